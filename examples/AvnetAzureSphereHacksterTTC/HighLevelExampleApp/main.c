@@ -860,6 +860,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Let IoT Hub acknowledge in flight messages and reported properties before closing, with the
+    // timers stopped so nothing new is published meanwhile
+    dx_timerSetStop(timer_bindings, NELEMS(timer_bindings));
+    dx_terminateDrain(DX_TERMINATE_DRAIN_DEADLINE_MS, NULL);
+
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting.\n");
     return dx_getTerminationExitCode();
@@ -141,6 +141,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Let IoT Hub acknowledge in flight messages and reported properties before closing, with the
+    // timers stopped so nothing new is published meanwhile
+    dx_timerSetStop(timers, NELEMS(timers));
+    dx_terminateDrain(DX_TERMINATE_DRAIN_DEADLINE_MS, NULL);
+
     ClosePeripheralsAndHandlers();
     return dx_getTerminationExitCode();
 }
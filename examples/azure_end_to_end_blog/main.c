@@ -40,6 +40,7 @@
 #include "dx_azure_iot.h"
 #include "dx_config.h"
 #include "dx_exit_codes.h"
+#include "dx_json_pool.h"
 #include "dx_json_serializer.h"
 #include "dx_terminate.h"
 #include "dx_timer.h"
@@ -297,6 +298,9 @@ static void NetworkConnectionState(bool connected)
 /// </summary>
 static void InitPeripheralsAndHandlers(void)
 {
+    // Serve parson from static slabs, before anything parses or builds JSON
+    dx_jsonPoolInit();
+
     dx_azureConnect(&dx_config, NETWORK_INTERFACE, IOT_PLUG_AND_PLAY_MODEL_ID);
     dx_gpioSetOpen(gpio_bindings, NELEMS(gpio_bindings));
     dx_timerSetStart(timer_bindings, NELEMS(timer_bindings));
@@ -337,6 +341,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Let IoT Hub acknowledge in flight messages and reported properties before closing, with the
+    // timers stopped so nothing new is published meanwhile
+    dx_timerSetStop(timer_bindings, NELEMS(timer_bindings));
+    dx_terminateDrain(DX_TERMINATE_DRAIN_DEADLINE_MS, NULL);
+
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting.\n");
     return dx_getTerminationExitCode();
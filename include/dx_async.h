@@ -0,0 +1,62 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_timer.h"
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef DX_ASYNC_QUEUE_LENGTH
+#define DX_ASYNC_QUEUE_LENGTH 256 // must be a power of two
+#endif
+
+#ifndef DX_ASYNC_BATCH_SIZE
+#define DX_ASYNC_BATCH_SIZE 64 // handlers run per event loop dispatch, so a busy producer can't starve timers
+#endif
+
+typedef void (*DX_ASYNC_HANDLER)(void *arg);
+
+/// <summary>
+/// Hand work from other threads to the event loop thread. Worker threads post a handler and
+/// argument, the event loop runs them in posting order, where calling dx_azurePublish, twin,
+/// timer and other single threaded DevX functions is safe. Posting is lock free and wakes the
+/// event loop through an eventfd only when it is not already due to run the queue.
+/// </summary>
+
+/// <summary>
+/// Register the queue with the event loop. Call from the event loop thread before starting
+/// threads that post.
+/// </summary>
+/// <returns>false if the eventfd could not be created or registered</returns>
+bool dx_asyncInit(void);
+
+/// <summary>
+/// Queue handler(arg) to run on the event loop thread. Safe to call from any thread, including
+/// from an async handler.
+/// </summary>
+/// <param name="handler"></param>
+/// <param name="arg">Passed to handler, must stay valid until the handler has run</param>
+/// <returns>false if the queue is full or not initialized, arg is then still owned by the caller</returns>
+bool dx_asyncPost(DX_ASYNC_HANDLER handler, void *arg);
+
+/// <summary>
+/// Number of posts that failed because the queue was full
+/// </summary>
+unsigned long dx_asyncDroppedCount(void);
+
+/// <summary>
+/// Run everything queued so far on the calling thread, used at shutdown when the event loop no
+/// longer runs. Must be called from the event loop thread.
+/// </summary>
+/// <returns>The number of handlers run</returns>
+size_t dx_asyncDrain(void);
+
+/// <summary>
+/// Unregister from the event loop and dx_terminateDrain, then close the eventfd. Threads that
+/// post must have stopped.
+/// Queued handlers that have not run are discarded, call dx_asyncDrain first to run them.
+/// </summary>
+void dx_asyncClose(void);
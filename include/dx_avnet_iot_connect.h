@@ -23,6 +23,8 @@ SOFTWARE.
 */
 
 #include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <applibs/log.h>
@@ -38,12 +40,56 @@ SOFTWARE.
 #include "dx_utilities.h"
 #include "dx_azure_iot.h"
 #include "dx_config.h"
+#include "dx_storage.h"
 
 #define DX_AVNET_IOT_CONNECT_GUID_LEN 36
 #define DX_AVNET_IOT_CONNECT_SID_LEN 64
 #define DX_AVNET_IOT_CONNECT_METADATA 256
 #define DX_AVNET_IOT_CONNECT_JSON_BUFFER_SIZE 512
 
+// How long a session saved to mutable storage is reused after a restart or reconnect, so telemetry
+// can start as soon as IoT Hub connects instead of after the hello response.  0, the default,
+// disables the session cache.  Enabling it needs "MutableStorage" in the app_manifest.json
+// capabilities, for example {"SizeKB": 16}.
+#ifndef DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS
+#define DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS 0
+#endif
+
+// Largest saved session including the child list, gateways with more children are not cached
+#ifndef DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE
+#define DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE 4096
+#endif
+
+// The hello is resent after HELLO_RETRY_MIN_SECONDS without a response, doubling the wait after
+// each attempt up to HELLO_RETRY_MAX_SECONDS
+#ifndef DX_AVNET_IOT_CONNECT_HELLO_RETRY_MIN_SECONDS
+#define DX_AVNET_IOT_CONNECT_HELLO_RETRY_MIN_SECONDS 5
+#endif
+
+#ifndef DX_AVNET_IOT_CONNECT_HELLO_RETRY_MAX_SECONDS
+#define DX_AVNET_IOT_CONNECT_HELLO_RETRY_MAX_SECONDS 120
+#endif
+
+// Telemetry messages dx_avnetPublish holds until IoTConnect is ready, the oldest is dropped first
+#ifndef DX_AVNET_IOT_CONNECT_QUEUE_LENGTH
+#define DX_AVNET_IOT_CONNECT_QUEUE_LENGTH 16
+#endif
+
+// Largest message dx_avnetPublish sends, telemetry plus the IoTConnect envelope
+#ifndef DX_AVNET_IOT_CONNECT_PUBLISH_BUFFER_SIZE
+#define DX_AVNET_IOT_CONNECT_PUBLISH_BUFFER_SIZE 2048
+#endif
+
+// Number of C2D response (ct) plus command (cmdType) handlers, including the library's own
+#ifndef DX_AVNET_IOT_CONNECT_MAX_C2D_HANDLERS
+#define DX_AVNET_IOT_CONNECT_MAX_C2D_HANDLERS 16
+#endif
+
+// C2D messages up to this size are parsed from a static buffer, larger ones are copied to the heap
+#ifndef DX_AVNET_IOT_CONNECT_C2D_BUFFER_SIZE
+#define DX_AVNET_IOT_CONNECT_C2D_BUFFER_SIZE 1024
+#endif
+
 // The gateway field length is long to acomidate long ids from child devices
 #define DX_AVNET_IOT_CONNECT_GW_FIELD_LEN 128+64
 
@@ -72,21 +118,41 @@ typedef enum
     AVT_RESPONSE_CODE_UID_ALREADY_EXISTS = 8
 } AVT_IOTC_221_RESPONSE_CODES;
 
-// Linked list node definition
+// Linked list node definition.  Nodes are owned by the library and keep their address until the
+// child is removed.  The fields after id are internal to the library.
 typedef struct node {
 	struct node* next;
 	struct node* prev;
 	char tg[DX_AVNET_IOT_CONNECT_GW_FIELD_LEN];
 	char id[DX_AVNET_IOT_CONNECT_GW_FIELD_LEN];
+	struct node* hashNext; // internal, next node in the same id hash bucket
+	uint32_t hash;         // internal, hash of id
+	uint32_t syncMark;     // internal, last 204 child sync that listed this child
 } gw_child_list_node_t;
 
+typedef enum
+{
+	DX_AVNET_CHILD_ADDED,
+	DX_AVNET_CHILD_REMOVED,
+	DX_AVNET_CHILD_RETAGGED
+} DX_AVNET_CHILD_CHANGE;
+
+/// <summary>
+/// Called for each change to the children list.  For DX_AVNET_CHILD_REMOVED the node is freed
+/// once the callback returns, for DX_AVNET_CHILD_RETAGGED previousTag holds the old tag and is
+/// NULL otherwise.  When the whole list is cleared the children are already gone from lookups
+/// while their callbacks run.  Don't add or delete children from inside the callback.
+/// </summary>
+typedef void (*DX_AVNET_CHILD_CHANGED_HANDLER)(DX_AVNET_CHILD_CHANGE change, gw_child_list_node_t* child, const char* previousTag);
+
 /// <summary>
 /// Takes properly formatted JSON telemetry data and wraps it with ToTConnect
 /// metaData.  Returns false if the application has not received the IoTConnect hello
 /// response, if the passed in buffer is too small for the modified JSON document, or
 /// if the passed in JSON is malformed.  If childDevice is passed in is non-NULL, the payload
 /// will be formatted for a gateway child device using the id and tag values set in the
-/// gw_child_list_note_t structure.
+/// gw_child_list_note_t structure.  The telemetry is checked without being parsed into a
+/// document, define DX_AVNET_IOT_CONNECT_TRUSTED_PAYLOAD to skip the check entirely.
 /// </summary>
 /// <param name="originalJsonMessage"></param>
 /// <param name="modifiedJsonMessage"></param>
@@ -110,7 +176,12 @@ bool dx_avnetJsonSerializePayload(const char *originalJsonMessage, char *modifie
 bool dx_avnetJsonSerialize(char * jsonMessageBuffer, size_t bufferSize, gw_child_list_node_t* childDevice, int key_value_pair_count, ...);
 
 /// <summary>
-/// Initializes the IoTConnect timer.  This routine should be called on application init
+/// Initializes the IoTConnect timer.  This routine should be called on application init.
+/// If DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS is set and a session saved by an earlier run has
+/// not expired it is restored, and dx_isAvnetConnected returns true as soon as IoT Hub connects.
+/// The hello handshake then revalidates it in the background and any change to the sid, dtg or
+/// child list replaces the saved session.  The session is kept with dx_storage, so
+/// app_manifest.json needs MutableStorage.
 /// </summary>
 /// <returns></returns>
 void dx_avnetConnect(DX_USER_CONFIG *userConfig, const char *networkInterface);
@@ -122,8 +193,50 @@ void dx_avnetConnect(DX_USER_CONFIG *userConfig, const char *networkInterface);
 bool dx_isAvnetConnected(void);
 
 /// <summary>
-/// Finds the child node in the linked list by id and returns
-/// a pointer to the child node.
+/// Register to be told when IoTConnect becomes ready for telemetry, or stops being ready, instead
+/// of polling dx_isAvnetConnected.  Up to 5 callbacks can be registered.
+/// </summary>
+/// <param name="readyCallback"></param>
+/// <returns>false if the maximum number of callbacks is already registered</returns>
+bool dx_avnetRegisterReadyNotification(void (*readyCallback)(bool ready));
+
+/// <summary>
+/// Unregister a callback registered with dx_avnetRegisterReadyNotification
+/// </summary>
+/// <param name="readyCallback"></param>
+void dx_avnetUnregisterReadyNotification(void (*readyCallback)(bool ready));
+
+/// <summary>
+/// Wraps telemetryJson with the IoTConnect envelope and publishes it.  Telemetry published before
+/// IoTConnect is ready, or while IoT Hub can't be reached, is copied to a queue of
+/// DX_AVNET_IOT_CONNECT_QUEUE_LENGTH messages and sent, in order, as soon as the connection is
+/// ready.  Queued telemetry for a child that is removed in the meantime is dropped.
+/// </summary>
+/// <param name="telemetryJson">JSON object holding the telemetry</param>
+/// <param name="childDevice">NULL unless sending for a gateway child</param>
+/// <returns>true if the telemetry was sent or queued</returns>
+bool dx_avnetPublish(const char *telemetryJson, gw_child_list_node_t* childDevice);
+
+typedef struct DX_AVNET_CONNECTION_STATS {
+    int64_t readyMilliseconds;     // IoT Hub connection to telemetry being accepted, -1 until it happens
+    int64_t validatedMilliseconds; // IoT Hub connection to the hello handshake completing, -1 until it happens
+    uint32_t helloAttempts;        // hellos sent since the last IoT Hub connection
+    size_t queued;                 // telemetry queued by dx_avnetPublish
+    size_t flushed;                // queued telemetry sent once ready
+    size_t dropped;                // queued telemetry lost to a full queue, a removed child or a bad payload
+} DX_AVNET_CONNECTION_STATS;
+
+/// <summary>
+/// Reports how long the last (re)connection took to become ready and what happened to the
+/// telemetry published while it wasn't.  The counts are totals since start up.
+/// </summary>
+/// <param name="stats"></param>
+void dx_avnetGetConnectionStats(DX_AVNET_CONNECTION_STATS *stats);
+
+/// <summary>
+/// Finds the child node by id and returns a pointer to the child node.
+/// The lookup is hashed, and the pointer stays valid until the child is
+/// removed, so it can be kept and passed to the serialize functions.
 /// </summary>
 /// <parm name="id"></param>
 /// <returns></returns>
@@ -165,8 +278,101 @@ gw_child_list_node_t* dx_avnetGetFirstChild(void);
 /// <returns></returns>
 gw_child_list_node_t* dx_avnetGetNextChild(gw_child_list_node_t* currentChild);
 
+/// <summary>
+/// Handles an IoTConnect C2D message.  For responses properties is the "d" object, for commands
+/// it is the "data" object, or the whole message if there isn't one.  The message is parsed in
+/// place, copy any strings that need to outlive the call.  Return false if the message could not
+/// be processed.
+/// </summary>
+typedef bool (*DX_AVNET_C2D_HANDLER)(JSON_Object* properties);
+
+/// <summary>
+/// Route IoTConnect responses carrying {"d":{"ct":ct,...}} to handler.  The library handles ct
+/// 200, 204, 221 and 222 itself.  IoTConnect takes messages with a top level "d" or "cmdType"
+/// member through its own dx_azureSubscribeMessages subscriptions, those without a handler are
+/// logged and accepted.  Anything else goes to the app's subscriptions or the callback registered
+/// with dx_azureRegisterMessageReceivedNotification.
+/// </summary>
+/// <param name="ct"></param>
+/// <param name="handler"></param>
+/// <returns>false if ct already has a handler or the handler table is full</returns>
+bool dx_avnetRegisterResponseHandler(int ct, DX_AVNET_C2D_HANDLER handler);
+
+/// <summary>
+/// Route IoTConnect commands carrying {"cmdType":"0x..",...} to handler, for example 0x01 for
+/// device commands.  See dx_avnetRegisterResponseHandler for messages without a handler.
+/// </summary>
+/// <param name="cmdType"></param>
+/// <param name="handler"></param>
+/// <returns>false if cmdType already has a handler or the handler table is full</returns>
+bool dx_avnetRegisterCommandHandler(int cmdType, DX_AVNET_C2D_HANDLER handler);
+
+/// <summary>
+/// Register for changes to the children list.  The 204 child sync compares the child list sent by
+/// IoTConnect against the current list and only applies, and reports, the children that were
+/// added, removed or retagged.  Children added or deleted through 221/222 responses and children
+/// restored from a saved session are reported too.
+/// </summary>
+/// <param name="childChangedHandler"></param>
+/// <returns>false if the maximum number of handlers is already registered</returns>
+bool dx_avnetRegisterChildChangedNotification(DX_AVNET_CHILD_CHANGED_HANDLER childChangedHandler);
+
+/// <summary>
+/// Unregister a handler registered with dx_avnetRegisterChildChangedNotification
+/// </summary>
+/// <param name="childChangedHandler"></param>
+/// <returns></returns>
+void dx_avnetUnregisterChildChangedNotification(DX_AVNET_CHILD_CHANGED_HANDLER childChangedHandler);
+
 /// <summary>
 /// Outputs all child devices in the children list to debug
 /// </summary>
 /// <returns></returns>
-void dx_avnetPrintGwChildrenList(void);
\ No newline at end of file
+void dx_avnetPrintGwChildrenList(void);
+
+/// <summary>
+/// Builds IoTConnect telemetry messages holding an {id, tg, d} entry for many children, so a
+/// gateway sends a few large messages per cycle instead of one per child. The message is built
+/// in the buffer passed to dx_avnetBatchInit, whose size is the byte budget for each message.
+/// The totals are kept since init, read them to report messages and bytes per cycle.
+/// </summary>
+typedef struct DX_AVNET_BATCH {
+    DX_JSON_WRITER writer;
+    size_t entries;        // entries in the message being built
+    size_t messagesSent;
+    size_t entriesSent;
+    size_t bytesSent;
+    size_t entriesQueued;  // entries handed to dx_avnetPublish because the message could not go out
+    size_t entriesDropped; // entries too large for an empty message, or that could not be queued
+} DX_AVNET_BATCH;
+
+/// <summary>
+/// Prepares a batch that builds messages in buffer
+/// </summary>
+/// <param name="batch"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize">Byte budget for each message</param>
+void dx_avnetBatchInit(DX_AVNET_BATCH *batch, char *buffer, size_t bufferSize);
+
+/// <summary>
+/// Appends telemetry for childDevice, or for the gateway itself when childDevice is NULL.
+/// telemetryJson must be a serialized JSON object, for example from dx_jsonSerialize or a
+/// DX_JSON_SCHEMA serializer, invalid JSON is dropped. If the entry does not fit, the message
+/// built so far is flushed and the entry starts the next one. Returns false if the entry was
+/// dropped.
+/// </summary>
+/// <param name="batch"></param>
+/// <param name="childDevice"></param>
+/// <param name="telemetryJson"></param>
+/// <returns></returns>
+bool dx_avnetBatchAdd(DX_AVNET_BATCH *batch, gw_child_list_node_t *childDevice, const char *telemetryJson);
+
+/// <summary>
+/// Publishes the message built so far, call at the end of each telemetry cycle. Follows the same
+/// rules as dx_avnetPublish: until IoTConnect is ready, while older telemetry is queued, or if
+/// the publish fails, the entries are queued one by one through dx_avnetPublish instead of being
+/// sent as one message. Returns false if an entry had to be dropped.
+/// </summary>
+/// <param name="batch"></param>
+/// <returns></returns>
+bool dx_avnetBatchFlush(DX_AVNET_BATCH *batch);
@@ -46,6 +46,29 @@ typedef struct DX_MESSAGE_CONTENT_PROPERTIES {
     const char *contentType;
 } DX_MESSAGE_CONTENT_PROPERTIES;
 
+#ifndef DX_AZURE_MAX_MESSAGE_SUBSCRIPTIONS
+#define DX_AZURE_MAX_MESSAGE_SUBSCRIPTIONS 32
+#endif
+
+typedef enum {
+    DX_MESSAGE_MATCH_ALL,          // every cloud to device message
+    DX_MESSAGE_MATCH_PROPERTY,     // application property key, equal to value or just present if value is NULL
+    DX_MESSAGE_MATCH_CONTENT_TYPE, // content type equal to value
+    DX_MESSAGE_MATCH_JSON_MEMBER   // top level JSON member key, equal to value or just present if value is NULL.
+                                   // value is compared to a string with its escapes decoded, or to the JSON text of
+                                   // other values
+} DX_MESSAGE_MATCH;
+
+typedef struct _messageSubscription {
+    DX_MESSAGE_MATCH match;
+    const char *key;
+    const char *value;
+    // payload points into the IoT Hub message and is only valid during the call, it isn't null terminated
+    IOTHUBMESSAGE_DISPOSITION_RESULT (*handler)(struct _messageSubscription *subscription, const void *payload, size_t payloadLength,
+                                                IOTHUB_MESSAGE_HANDLE message);
+    void *context;
+} DX_MESSAGE_SUBSCRIPTION;
+
 /// <summary>
 /// Check if there is a network connection and an authenticated connection to Azure IoT Hub/Central
 /// </summary>
@@ -88,11 +111,33 @@ void dx_azureConnect(DX_USER_CONFIG *userConfig, const char *networkInterface, c
 /// <param name=""></param>
 void dx_azureToDeviceStop(void);
 
+typedef IOTHUBMESSAGE_DISPOSITION_RESULT (*DX_MESSAGE_RECEIVED_HANDLER)(IOTHUB_MESSAGE_HANDLE message, void *context);
+
+/// <summary>
+/// Subscribe to cloud to device messages matching a filter.  Every matching subscription is
+/// called with a view of the payload, nothing is copied.  The message is rejected only if every
+/// matching handler rejected it, abandoned if any abandoned it and none accepted it, and accepted
+/// otherwise.  Messages no subscription matches go to the callback registered with
+/// dx_azureRegisterMessageReceivedNotification.  Subscriptions may unsubscribe from their handler.
+/// </summary>
+/// <param name="subscription">Kept by reference, must stay valid while subscribed</param>
+/// <returns>false if DX_AZURE_MAX_MESSAGE_SUBSCRIPTIONS are already subscribed</returns>
+bool dx_azureSubscribeMessages(DX_MESSAGE_SUBSCRIPTION *subscription);
+
+/// <summary>
+/// Remove a subscription added with dx_azureSubscribeMessages
+/// </summary>
+/// <param name="subscription"></param>
+void dx_azureUnsubscribeMessages(DX_MESSAGE_SUBSCRIPTION *subscription);
+
 /// <summary>
-/// Register for new message recieved from Azure IoT
+/// Register for new message recieved from Azure IoT.  Returns the callback it replaces, so a
+/// module taking over messages can pass on the ones it doesn't handle.  This callback receives
+/// the messages no dx_azureSubscribeMessages subscription matched.
 /// </summary>
 /// <param name="messageReceivedCallback"></param>
-void dx_azureRegisterMessageReceivedNotification(IOTHUBMESSAGE_DISPOSITION_RESULT (*messageReceivedCallback)(IOTHUB_MESSAGE_HANDLE message, void *context));
+/// <returns>The previously registered callback or NULL</returns>
+DX_MESSAGE_RECEIVED_HANDLER dx_azureRegisterMessageReceivedNotification(DX_MESSAGE_RECEIVED_HANDLER messageReceivedCallback);
 
 /// <summary>
 /// Register to be notified of change in Azure IoT Connection status
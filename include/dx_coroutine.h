@@ -0,0 +1,145 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_intercore.h"
+#include "dx_timer.h"
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// <summary>
+/// Stackless coroutines for multi-step sequences such as sensor bring-up. Instead of calling
+/// nanosleep or a blocking recv a handler awaits a delay, fd readiness or an intercore reply.
+/// The handler returns to the event loop at each await and is called again from the point it
+/// left off when the wait completes, so timers and other handlers keep running in between.
+///
+///     static DX_COROUTINE_HANDLER(imu_bringup_handler)
+///         imu_power_on();
+///         DX_AWAIT_DELAY(20);  // sensor boot time
+///
+///         DX_AWAIT_UNTIL(imu_reset_done(), 5);
+///         ...
+///     DX_COROUTINE_HANDLER_END
+///
+///     static DX_COROUTINE_BINDING imu_bringup = {.handler = imu_bringup_handler, .name = "imu_bringup"};
+///     dx_coroutineStart(&imu_bringup);
+///
+/// The handler is re-entered through a switch statement, so local variables do not keep their
+/// values across an await: keep state in static variables or behind coroutine->context. Only one
+/// await per source line, and awaits can't be used inside a switch statement of the handler.
+/// Everything runs on the event loop thread.
+/// </summary>
+
+typedef enum {
+    DX_COROUTINE_WAITING,
+    DX_COROUTINE_DONE
+} DX_COROUTINE_STATE;
+
+typedef struct _coroutineBinding {
+    DX_COROUTINE_STATE (*handler)(struct _coroutineBinding *coroutine);
+    const char *name;
+    void *context;
+    // Results of the last await
+    bool timedOut;                    // the fd or intercore await hit its timeout
+    EventLoop_IoEvents events;        // events seen by DX_AWAIT_FD
+    ssize_t received;                 // bytes DX_AWAIT_INTERCORE read into intercore_recv_block, -1 on timeout or error
+    // Used by the library
+    int resumePoint;
+    bool running;
+    int64_t wakeNs;
+    struct _coroutineBinding *nextSleeper;
+    EventRegistration *registration;
+    DX_INTERCORE_BINDING *intercore;
+} DX_COROUTINE_BINDING;
+
+#define DX_COROUTINE_HANDLER(name)                                  \
+    DX_COROUTINE_STATE name(DX_COROUTINE_BINDING *coroutine)        \
+    {                                                               \
+        switch (coroutine->resumePoint) {                           \
+        case 0:
+
+#define DX_COROUTINE_HANDLER_END \
+    }                            \
+    return DX_COROUTINE_DONE;    \
+    }
+
+#define DX_DECLARE_COROUTINE_HANDLER(name) DX_COROUTINE_STATE name(DX_COROUTINE_BINDING *coroutine)
+
+// Record where to resume and return to the event loop. A wait that could not be set up has
+// logged why and ends the coroutine.
+#define DX_COROUTINE_AWAIT_(wait)                                  \
+    do {                                                           \
+        coroutine->resumePoint = __LINE__;                         \
+        return (wait) ? DX_COROUTINE_WAITING : DX_COROUTINE_DONE;  \
+        case __LINE__:;                                            \
+    } while (0)
+
+/// <summary>
+/// Resume after milliseconds have passed
+/// </summary>
+#define DX_AWAIT_DELAY(milliseconds) DX_COROUTINE_AWAIT_(dx_coroutineWaitDelay(coroutine, (milliseconds)))
+
+/// <summary>
+/// Let the rest of the event loop run, then resume
+/// </summary>
+#define DX_COROUTINE_YIELD() DX_AWAIT_DELAY(0)
+
+/// <summary>
+/// Resume once condition is true, checking it every pollMilliseconds. For registers that have
+/// no interrupt line, such as a sensor's data ready or reset done flag.
+/// </summary>
+#define DX_AWAIT_UNTIL(condition, pollMilliseconds) \
+    while (!(condition))                            \
+    DX_AWAIT_DELAY(pollMilliseconds)
+
+/// <summary>
+/// Resume when fd is ready for events or timeoutMilliseconds have passed, zero waits without a
+/// timeout. Check coroutine->timedOut and coroutine->events afterwards.
+/// </summary>
+#define DX_AWAIT_FD(fd, events, timeoutMilliseconds) \
+    DX_COROUTINE_AWAIT_(dx_coroutineWaitFd(coroutine, (fd), (events), (timeoutMilliseconds)))
+
+/// <summary>
+/// Resume when the real time app replies on intercore_binding, after the request has been sent
+/// with dx_intercorePublish. The reply is read into intercore_recv_block and its length stored
+/// in coroutine->received. The binding must be connected and have no interCoreCallback, the
+/// callback would consume the reply.
+/// </summary>
+#define DX_AWAIT_INTERCORE(intercore_binding, timeoutMilliseconds) \
+    DX_COROUTINE_AWAIT_(dx_coroutineWaitIntercore(coroutine, (intercore_binding), (timeoutMilliseconds)))
+
+/// <summary>
+/// Finish the coroutine from anywhere in its handler
+/// </summary>
+#define DX_COROUTINE_EXIT() return DX_COROUTINE_DONE
+
+/// <summary>
+/// Run the coroutine from the top until its first await. Call from the event loop thread.
+/// </summary>
+/// <param name="coroutine"></param>
+/// <returns>false if it is already running</returns>
+bool dx_coroutineStart(DX_COROUTINE_BINDING *coroutine);
+
+/// <summary>
+/// Abandon the coroutine at its current await. It can be started again from the top.
+/// </summary>
+/// <param name="coroutine"></param>
+void dx_coroutineStop(DX_COROUTINE_BINDING *coroutine);
+
+/// <summary>
+/// True from dx_coroutineStart until the handler finishes or dx_coroutineStop is called
+/// </summary>
+bool dx_coroutineIsRunning(DX_COROUTINE_BINDING *coroutine);
+
+void dx_coroutineSetStart(DX_COROUTINE_BINDING *coroutineSet[], size_t coroutineCount);
+void dx_coroutineSetStop(DX_COROUTINE_BINDING *coroutineSet[], size_t coroutineCount);
+
+// Used by the await macros, return false if the wait could not be set up
+bool dx_coroutineWaitDelay(DX_COROUTINE_BINDING *coroutine, uint32_t milliseconds);
+bool dx_coroutineWaitFd(DX_COROUTINE_BINDING *coroutine, int fd, EventLoop_IoEvents events, uint32_t timeoutMilliseconds);
+bool dx_coroutineWaitIntercore(DX_COROUTINE_BINDING *coroutine, DX_INTERCORE_BINDING *intercore_binding,
+                               uint32_t timeoutMilliseconds);
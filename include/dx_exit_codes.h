@@ -49,6 +49,7 @@ typedef enum {
 
 	DX_ExitCode_Init_IoTCTimer = 220,
 	DX_ExitCode_IoTCTimer_Consume = 219,
+	DX_ExitCode_Init_IoTCSubscribe = 218,
 
 	DX_ExitCode_Uart_Open_Failed = 215,
 	DX_ExitCode_Uart_Read_Failed = 214,
@@ -63,4 +64,5 @@ typedef enum {
     DX_ExitCode_I2C_SetTimeout_Failed = 207,
 
 	DX_ExitCode_Create_Timer_Failed = 206,
+	DX_ExitCode_Json_Path_Compile_Failed = 205,
 } ExitCode;
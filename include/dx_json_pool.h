@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "parson.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of blocks in each size class. Override from CMake to tune the static footprint,
+// the defaults reserve 24 KB. Use dx_jsonPoolGetStats high water marks to size them for an app.
+#ifndef DX_JSON_POOL_BLOCKS_16
+#define DX_JSON_POOL_BLOCKS_16 384
+#endif
+
+#ifndef DX_JSON_POOL_BLOCKS_32
+#define DX_JSON_POOL_BLOCKS_32 192
+#endif
+
+#ifndef DX_JSON_POOL_BLOCKS_64
+#define DX_JSON_POOL_BLOCKS_64 64
+#endif
+
+#ifndef DX_JSON_POOL_BLOCKS_128
+#define DX_JSON_POOL_BLOCKS_128 32
+#endif
+
+#ifndef DX_JSON_POOL_BLOCKS_256
+#define DX_JSON_POOL_BLOCKS_256 16
+#endif
+
+#define DX_JSON_POOL_CLASS_COUNT 5
+
+typedef struct DX_JSON_POOL_CLASS_STATS {
+    size_t blockSize;
+    size_t blockCount;
+    size_t inUse;
+    size_t highWater;
+} DX_JSON_POOL_CLASS_STATS;
+
+typedef struct DX_JSON_POOL_STATS {
+    DX_JSON_POOL_CLASS_STATS sizeClass[DX_JSON_POOL_CLASS_COUNT];
+    size_t fallbackInUse;          // blocks currently allocated with malloc
+    size_t fallbackHighWater;      // most malloc blocks live at once
+    size_t fallbackBytesHighWater; // most malloc bytes live at once
+    size_t fallbackTotal;          // malloc calls since init or reset
+} DX_JSON_POOL_STATS;
+
+/// <summary>
+/// Route all parson allocations through fixed size slabs held in static memory.
+/// Requests are served from the smallest class that fits, spilling into larger classes and then
+/// malloc when the slabs are exhausted. Call once at startup before any JSON is parsed or built,
+/// memory allocated by parson before the pool is installed must not be freed afterwards.
+/// </summary>
+void dx_jsonPoolInit(void);
+
+/// <summary>
+/// Return the slabs to a fragmentation free state once every document has been freed, for
+/// example after a message has been handled. The free lists are rebuilt in address order, so
+/// later documents are laid out compactly again. High water marks are kept. Compiled JSON_Path
+/// objects are not pool memory and are unaffected.
+/// </summary>
+/// <returns>false, leaving the pool untouched, while any JSON_Value or serialized string is live</returns>
+bool dx_jsonPoolReset(void);
+
+/// <summary>
+/// Snapshot of per class usage and malloc fallback counters
+/// </summary>
+/// <param name="stats"></param>
+void dx_jsonPoolGetStats(DX_JSON_POOL_STATS *stats);
+
+/// <summary>
+/// Pool allocation functions, exposed so they can be wrapped or used by other modules
+/// </summary>
+void *dx_jsonPoolMalloc(size_t size);
+void dx_jsonPoolFree(void *ptr);
@@ -3,6 +3,7 @@
 #include "parson.h"
 #include "stdarg.h"
 #include "stdbool.h"
+#include "stdint.h"
 #include "stdio.h"
 #include "string.h"
 
@@ -21,8 +22,131 @@ typedef enum {
 /// <param name="buffer_size">Size of JSON string</param>
 /// <param name="key_value_pair_count">The number of Key Value Pairs to serialize as JSON</param>
 /// <param name="">
-/// Data to be serialised must be passed in groups of three (JSON type, key name, key value). The value passed must match the type. 
+/// Data to be serialised must be passed in groups of three (JSON type, key name, key value). The value passed must match the type.
 /// Examples: DX_JSON_DOUBLE, "Temperature", temperature, DX_JSON_INT, "Humidity", humidity, DX_JSON_STRING, "Status", "cooling"
 /// </param>
-/// <returns></returns>
-bool dx_jsonSerialize(char* buffer, size_t buffer_size, int key_value_pair_count, ...);
\ No newline at end of file
+/// <returns>false if the buffer is too small, buffer then holds an empty string</returns>
+bool dx_jsonSerialize(char* buffer, size_t buffer_size, int key_value_pair_count, ...);
+
+/// <summary>
+/// Appends JSON text to a fixed buffer without allocating. Once the buffer is full further writes
+/// are dropped and dx_jsonWriterFinish returns false.
+/// </summary>
+typedef struct DX_JSON_WRITER {
+    char *buffer;
+    size_t size;
+    size_t length;
+    bool overflow;
+} DX_JSON_WRITER;
+
+void dx_jsonWriterInit(DX_JSON_WRITER *writer, char *buffer, size_t size);
+void dx_jsonWriterRaw(DX_JSON_WRITER *writer, const char *data, size_t length);
+// Append a string literal, its length is taken at compile time
+#define dx_jsonWriterLiteral(writer, literal) dx_jsonWriterRaw((writer), "" literal, sizeof(literal) - 1)
+void dx_jsonWriterBool(DX_JSON_WRITER *writer, bool value);
+void dx_jsonWriterInt(DX_JSON_WRITER *writer, int value);
+void dx_jsonWriterUint64(DX_JSON_WRITER *writer, uint64_t value); // counters and totals, uint32_t widens to this
+// %.9g, enough digits for any float to read back unchanged but not the shortest form, 0.1f writes
+// 0.100000001. dx_jsonSerialize widens DX_JSON_FLOAT to double and writes %1.17g, 0.10000000149011612
+void dx_jsonWriterFloat(DX_JSON_WRITER *writer, float value);
+void dx_jsonWriterDouble(DX_JSON_WRITER *writer, double value); // %.17g, same as parson
+void dx_jsonWriterString(DX_JSON_WRITER *writer, const char *value); // quoted and escaped as parson does, NULL writes null
+
+/// <summary>
+/// Null terminate the output. Returns false if anything was dropped for lack of space.
+/// </summary>
+bool dx_jsonWriterFinish(DX_JSON_WRITER *writer);
+
+/// <summary>
+/// Compile time JSON schemas. Describe a message once as an X-macro of (type, member, "key") entries
+/// and DX_JSON_SCHEMA generates a struct plus serialize and parse functions for it. Keys are turned
+/// into quoted fragments at compile time and each member is written with the writer matching its
+/// declared type, so there is no runtime key formatting and no va_list to get wrong.
+///
+/// Generated functions:
+///   bool NAME_serialize(const NAME *data, char *buffer, size_t size)
+///   void NAME_write(const NAME *data, DX_JSON_WRITER *writer)   - write the object into a larger document
+///   bool NAME_parse(NAME *data, const JSON_Object *object)     - false if a member is missing or mistyped,
+///                                                                 strings point into the parsed document
+/// </summary>
+/*
+    #define TELEMETRY_FIELDS(FIELD)                           \
+        FIELD(DX_JSON_DOUBLE, temperature, "Temperature")     \
+        FIELD(DX_JSON_INT, humidity, "Humidity")              \
+        FIELD(DX_JSON_STRING, status, "Status")
+
+    DX_JSON_SCHEMA(TELEMETRY, TELEMETRY_FIELDS)
+
+    TELEMETRY telemetry = {.temperature = 21.5, .humidity = 40, .status = "cooling"};
+    TELEMETRY_serialize(&telemetry, msgBuffer, sizeof(msgBuffer));
+*/
+#define DX_JSON_SCHEMA(name, FIELDS)        \
+    DX_JSON_SCHEMA_STRUCT(name, FIELDS)     \
+    DX_JSON_SCHEMA_FUNCTIONS(name, FIELDS)
+
+#define DX_JSON_SCHEMA_STRUCT(name, FIELDS)  \
+    typedef struct name {                    \
+        FIELDS(DX_JSON_SCHEMA_MEMBER_)       \
+    } name;
+
+#define DX_JSON_SCHEMA_FUNCTIONS(name, FIELDS)                                                 \
+    static inline void name##_write(const name *data, DX_JSON_WRITER *writer)                  \
+    {                                                                                          \
+        size_t start = writer->length;                                                         \
+        FIELDS(DX_JSON_SCHEMA_WRITE_)                                                          \
+        if (!writer->overflow) {                                                               \
+            writer->buffer[start] = '{'; /* every key fragment starts with a comma */          \
+        }                                                                                      \
+        dx_jsonWriterLiteral(writer, "}");                                                     \
+    }                                                                                          \
+    static inline bool name##_serialize(const name *data, char *buffer, size_t size)          \
+    {                                                                                          \
+        DX_JSON_WRITER writer;                                                                 \
+        dx_jsonWriterInit(&writer, buffer, size);                                              \
+        name##_write(data, &writer);                                                           \
+        return dx_jsonWriterFinish(&writer);                                                   \
+    }                                                                                          \
+    static inline bool name##_parse(name *data, const JSON_Object *object)                    \
+    {                                                                                          \
+        bool complete = true;                                                                  \
+        FIELDS(DX_JSON_SCHEMA_READ_)                                                           \
+        return complete;                                                                       \
+    }
+
+// Implementation details of DX_JSON_SCHEMA, dispatched on the DX_JSON_TYPE token of each field
+#define DX_JSON_SCHEMA_MEMBER_(type, member, key) DX_JSON_CTYPE_##type member;
+
+#define DX_JSON_SCHEMA_WRITE_(type, member, key)   \
+    dx_jsonWriterLiteral(writer, ",\"" key "\":"); \
+    DX_JSON_WRITE_##type(writer, data->member);
+
+#define DX_JSON_SCHEMA_READ_(type, member, key)                                              \
+    if (json_object_has_value_of_type(object, key, DX_JSON_PARSON_TYPE_##type)) {             \
+        DX_JSON_READ_##type(data->member, object, key);                                        \
+    } else {                                                                                 \
+        complete = false;                                                                    \
+    }
+
+#define DX_JSON_CTYPE_DX_JSON_BOOL bool
+#define DX_JSON_CTYPE_DX_JSON_STRING const char *
+#define DX_JSON_CTYPE_DX_JSON_INT int
+#define DX_JSON_CTYPE_DX_JSON_FLOAT float
+#define DX_JSON_CTYPE_DX_JSON_DOUBLE double
+
+#define DX_JSON_WRITE_DX_JSON_BOOL dx_jsonWriterBool
+#define DX_JSON_WRITE_DX_JSON_STRING dx_jsonWriterString
+#define DX_JSON_WRITE_DX_JSON_INT dx_jsonWriterInt
+#define DX_JSON_WRITE_DX_JSON_FLOAT dx_jsonWriterFloat
+#define DX_JSON_WRITE_DX_JSON_DOUBLE dx_jsonWriterDouble
+
+#define DX_JSON_PARSON_TYPE_DX_JSON_BOOL JSONBoolean
+#define DX_JSON_PARSON_TYPE_DX_JSON_STRING JSONString
+#define DX_JSON_PARSON_TYPE_DX_JSON_INT JSONNumber
+#define DX_JSON_PARSON_TYPE_DX_JSON_FLOAT JSONNumber
+#define DX_JSON_PARSON_TYPE_DX_JSON_DOUBLE JSONNumber
+
+#define DX_JSON_READ_DX_JSON_BOOL(dest, object, key) dest = json_object_get_boolean(object, key) == 1
+#define DX_JSON_READ_DX_JSON_STRING(dest, object, key) dest = json_object_get_string(object, key)
+#define DX_JSON_READ_DX_JSON_INT(dest, object, key) dest = (int)json_object_get_number(object, key)
+#define DX_JSON_READ_DX_JSON_FLOAT(dest, object, key) dest = (float)json_object_get_number(object, key)
+#define DX_JSON_READ_DX_JSON_DOUBLE(dest, object, key) dest = json_object_get_number(object, key)
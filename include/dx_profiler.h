@@ -0,0 +1,128 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "eventloop_timer_utilities.h"
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Define DX_PROFILER_ENABLED to time every handler the library dispatches: timers, intercore
+// and UART events, IoT Hub DoWork, device twin and direct method handlers. Each dispatch costs
+// two clock_gettime calls and a table lookup, nothing is allocated.
+
+#ifndef DX_PROFILER_MAX_ENTRIES
+#define DX_PROFILER_MAX_ENTRIES 64 // handlers beyond this are counted together as "other"
+#endif
+
+#ifndef DX_PROFILER_DEFAULT_BUDGET_US
+#define DX_PROFILER_DEFAULT_BUDGET_US 10000 // handlers running longer hold up the event loop
+#endif
+
+#ifndef DX_PROFILER_MAX_DEPTH
+#define DX_PROFILER_MAX_DEPTH 8 // nested handlers tracked by dx_profilerRunning, e.g. a twin handler inside DoWork
+#endif
+
+#define DX_PROFILER_HISTOGRAM_BUCKETS EVENTLOOP_TIMER_HISTOGRAM_BUCKETS
+
+/// <summary>
+/// Run time statistics for one handler. Times include anything the handler dispatches itself,
+/// for example DoWork includes the twin and method handlers it calls. Histogram bucket n counts
+/// runs below 2^n microseconds, the same layout as DX_TIMER_STATS.
+/// </summary>
+typedef struct DX_PROFILER_ENTRY {
+    const void *key;
+    const char *name;
+    uint32_t count;
+    uint32_t overBudget; // runs longer than budgetUs
+    uint32_t budgetUs;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint32_t histogram[DX_PROFILER_HISTOGRAM_BUCKETS];
+} DX_PROFILER_ENTRY;
+
+#if defined(DX_PROFILER_ENABLED)
+#define DX_PROFILE(key, name, call)                         \
+    do {                                                    \
+        int64_t dx_profileStart_ = dx_profilerBegin();      \
+        dx_profilerEnter((key), (name), dx_profileStart_);  \
+        call;                                               \
+        dx_profilerEnd((key), (name), dx_profileStart_);    \
+    } while (0)
+#else
+#define DX_PROFILE(key, name, call) call
+#endif
+
+/// <summary>
+/// Timestamp to pass to dx_profilerEnd, CLOCK_MONOTONIC nanoseconds
+/// </summary>
+int64_t dx_profilerBegin(void);
+
+/// <summary>
+/// Mark the handler identified by key as running from start, for dx_profilerRunning. The matching
+/// dx_profilerEnd or dx_profilerRecord clears the mark.
+/// </summary>
+void dx_profilerEnter(const void *key, const char *name, int64_t start);
+
+/// <summary>
+/// The innermost handler running on the event loop thread. Safe to call from any thread, used by
+/// the watchdog to name the handler that stalled the loop.
+/// </summary>
+/// <param name="name">Set to the handler name, NULL if it has none</param>
+/// <param name="start">Set to when it started, CLOCK_MONOTONIC nanoseconds</param>
+/// <returns>false if no profiled handler is running</returns>
+bool dx_profilerRunning(const char **name, int64_t *start);
+
+/// <summary>
+/// Record one run of the handler identified by key, started at start
+/// </summary>
+/// <param name="key">Identifies the handler, usually its binding or function</param>
+/// <param name="name">Name shown in reports, may be NULL if set with dx_profilerName</param>
+/// <param name="start">Value returned by dx_profilerBegin</param>
+void dx_profilerEnd(const void *key, const char *name, int64_t start);
+
+/// <summary>
+/// Record one run of the handler identified by key that took runNs nanoseconds
+/// </summary>
+void dx_profilerRecord(const void *key, const char *name, int64_t runNs);
+
+/// <summary>
+/// Name a handler before it first runs, used for timers whose dispatch only knows the handler
+/// </summary>
+void dx_profilerName(const void *key, const char *name);
+
+/// <summary>
+/// Set the run time budget of a handler, or the default for handlers without their own when key
+/// is NULL. Each run over budget is counted, and logged when it sets a new maximum.
+/// </summary>
+/// <param name="key"></param>
+/// <param name="budgetUs"></param>
+/// <returns>false if the profiler table is full</returns>
+bool dx_profilerSetBudget(const void *key, uint32_t budgetUs);
+
+/// <summary>
+/// Find the handlers with the largest total run time, most expensive first
+/// </summary>
+/// <param name="top">Receives pointers into the profiler table, valid until dx_profilerReset</param>
+/// <param name="topCount">Size of top</param>
+/// <returns>Number of entries written</returns>
+size_t dx_profilerTop(const DX_PROFILER_ENTRY *top[], size_t topCount);
+
+/// <summary>
+/// Write the top handlers as a JSON object keyed by handler name, each with count, overBudget
+/// and the total (ms), average, p99 and maximum (us) run time. Suitable for dx_azurePublish.
+/// </summary>
+/// <returns>false if the buffer is too small</returns>
+bool dx_profilerSerialize(size_t topCount, char *buffer, size_t bufferSize);
+
+/// <summary>
+/// Log the top handlers, one line each
+/// </summary>
+void dx_profilerLog(size_t topCount);
+
+/// <summary>
+/// Clear the statistics, keeping handler names and budgets, so each report covers one interval
+/// </summary>
+void dx_profilerReset(void);
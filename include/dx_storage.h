@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DX_STORAGE_SLOT_SIZE
+#define DX_STORAGE_SLOT_SIZE 8192 // room for all records, the storage file holds two slots
+#endif
+
+// Record tags used by the library. Applications can use any other value.
+#define DX_STORAGE_TAG_AVNET_SESSION 0x44584153 // "DXAS"
+#define DX_STORAGE_TAG_WATCHDOG 0x44585744      // "DXWD"
+
+/// <summary>
+/// Small tagged records kept in the application's mutable storage file. Every change writes all
+/// records to the other of two slots and only then becomes current, so a power loss during a
+/// write leaves the records as they were before it. The app_manifest.json must request
+/// MutableStorage with a SizeKB of at least twice DX_STORAGE_SLOT_SIZE, 16 by default.
+/// Safe to call from any thread.
+/// </summary>
+
+/// <summary>
+/// Write a record, replacing any existing record with the same tag
+/// </summary>
+/// <param name="tag"></param>
+/// <param name="data"></param>
+/// <param name="length"></param>
+/// <returns>false if mutable storage is unavailable or full</returns>
+bool dx_storageWrite(uint32_t tag, const void *data, size_t length);
+
+/// <summary>
+/// Read a record into buffer
+/// </summary>
+/// <param name="tag"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize"></param>
+/// <param name="length">Set to the record length, also when buffer is too small</param>
+/// <returns>false if there is no valid record with the tag or buffer is too small</returns>
+bool dx_storageRead(uint32_t tag, void *buffer, size_t bufferSize, size_t *length);
+
+/// <summary>
+/// Remove a record, succeeds if there was no record with the tag
+/// </summary>
+/// <param name="tag"></param>
+/// <returns></returns>
+bool dx_storageDelete(uint32_t tag);
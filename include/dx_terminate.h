@@ -8,14 +8,80 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
-// volatile sig_atomic_t terminationRequired = false;
+// The termination flag is private to dx_terminate.c, read it with dx_isTerminationRequired
+
+#ifndef DX_TERMINATE_MAX_DRAIN_SOURCES
+#define DX_TERMINATE_MAX_DRAIN_SOURCES 8
+#endif
+
+#ifndef DX_TERMINATE_DRAIN_DEADLINE_MS
+#define DX_TERMINATE_DRAIN_DEADLINE_MS 3000 // keep well inside the time the OS allows after SIGTERM
+#endif
+
+#ifndef DX_TERMINATE_DRAIN_PUMP_MS
+#define DX_TERMINATE_DRAIN_PUMP_MS 10 // how often the drain calls each source's pump
+#endif
+
+/// <summary>
+/// Work that is still in flight when the app terminates, for example messages IoT Hub has not
+/// acknowledged yet. Modules register a source and dx_terminateDrain keeps the event loop and
+/// the pumps running until every source has nothing pending.
+/// </summary>
+typedef struct {
+    const char *name;
+    size_t (*pending)(void);          // items not yet flushed
+    unsigned long (*completed)(void); // running count of items flushed, the drain reports the difference
+    void (*pump)(void);               // optional, moves items along, e.g. IoTHubDeviceClient_LL_DoWork
+    bool (*stalled)(void);            // optional, true while pending items can't make progress, e.g. offline
+    unsigned long (*dropped)(void);   // optional, running count of items the source discarded itself
+} DX_DRAIN_SOURCE;
+
+typedef struct {
+    const char *name;
+    unsigned long flushed; // completed during the drain
+    size_t dropped;        // discarded by the source during the drain or still pending when it ended
+} DX_DRAIN_RESULT;
+
+typedef struct {
+    uint32_t elapsedMs;
+    bool complete; // nothing was dropped
+    size_t sourceCount;
+    DX_DRAIN_RESULT sources[DX_TERMINATE_MAX_DRAIN_SOURCES];
+} DX_DRAIN_REPORT;
 
 bool dx_isTerminationRequired(void);
 int dx_getTerminationExitCode(void);
 void dx_eventLoopRun(void);
 void dx_registerTerminationHandler(void);
 void dx_terminate(int exitCode);
-void dx_terminationHandler(int signalNumber);
\ No newline at end of file
+void dx_terminationHandler(int signalNumber);
+
+/// <summary>
+/// Register in flight work for dx_terminateDrain. Registering the same source again is a no-op.
+/// </summary>
+/// <param name="source">Must stay valid for the life of the app</param>
+/// <returns>false if DX_TERMINATE_MAX_DRAIN_SOURCES are already registered</returns>
+bool dx_terminateRegisterDrain(const DX_DRAIN_SOURCE *source);
+
+/// <summary>
+/// Remove a source, for a module that is closed before the app terminates
+/// </summary>
+/// <param name="source"></param>
+void dx_terminateUnregisterDrain(const DX_DRAIN_SOURCE *source);
+
+/// <summary>
+/// Shutdown phase to call after the event loop has exited and before closing anything. Keeps
+/// running the event loop and the source pumps until nothing is pending, every source with
+/// pending items is stalled or deadlineMs has passed, then logs what was flushed and dropped.
+/// Stop the application timers first, for example with dx_timerSetStop, otherwise periodic
+/// publishes keep adding work and can hold the drain until its deadline.
+/// </summary>
+/// <param name="deadlineMs">DX_TERMINATE_DRAIN_DEADLINE_MS unless the app knows better</param>
+/// <param name="report">Optional, receives the per source counts</param>
+/// <returns>true if everything was flushed</returns>
+bool dx_terminateDrain(uint32_t deadlineMs, DX_DRAIN_REPORT *report);
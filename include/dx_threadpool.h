@@ -0,0 +1,80 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_async.h"
+#include "dx_terminate.h"
+#include "dx_utilities.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef DX_THREADPOOL_THREADS
+#define DX_THREADPOOL_THREADS 2
+#endif
+
+#ifndef DX_THREADPOOL_QUEUE_LENGTH
+#define DX_THREADPOOL_QUEUE_LENGTH 16 // jobs waiting for a worker, further submits are refused
+#endif
+
+#ifndef DX_THREADPOOL_RETRY_MS
+#define DX_THREADPOOL_RETRY_MS 1 // how soon a completion that found the dx_async queue full is posted again
+#endif
+
+/// <summary>
+/// A unit of work for the pool, owned by the application and reusable once its completed
+/// handler has run. work runs on a worker thread and must not call DevX functions other than
+/// dx_threadpoolJobCancelled and dx_asyncPost. completed runs on the event loop thread.
+/// </summary>
+typedef struct _threadpoolJob {
+    void (*work)(struct _threadpoolJob *job);
+    void (*completed)(struct _threadpoolJob *job, bool cancelled); // optional
+    void *context;
+    // Used by the pool
+    struct _threadpoolJob *next;
+    atomic_bool cancelled;
+    bool busy;     // submitted and completed has not run yet
+    bool finished; // work has returned or was skipped, protected by the pool lock
+} DX_THREADPOOL_JOB;
+
+/// <summary>
+/// Start the worker threads. Also initializes dx_async, which delivers completions. Call from
+/// the event loop thread.
+/// </summary>
+/// <returns>false if a worker could not be started</returns>
+bool dx_threadpoolStart(void);
+
+/// <summary>
+/// Queue a job for the next free worker. Call from the event loop thread.
+/// </summary>
+/// <param name="job"></param>
+/// <returns>false if the queue is full, the pool is stopping or the job is still busy</returns>
+bool dx_threadpoolSubmit(DX_THREADPOOL_JOB *job);
+
+/// <summary>
+/// Cancel a job. A queued job is removed without running, a running job sees
+/// dx_threadpoolJobCancelled return true. Either way completed is called with cancelled set.
+/// A job whose work has already returned is not cancelled, its completed runs as it would have.
+/// </summary>
+/// <param name="job"></param>
+/// <returns>false if the job is not busy or its work has already finished</returns>
+bool dx_threadpoolCancel(DX_THREADPOOL_JOB *job);
+
+/// <summary>
+/// Long running work should poll this and return early when it is true. Also true once
+/// dx_terminate has been called, no queued job is started after that.
+/// </summary>
+bool dx_threadpoolJobCancelled(DX_THREADPOOL_JOB *job);
+
+/// <summary>
+/// Number of jobs waiting for a worker
+/// </summary>
+size_t dx_threadpoolQueueDepth(void);
+
+/// <summary>
+/// Cancel queued jobs, ask running jobs to stop and wait for the workers to exit. Completions
+/// of the cancelled jobs are posted through dx_async, run them with dx_terminateDrain or
+/// dx_asyncDrain if the event loop has already stopped.
+/// </summary>
+void dx_threadpoolStop(void);
@@ -9,6 +9,10 @@
 #include <applibs/eventloop.h>
 #include <applibs/log.h>
 
+// Define DX_TIMER_MULTIPLEX_ENABLED to drive every DX_TIMER_BINDING from a single timerfd
+// instead of one timerfd and event loop registration per timer. Worth it for apps with many
+// timers, or timers that are rescheduled often. All timers must then use dx_timerGetEventLoop.
+
 #define DX_TIMER_HANDLER(name)                            \
     void name(EventLoopTimer *eventLoopTimer)                    \
     {                                                            \
@@ -23,6 +27,8 @@
 
 #define DX_DECLARE_TIMER_HANDLER(name) void name(EventLoopTimer *eventLoopTimer)
 
+typedef EventLoopTimerStats DX_TIMER_STATS;
+
 typedef struct {
     void (*handler)(EventLoopTimer *timer);
     struct timespec period;
@@ -30,6 +36,7 @@ typedef struct {
     struct timespec *repeat;
     EventLoopTimer *eventLoopTimer;
     const char *name;
+    struct timespec slack; // how late the timer may fire so it can share a wakeup, see DX_TIMER_MULTIPLEX_ENABLED
 } DX_TIMER_BINDING;
 
 EventLoop *dx_timerGetEventLoop(void);
@@ -39,4 +46,38 @@ bool dx_timerStart(DX_TIMER_BINDING *timer);
 void dx_timerSetStart(DX_TIMER_BINDING *timerSet[], size_t timerCount);
 void dx_timerSetStop(DX_TIMER_BINDING *timerSet[], size_t timerCount);
 void dx_timerStop(DX_TIMER_BINDING *timer);
-void dx_timerEventLoopStop(void);
\ No newline at end of file
+void dx_timerEventLoopStop(void);
+
+/// <summary>
+/// Every timer records how late its handler ran, how many expirations were missed while the
+/// event loop was busy and how long the handler took, in log2 microsecond histograms.
+/// Statistics start when the timer is started and are discarded when it is stopped.
+/// </summary>
+/// <param name="timer"></param>
+/// <param name="stats">Receives a copy of the statistics</param>
+/// <param name="reset">Clear the statistics after copying them</param>
+/// <returns>false if the timer is not started</returns>
+bool dx_timerGetStats(DX_TIMER_BINDING *timer, DX_TIMER_STATS *stats, bool reset);
+
+/// <summary>
+/// Percentile of a DX_TIMER_STATS histogram in microseconds, rounded up to the bucket boundary
+/// and capped at max
+/// </summary>
+/// <param name="histogram">stats.lateness or stats.runTime</param>
+/// <param name="max">stats.maxLatenessUs or stats.maxRunUs</param>
+/// <param name="percentile">1 to 100</param>
+/// <returns></returns>
+uint32_t dx_timerStatsPercentile(const uint32_t *histogram, uint32_t max, unsigned int percentile);
+
+/// <summary>
+/// Serialize the statistics of a timer set as a JSON object keyed by timer name, ready to send
+/// with dx_azurePublish. Each entry has fired, missed and the average, p99 and maximum lateness
+/// and run time in microseconds. Unnamed timers are keyed timer0, timer1, ... by position.
+/// </summary>
+/// <param name="timerSet"></param>
+/// <param name="timerCount"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize"></param>
+/// <param name="reset">Clear the statistics so each message covers one reporting interval, only once the whole message fitted</param>
+/// <returns>false if the buffer is too small</returns>
+bool dx_timerStatsSerialize(DX_TIMER_BINDING *timerSet[], size_t timerCount, char *buffer, size_t bufferSize, bool reset);
@@ -0,0 +1,85 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef DX_TIMESTAMP_MIN_VALID_UTC
+#define DX_TIMESTAMP_MIN_VALID_UTC 1640995200 // 2022-01-01, a wall clock before this is never trusted
+#endif
+
+#ifndef DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS
+#define DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS 4
+#endif
+
+#define DX_TIMESTAMP_UTC_LENGTH 21 // "2024-01-31T12:34:56Z" and the terminating null
+
+/// <summary>
+/// Stamp samples with CLOCK_MONOTONIC, which is cheap to read and unaffected by the wall clock
+/// being set, and convert to UTC when the sample is sent. A stamp taken before the device has
+/// synchronized its clock converts correctly once the clock is known good, because the monotonic
+/// clock runs on undisturbed while the wall clock is stepped. Stamps are only meaningful within
+/// the boot they were taken in.
+///
+/// The clock is known good once dx_timestampSetClockValid has been called, which the library
+/// does when it authenticates with IoT Hub, and the wall clock reads later than
+/// DX_TIMESTAMP_MIN_VALID_UTC. Until then conversions fail, so samples can be kept and
+/// converted later, for example from a dx_timestampRegisterClockValidNotification handler.
+/// </summary>
+
+typedef int64_t DX_TIMESTAMP; // CLOCK_MONOTONIC nanoseconds
+
+/// <summary>
+/// Current monotonic time, safe to call from any thread
+/// </summary>
+DX_TIMESTAMP dx_timestampNow(void);
+
+/// <summary>
+/// Declare the wall clock synchronized, for example after the app has checked time sync itself.
+/// Calls the clock valid notifications the first time. Call from the event loop thread.
+/// </summary>
+void dx_timestampSetClockValid(void);
+
+/// <summary>
+/// True if stamps can be converted to UTC
+/// </summary>
+bool dx_timestampClockValid(void);
+
+/// <summary>
+/// Call handler on the event loop thread when the clock becomes valid, the time to convert and
+/// send samples that were kept while it was not. Called straight away if it already is.
+/// </summary>
+/// <param name="handler"></param>
+/// <returns>false if DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS are already registered</returns>
+bool dx_timestampRegisterClockValidNotification(void (*handler)(void));
+
+/// <summary>
+/// Convert a stamp to UTC milliseconds since the epoch
+/// </summary>
+/// <param name="stamp"></param>
+/// <param name="utcMilliseconds"></param>
+/// <returns>false if the clock is not valid yet</returns>
+bool dx_timestampToUtcMs(DX_TIMESTAMP stamp, int64_t *utcMilliseconds);
+
+/// <summary>
+/// Format a stamp as UTC in the same ISO 8601 format as dx_getCurrentUtc
+/// </summary>
+/// <param name="stamp"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize">At least DX_TIMESTAMP_UTC_LENGTH</param>
+/// <returns>false if the clock is not valid yet or the buffer is too small</returns>
+bool dx_timestampFormatUtc(DX_TIMESTAMP stamp, char *buffer, size_t bufferSize);
+
+/// <summary>
+/// Format UTC seconds since the epoch, reusing the previous result when it is the same second.
+/// The cache is per thread, so no locking is needed.
+/// </summary>
+/// <param name="utcSeconds"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize">At least DX_TIMESTAMP_UTC_LENGTH</param>
+/// <returns>false if the buffer is too small</returns>
+bool dx_timestampFormatUtcSeconds(int64_t utcSeconds, char *buffer, size_t bufferSize);
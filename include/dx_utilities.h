@@ -40,5 +40,6 @@ bool dx_startThreadDetached(void *(daemon)(void *), void *arg, char *daemon_name
 char *dx_getCurrentUtc(char *buffer, size_t bufferSize);
 int dx_stringEndsWith(const char *str, const char *suffix);
 int64_t dx_getNowMilliseconds(void);
+int64_t dx_getNowNanoseconds(void);
 void dx_Log_Debug(char *fmt, ...);
 void dx_Log_Debug_Init(const char *buffer, size_t buffer_size);
\ No newline at end of file
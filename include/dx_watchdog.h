@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_profiler.h"
+#include "dx_storage.h"
+#include "dx_timer.h"
+#include "dx_utilities.h"
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DX_WATCHDOG_HEARTBEAT_MS
+#define DX_WATCHDOG_HEARTBEAT_MS 100 // event loop heartbeat, also how often the watchdog thread checks it
+#endif
+
+#ifndef DX_WATCHDOG_STALL_MS
+#define DX_WATCHDOG_STALL_MS 2000 // default threshold, pick one below the hardware watchdog timeout
+#endif
+
+#ifndef DX_WATCHDOG_SNAPSHOT_MS
+#define DX_WATCHDOG_SNAPSHOT_MS 1000 // how often loop statistics are copied for the report
+#endif
+
+#ifndef DX_WATCHDOG_PERSIST_MS
+#define DX_WATCHDOG_PERSIST_MS 1000 // how often a continuing stall rewrites the stored report
+#endif
+
+#ifndef DX_WATCHDOG_TOP_HANDLERS
+#define DX_WATCHDOG_TOP_HANDLERS 4
+#endif
+
+#define DX_WATCHDOG_NAME_LENGTH 32
+
+/// <summary>
+/// A watchdog thread checks an event loop heartbeat. When the loop has not run the heartbeat
+/// for longer than the threshold it records a report and stores it with dx_storage, so it
+/// survives the hardware watchdog restarting the app:
+/// - the handler that was running and for how long, if DX_PROFILER_ENABLED is defined
+/// - the busiest handlers and the loop lateness in the second before the stall
+/// While the stall goes on the report is rewritten with the growing duration. If the loop
+/// recovers, it is rewritten once more marked recovered. On the next boot read it with
+/// dx_watchdogPreviousReport, upload it, for example with dx_watchdogReportSerialize, and only
+/// then delete it with dx_watchdogPreviousReportClear.
+/// </summary>
+
+typedef struct {
+    char name[DX_WATCHDOG_NAME_LENGTH];
+    uint32_t count;   // runs in the last snapshot interval
+    uint32_t totalUs; // run time in the last snapshot interval
+    uint32_t maxUs;   // longest run since the profiler was last reset
+} DX_WATCHDOG_HANDLER;
+
+typedef struct {
+    uint32_t version;
+    uint32_t thresholdMs;
+    int64_t detectedAt;                     // UTC seconds
+    uint32_t stallMs;                       // how long the loop had not run when the report was last written
+    bool recovered;                         // the loop came back before the app was restarted
+    char handler[DX_WATCHDOG_NAME_LENGTH];  // running handler, empty if unknown
+    uint32_t handlerRunMs;                  // how long that handler had been running
+    uint32_t stalls;                        // stalls this run, including this one
+    uint32_t loopMaxLatenessUs;             // heartbeat lateness before the stall, how responsive the loop was
+    uint32_t loopAvgLatenessUs;
+    uint32_t topCount;
+    DX_WATCHDOG_HANDLER top[DX_WATCHDOG_TOP_HANDLERS]; // busiest handlers before the stall, needs DX_PROFILER_ENABLED
+} DX_WATCHDOG_REPORT;
+
+/// <summary>
+/// Start the heartbeat and the watchdog thread. Call from the event loop thread.
+/// </summary>
+/// <param name="stallMs">Threshold, DX_WATCHDOG_STALL_MS unless the app knows better</param>
+/// <returns>false if the heartbeat timer or the thread could not be started</returns>
+bool dx_watchdogStart(uint32_t stallMs);
+
+/// <summary>
+/// Stop the watchdog thread and the heartbeat, waits for the thread to exit
+/// </summary>
+void dx_watchdogStop(void);
+
+/// <summary>
+/// Read the report left by a stall in an earlier run
+/// </summary>
+/// <param name="report"></param>
+/// <returns>false if there is none</returns>
+bool dx_watchdogPreviousReport(DX_WATCHDOG_REPORT *report);
+
+/// <summary>
+/// Delete the stored report so it is only uploaded once. Call after it has been serialized and
+/// published, a report that did not fit the buffer or failed to send is kept for the next try.
+/// </summary>
+void dx_watchdogPreviousReportClear(void);
+
+/// <summary>
+/// Serialize a report as JSON, ready for dx_azurePublish
+/// </summary>
+/// <returns>false if the buffer is too small</returns>
+bool dx_watchdogReportSerialize(const DX_WATCHDOG_REPORT *report, char *buffer, size_t bufferSize);
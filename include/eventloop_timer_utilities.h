@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #include <unistd.h>
@@ -90,6 +92,17 @@ int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period
 /// <seealso cref="DisarmEventLoopTimer" />
 int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay);
 
+/// <summary>
+/// Allow the timer to expire up to slack after it is due, so it can share a wakeup with other
+/// timers. Only multiplexed timers (DX_TIMER_MULTIPLEX_ENABLED) are coalesced, otherwise the
+/// slack is ignored.
+/// </summary>
+/// <param name="timer">Successfully allocated timer.</param>
+/// <param name="slack">How late the timer may fire, zero for no slack.</param>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information. EINVAL if
+/// slack is negative or tv_nsec is not below one second.</returns>
+int SetEventLoopTimerSlack(EventLoopTimer *timer, const struct timespec *slack);
+
 /// <summary>
 /// Disarm an existing event loop timer.
 /// </summary>
@@ -100,3 +113,31 @@ int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay
 /// <seealso cref="SetEventLoopTimerOneShot" />
 /// <seealso cref="SetEventLoopTimerPeriod" />
 int DisarmEventLoopTimer(EventLoopTimer *timer);
+
+#define EVENTLOOP_TIMER_HISTOGRAM_BUCKETS 24
+
+/// <summary>
+/// Dispatch statistics kept for every timer. Lateness is the time from when the timer was due
+/// to when its handler was called. Histogram bucket n counts values below 2^n microseconds,
+/// bucket 0 values under 1 us and the last bucket everything from 2^22 us (about 4 s) up.
+/// </summary>
+typedef struct EventLoopTimerStats {
+    uint32_t fired;  // handler calls
+    uint32_t missed; // expirations folded into a later call because the loop was busy
+    uint32_t maxLatenessUs;
+    uint32_t maxRunUs;
+    uint64_t totalLatenessUs;
+    uint64_t totalRunUs;
+    uint32_t lateness[EVENTLOOP_TIMER_HISTOGRAM_BUCKETS];
+    uint32_t runTime[EVENTLOOP_TIMER_HISTOGRAM_BUCKETS];
+} EventLoopTimerStats;
+
+/// <summary>
+/// Copy the timer's dispatch statistics, optionally clearing them so the next call reports a
+/// fresh interval.
+/// </summary>
+/// <param name="timer">Successfully allocated timer.</param>
+/// <param name="stats">Receives a copy of the statistics.</param>
+/// <param name="reset">Clear the statistics after copying them.</param>
+/// <returns>0 on success.</returns>
+int GetEventLoopTimerStats(EventLoopTimer *timer, EventLoopTimerStats *stats, bool reset);
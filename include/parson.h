@@ -70,7 +70,34 @@ JSON_Value *json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
 
-/* Serialization */
+/*  Parses first JSON value in the first string_len bytes of string, which doesn't need to be
+    null-terminated. Returns NULL in case of error */
+JSON_Value *json_parse_stringn(const char *string, size_t string_len);
+
+/*  Parses first JSON value in a mutable buffer holding string_len bytes of JSON and at least one
+    spare byte, which is overwritten with a terminating null. Strings and names are unescaped in
+    place and referenced rather than copied, so the buffer is modified and must outlive the
+    returned value. Returns NULL in case of error */
+JSON_Value *json_parse_string_in_situ(char *buffer, size_t string_len);
+
+/*  Returns 1 if the first string_len bytes of string hold exactly one JSON value as defined by
+    RFC 8259, optionally surrounded by whitespace, and 0 otherwise. Nothing is allocated, so this
+    is a cheap check for text that is passed on rather than parsed */
+int json_is_well_formed(const char *string, size_t string_len);
+
+/*  Finds the member called name in the top level object of the first string_len bytes of string
+    without parsing or allocating. On success value points at the raw JSON text of the member's
+    value, quotes included for strings, and value_len is its length. Member names are compared
+    without unescaping and only the path to the member is checked, so this is a filter, not a
+    substitute for json_is_well_formed. Returns 1 if found, 0 otherwise */
+int json_find_member(const char *string, size_t string_len, const char *name, const char **value,
+                     size_t *value_len);
+
+/* Serialization
+   All serializers make a single pass. json_serialize_to_buffer never allocates and fails if buf is
+   too small, leaving an empty string in buf when buf_size_in_bytes is not 0.
+   json_serialize_to_string grows its result as needed and trims it afterwards, the allocation is at
+   most 256 bytes larger than the string. */
 size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 char *json_serialize_to_string(const JSON_Value *value);
@@ -122,6 +149,32 @@ double json_object_dotget_number(const JSON_Object *object,
 int json_object_dotget_boolean(const JSON_Object *object,
                                const char *name); /* returns -1 on fail */
 
+/* Compiled paths
+   json_path_compile splits a dot notation name (as used by dotget functions) once, so repeated
+   lookups don't rescan and rehash it. json_path_compile_set compiles several names into one prefix
+   tree that json_path_get_values resolves in a single pass, looking shared prefixes up only once.
+   A JSON_Path holds scratch space for json_path_get_values, so one path must not be evaluated from
+   two threads at the same time. Paths are allocated with malloc, not the functions set with
+   json_set_allocation_functions, so they stay valid when a pool behind those is reset. */
+typedef struct json_path_t JSON_Path;
+
+JSON_Path *json_path_compile(const char *path); /* returns NULL in case of error */
+JSON_Path *json_path_compile_set(const char *const *paths, size_t count);
+void json_path_free(JSON_Path *path);
+size_t json_path_get_count(const JSON_Path *path);
+
+/* Getters resolve the first path of a set */
+JSON_Value *json_path_get_value(const JSON_Object *object, const JSON_Path *path);
+const char *json_path_get_string(const JSON_Object *object, const JSON_Path *path);
+JSON_Object *json_path_get_object(const JSON_Object *object, const JSON_Path *path);
+JSON_Array *json_path_get_array(const JSON_Object *object, const JSON_Path *path);
+double json_path_get_number(const JSON_Object *object, const JSON_Path *path); /* returns 0 on fail */
+int json_path_get_boolean(const JSON_Object *object, const JSON_Path *path);   /* returns -1 on fail */
+
+/* Fills values with json_path_get_count(path) entries in compile order, NULL where a path is not
+   found, and returns the number found */
+size_t json_path_get_values(const JSON_Object *object, const JSON_Path *path, JSON_Value **values);
+
 /* Functions to get available names */
 size_t json_object_get_count(const JSON_Object *object);
 const char *json_object_get_name(const JSON_Object *object, size_t index);
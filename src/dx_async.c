@@ -0,0 +1,210 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_async.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#if (DX_ASYNC_QUEUE_LENGTH & (DX_ASYNC_QUEUE_LENGTH - 1)) != 0
+#error DX_ASYNC_QUEUE_LENGTH must be a power of two
+#endif
+
+#define ASYNC_QUEUE_MASK (DX_ASYNC_QUEUE_LENGTH - 1)
+
+// Bounded multi producer, single consumer queue. Each cell's sequence tells producers whether
+// it is free for position pos (sequence == pos) and the consumer whether it has been filled
+// (sequence == pos + 1), so producers only contend on the tail index.
+typedef struct ASYNC_CELL {
+    atomic_size_t sequence;
+    DX_ASYNC_HANDLER handler;
+    void *arg;
+} ASYNC_CELL;
+
+static ASYNC_CELL asyncQueue[DX_ASYNC_QUEUE_LENGTH];
+static atomic_size_t asyncTail;
+static size_t asyncHead; // only touched by the event loop thread
+static atomic_bool asyncSignaled;
+static atomic_ulong asyncDropped;
+static unsigned long asyncRun; // only touched by the event loop thread
+
+static int asyncFd = -1;
+static EventRegistration *asyncRegistration = NULL;
+
+static bool AsyncDequeue(DX_ASYNC_HANDLER *handler, void **arg)
+{
+    ASYNC_CELL *cell = &asyncQueue[asyncHead & ASYNC_QUEUE_MASK];
+
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != asyncHead + 1) {
+        return false;
+    }
+
+    *handler = cell->handler;
+    *arg = cell->arg;
+
+    // Hand the cell back to producers for the position one lap ahead
+    atomic_store_explicit(&cell->sequence, asyncHead + DX_ASYNC_QUEUE_LENGTH, memory_order_release);
+    asyncHead++;
+    return true;
+}
+
+static void AsyncSignal(void)
+{
+    // Only the first post after the event loop cleared the flag pays for the eventfd write
+    if (!atomic_exchange(&asyncSignaled, true)) {
+        uint64_t one = 1;
+        if (write(asyncFd, &one, sizeof(one)) == -1) {
+            Log_Debug("ERROR: Could not signal async queue: %s (%d).\n", strerror(errno), errno);
+        }
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void AsyncEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t count;
+    DX_ASYNC_HANDLER handler;
+    void *arg;
+    int batch;
+
+    if (read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read async eventfd: %s (%d).\n", strerror(errno), errno);
+    }
+
+    // Clear before draining, a post that lands after the drain then signals again
+    atomic_store(&asyncSignaled, false);
+
+    for (batch = 0; batch < DX_ASYNC_BATCH_SIZE && AsyncDequeue(&handler, &arg); batch++) {
+        handler(arg);
+        asyncRun++;
+    }
+
+    // Batch limit reached, come back after the event loop has serviced everything else
+    if (batch == DX_ASYNC_BATCH_SIZE) {
+        AsyncSignal();
+    }
+}
+
+static size_t AsyncPending(void)
+{
+    return atomic_load(&asyncTail) - asyncHead;
+}
+
+static unsigned long AsyncRunCount(void)
+{
+    return asyncRun;
+}
+
+// Handlers posted by worker threads that have not run yet, run by the drain's event loop passes
+static const DX_DRAIN_SOURCE asyncDrain = {.name = "async", .pending = AsyncPending, .completed = AsyncRunCount};
+
+bool dx_asyncInit(void)
+{
+    if (asyncFd != -1) {
+        return true;
+    }
+
+    for (size_t i = 0; i < DX_ASYNC_QUEUE_LENGTH; i++) {
+        atomic_init(&asyncQueue[i].sequence, i);
+    }
+    atomic_init(&asyncTail, 0);
+    atomic_init(&asyncSignaled, false);
+    asyncHead = 0;
+
+    asyncFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (asyncFd == -1) {
+        Log_Debug("ERROR: Unable to create async eventfd: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    asyncRegistration = EventLoop_RegisterIo(dx_timerGetEventLoop(), asyncFd, EventLoop_Input, AsyncEventHandler, NULL);
+    if (asyncRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register async event: %s (%d).\n", strerror(errno), errno);
+        close(asyncFd);
+        asyncFd = -1;
+        return false;
+    }
+
+    dx_terminateRegisterDrain(&asyncDrain);
+    return true;
+}
+
+bool dx_asyncPost(DX_ASYNC_HANDLER handler, void *arg)
+{
+    size_t pos = atomic_load_explicit(&asyncTail, memory_order_relaxed);
+    ASYNC_CELL *cell;
+
+    if (handler == NULL || asyncFd == -1) {
+        return false;
+    }
+
+    for (;;) {
+        cell = &asyncQueue[pos & ASYNC_QUEUE_MASK];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&asyncTail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The cell still holds the entry from one lap ago, the queue is full
+            atomic_fetch_add_explicit(&asyncDropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&asyncTail, memory_order_relaxed);
+        }
+    }
+
+    cell->handler = handler;
+    cell->arg = arg;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    AsyncSignal();
+    return true;
+}
+
+unsigned long dx_asyncDroppedCount(void)
+{
+    return atomic_load_explicit(&asyncDropped, memory_order_relaxed);
+}
+
+size_t dx_asyncDrain(void)
+{
+    // Stop at what was queued on entry, a handler that keeps reposting itself can't hold up shutdown
+    size_t end = atomic_load(&asyncTail);
+    size_t ran = 0;
+    DX_ASYNC_HANDLER handler;
+    void *arg;
+
+    while (asyncHead != end && AsyncDequeue(&handler, &arg)) {
+        handler(arg);
+        ran++;
+    }
+
+    asyncRun += ran;
+
+    return ran;
+}
+
+void dx_asyncClose(void)
+{
+    if (asyncFd == -1) {
+        return;
+    }
+
+    // Nothing can run the queue once the eventfd is gone, so the drain must not wait for it
+    dx_terminateUnregisterDrain(&asyncDrain);
+
+    if (EventLoop_UnregisterIo(dx_timerGetEventLoop(), asyncRegistration) != 0) {
+        Log_Debug("ERROR: Unable to unregister async event: %s (%d).\n", strerror(errno), errno);
+    }
+    close(asyncFd);
+
+    asyncRegistration = NULL;
+    asyncFd = -1;
+}
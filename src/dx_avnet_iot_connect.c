@@ -31,16 +31,81 @@ static char deviceGUID[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
 static char entityGUID[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
 static bool avnetConnected = false;
 
-// Define a pointer to a linked list of children devices/nodes for gateway implementations
+// True once the hello handshake has confirmed the session for this connection.  A session restored
+// from storage sets avnetConnected once IoT Hub connects so telemetry flows, but stays unvalidated
+// until the hello response
+static bool sessionValidated = false;
+// A session from the hello response or the session cache, usable whenever IoT Hub is connected
+static bool sessionHeld = false;
+
+// Session saved to mutable storage, followed by childCount "id\0tg\0" pairs.  Bump the version
+// when the layout changes so an older record is ignored.
+#define AVNET_SESSION_VERSION 1
+typedef struct AVNET_SESSION_RECORD {
+    uint32_t version;
+    uint32_t childCount;
+    int64_t savedAt; // UTC seconds
+    char sid[DX_AVNET_IOT_CONNECT_SID_LEN + 1];
+    char dtg[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
+    char deviceGUID[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
+    char entityGUID[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
+} AVNET_SESSION_RECORD;
+
+// Define a pointer to a linked list of children devices/nodes for gateway implementations.  The list
+// keeps the order children were added in, childBuckets indexes the same nodes by id so lookups don't
+// walk the list.  Nodes are never moved, a node pointer stays valid until that child is removed.
 gw_child_list_node_t* gwChildrenListHead = NULL;
-
-// Wait for 15 seconds for IoT Connect to send the hello message
-static const int AVNET_IOT_DEFAULT_POLL_PERIOD_SECONDS = 15; 
+static gw_child_list_node_t* gwChildrenListTail = NULL;
+static gw_child_list_node_t** childBuckets = NULL;
+static size_t childBucketCount = 0; // power of two
+static size_t childCount = 0;
+
+// Each 204 child sync stamps the children it lists with a new generation, children left with an
+// older stamp are no longer configured on IoTConnect and are removed
+static uint32_t childSyncGeneration = 0;
+
+#define MAX_CHILD_CHANGED_CALLBACKS 5
+static DX_AVNET_CHILD_CHANGED_HANDLER _childChangedCallback[MAX_CHILD_CHANGED_CALLBACKS];
+
+// Fields read from the hello response "d" object, compiled once in dx_avnetConnect so each response
+// is resolved in a single pass without re-splitting the names
+enum { HELLO_SID, HELLO_HAS, HELLO_HAS_D, HELLO_META, HELLO_META_G, HELLO_META_EG, HELLO_META_DTG, HELLO_FIELD_COUNT };
+static const char *helloFieldPaths[HELLO_FIELD_COUNT] = {[HELLO_SID] = "sid",
+                                                        [HELLO_HAS] = "has",
+                                                        [HELLO_HAS_D] = "has.d",
+                                                        [HELLO_META] = "meta",
+                                                        [HELLO_META_G] = "meta.g",
+                                                        [HELLO_META_EG] = "meta.eg",
+                                                        [HELLO_META_DTG] = "meta.dtg"};
+// Compiled once and kept for the life of the app, compiled paths come from malloc so they don't
+// hold off a dx_jsonPoolReset
+static JSON_Path *helloFields = NULL;
+
+// Seconds to wait for the hello response before sending the hello again, doubles on each attempt
+static int helloRetrySeconds = DX_AVNET_IOT_CONNECT_HELLO_RETRY_MIN_SECONDS;
+static int64_t connectStartedMs = 0;
+static DX_AVNET_CONNECTION_STATS connectionStats = {.readyMilliseconds = -1, .validatedMilliseconds = -1};
+
+#define MAX_READY_CALLBACKS 5
+static void (*_readyCallback[MAX_READY_CALLBACKS])(bool ready);
+
+// Telemetry published before IoTConnect is ready.  Each entry is one allocation holding the
+// child id, empty for the gateway itself, followed by the telemetry JSON.
+typedef struct AVNET_QUEUED_TELEMETRY {
+    char *childId;
+    const char *telemetryJson;
+} AVNET_QUEUED_TELEMETRY;
+
+static AVNET_QUEUED_TELEMETRY publishQueue[DX_AVNET_IOT_CONNECT_QUEUE_LENGTH];
+static size_t publishQueueHead = 0;
+static size_t publishQueueCount = 0;
+static char publishBuffer[DX_AVNET_IOT_CONNECT_PUBLISH_BUFFER_SIZE];
 
 // Forward function declarations
 static void MonitorAvnetConnectionHandler(EventLoopTimer *timer);
 static void IoTCSend200HelloMessage(void);
-static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(IOTHUB_MESSAGE_HANDLE, void *);
+static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(DX_MESSAGE_SUBSCRIPTION *subscription, const void *payload,
+                                                               size_t payloadLength, IOTHUB_MESSAGE_HANDLE message);
 static const char *ErrorCodeToString(int iotConnectErrorCode);
 static void IoTCrequestChildDeviceInfo(void);
 static bool IoTCProcessHelloResponse(JSON_Object *dProperties);
@@ -49,37 +114,139 @@ static void IoTCSend221AddChildMessage(const char* id, const char* tg, const cha
 static bool IoTCProcess221Response(JSON_Object *dProperties);
 static void IoTCSend222DeleteChildMessage(gw_child_list_node_t* childToDelete);
 static bool IoTCProcess222Response(JSON_Object *dProperties);
+static void IoTCSessionSave(void);
+static bool IoTCSessionRestore(void);
+static void IoTCSessionDelete(void);
+static void IoTCSetConnected(bool connected);
+static void IoTCSessionValidated(void);
+static void IoTCFlushPublishQueue(void);
+
+static size_t PublishQueuePending(void)
+{
+    return publishQueueCount;
+}
+
+static unsigned long PublishQueueFlushed(void)
+{
+    return (unsigned long)connectionStats.flushed;
+}
+
+static unsigned long PublishQueueDropped(void)
+{
+    return (unsigned long)connectionStats.dropped;
+}
+
+static bool PublishQueueStalled(void)
+{
+    return !avnetConnected || !dx_isAzureConnected();
+}
+
+// Queued telemetry goes to IoT Hub on each pump, where the telemetry drain takes it over
+static const DX_DRAIN_SOURCE publishQueueDrain = {.name = "IoTConnect queue",
+                                                  .pending = PublishQueuePending,
+                                                  .completed = PublishQueueFlushed,
+                                                  .pump = IoTCFlushPublishQueue,
+                                                  .stalled = PublishQueueStalled,
+                                                  .dropped = PublishQueueDropped};
+
+// C2D messages are routed on their response code (ct) or command type through these tables, the
+// library's own responses are the first entries.  The two tables share the handler budget.
+typedef struct AVNET_C2D_ROUTE {
+    int code;
+    DX_AVNET_C2D_HANDLER handler;
+} AVNET_C2D_ROUTE;
+
+static AVNET_C2D_ROUTE responseHandlers[DX_AVNET_IOT_CONNECT_MAX_C2D_HANDLERS] = {{200, IoTCProcessHelloResponse},
+                                                                                 {204, IoTCProcess204Response},
+                                                                                 {221, IoTCProcess221Response},
+                                                                                 {222, IoTCProcess222Response}};
+static size_t responseHandlerCount = 4;
+static AVNET_C2D_ROUTE commandHandlers[DX_AVNET_IOT_CONNECT_MAX_C2D_HANDLERS];
+static size_t commandHandlerCount = 0;
+static char c2dBuffer[DX_AVNET_IOT_CONNECT_C2D_BUFFER_SIZE];
+
+static DX_AVNET_C2D_HANDLER IoTCFindC2DHandler(const AVNET_C2D_ROUTE *routes, size_t routeCount, int code);
+
+// IoTConnect responses carry a top level "d" object and commands a "cmdType" member, anything
+// else goes on to the app's own subscriptions or its message received callback
+static DX_MESSAGE_SUBSCRIPTION responseSubscription = {.match = DX_MESSAGE_MATCH_JSON_MEMBER, .key = "d", .handler = ReceiveMessageCallback};
+static DX_MESSAGE_SUBSCRIPTION commandSubscription = {.match = DX_MESSAGE_MATCH_JSON_MEMBER, .key = "cmdType", .handler = ReceiveMessageCallback};
 
 // Routines associated with gateway implementations and managing the linked list of children devices
-bool IoTCListAddChild(const char* id, const char* tg);
+gw_child_list_node_t* IoTCListAddChild(const char* id, const char* tg);
 void IoTClistDelete(void);
 bool IoTCListDeleteNode(gw_child_list_node_t* nodeToRemove);
 bool IoTCListDeleteNodeById(const char* id);
 gw_child_list_node_t* IoTCListGetNewNode(const char* id, const char* tg);
 gw_child_list_node_t* IoTCListInsertNode(const char* id, const char* tg);
-gw_child_list_node_t* IoTCListFindNode(char* id);
 gw_child_list_node_t* IoTCListFindNodeById(const char* id);
+bool IoTCListSetTag(gw_child_list_node_t* node, const char* tg);
+static void IoTCListFreeNode(gw_child_list_node_t* node);
+static void IoTCNotifyChildChanged(DX_AVNET_CHILD_CHANGE change, gw_child_list_node_t* child, const char* previousTag);
+static uint32_t IoTCHashString(const char* string);
+static bool IoTCGrowBuckets(void*** buckets, size_t* bucketCount, void (*rehash)(void** newBuckets, size_t newCount));
+static void IoTCRehashChildren(void** newBuckets, size_t newCount);
 
 
 static DX_TIMER_BINDING monitorAvnetConnectionTimer = {.name = "monitorAvnetConnectionTimer", .handler = MonitorAvnetConnectionHandler};
 
 static void AvnetReconnectCallback(bool connected) {
-    // Since we're going to be connecting or re-connecting to Azure
-    // Set the IoT Connected flag to false
-    avnetConnected = false;
+    // Since we're going to be connecting or re-connecting to Azure the session has to be confirmed
+    // again.  Nothing can be sent while IoT Hub is down, so IoTConnect isn't ready either way.
+    // With the session cache enabled the session is kept, and used again as soon as IoT Hub is
+    // back while the hello is outstanding
+    sessionValidated = false;
+    IoTCSetConnected(false);
+    if(DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS == 0){
+        sessionHeld = false;
+    }
+
+    if(!connected){
+        return;
+    }
+
+    connectStartedMs = dx_getNowMilliseconds();
+    connectionStats.readyMilliseconds = sessionHeld ? 0 : -1;
+    connectionStats.validatedMilliseconds = -1;
+    connectionStats.helloAttempts = 0;
 
     // Send the IoT Connect hello message to inform the platform that we're on-line!  We expect
     // to receive a hello response C2D message with connection details we need to send telemetry
     // data.
     IoTCSend200HelloMessage();
 
-    // Start the timer to make sure we see the IoT Connect "first response"
-    dx_timerChange(&monitorAvnetConnectionTimer, &(struct timespec){.tv_sec = AVNET_IOT_DEFAULT_POLL_PERIOD_SECONDS, .tv_nsec = 0});
+    // Start the timer to make sure we see the IoT Connect "first response", backing off from the
+    // shortest wait on every new connection
+    helloRetrySeconds = DX_AVNET_IOT_CONNECT_HELLO_RETRY_MIN_SECONDS;
+    dx_timerOneShotSet(&monitorAvnetConnectionTimer, &(struct timespec){.tv_sec = helloRetrySeconds, .tv_nsec = 0});
+
+    // A session we already hold is usable straight away, this sends what queued up while we were
+    // offline
+    if(sessionHeld){
+        IoTCSetConnected(true);
+    }
 }
 
 // Call from the main init function to setup periodic timer and handler
 void dx_avnetConnect(DX_USER_CONFIG *userConfig, const char *networkInterface)
 {
+    if (helloFields == NULL) {
+        helloFields = json_path_compile_set(helloFieldPaths, HELLO_FIELD_COUNT);
+        if (helloFields == NULL) {
+            dx_terminate(DX_ExitCode_Json_Path_Compile_Failed);
+            return;
+        }
+    }
+
+    // Pick up the session from the last run so telemetry doesn't wait for the hello response,
+    // it is used once IoT Hub connects
+    if (IoTCSessionRestore()) {
+        sessionHeld = true;
+        Log_Debug("[AVT IoTConnect] Restored saved session, revalidating with hello\n");
+    }
+
+    dx_terminateRegisterDrain(&publishQueueDrain);
+
     // Create the timer to monitor the IoTConnect hello response status
     if (!dx_timerStart(&monitorAvnetConnectionTimer)) {
         dx_terminate(DX_ExitCode_Init_IoTCTimer);
@@ -88,7 +255,9 @@ void dx_avnetConnect(DX_USER_CONFIG *userConfig, const char *networkInterface)
     // Register to receive updates when the application receives an Azure IoTHub connection update
     // and C2D messages
     dx_azureRegisterConnectionChangedNotification(AvnetReconnectCallback);
-    dx_azureRegisterMessageReceivedNotification(ReceiveMessageCallback);
+    if (!dx_azureSubscribeMessages(&responseSubscription) || !dx_azureSubscribeMessages(&commandSubscription)) {
+        dx_terminate(DX_ExitCode_Init_IoTCSubscribe);
+    }
     
     dx_azureConnect(userConfig, networkInterface, NULL);
 }
@@ -103,12 +272,170 @@ static void MonitorAvnetConnectionHandler(EventLoopTimer *timer)
         return;
     }
 
-    // If we're not connected to IoTConnect, then fall through to re-send the hello message
-    if (!avnetConnected) {
+    // If we're not connected to IoTConnect, or are still running on an unconfirmed saved session,
+    // then fall through to re-send the hello message.  While IoT Hub is down stop retrying, the
+    // reconnect callback starts over
+    if ((!avnetConnected || !sessionValidated) && dx_isAzureConnected()) {
+
+        IoTCSend200HelloMessage();
+
+        helloRetrySeconds *= 2;
+        if (helloRetrySeconds > DX_AVNET_IOT_CONNECT_HELLO_RETRY_MAX_SECONDS) {
+            helloRetrySeconds = DX_AVNET_IOT_CONNECT_HELLO_RETRY_MAX_SECONDS;
+        }
+        dx_timerOneShotSet(&monitorAvnetConnectionTimer, &(struct timespec){.tv_sec = helloRetrySeconds, .tv_nsec = 0});
+    }
+}
+
+static void IoTCSetConnected(bool connected)
+{
+    if (avnetConnected == connected) {
+        return;
+    }
+
+    avnetConnected = connected;
+
+    if (connected) {
+        if (connectStartedMs != 0) {
+            connectionStats.readyMilliseconds = dx_getNowMilliseconds() - connectStartedMs;
+        }
+        // Send the backlog before the application is told, so telemetry stays in order
+        IoTCFlushPublishQueue();
+    }
+
+    for (size_t i = 0; i < MAX_READY_CALLBACKS; i++) {
+        if (_readyCallback[i] != NULL) {
+            _readyCallback[i](connected);
+        }
+    }
+}
+
+// The hello handshake, and the 204 child sync for gateways, confirmed the session
+static void IoTCSessionValidated(void)
+{
+    sessionValidated = true;
+    sessionHeld = true;
+    if (connectStartedMs != 0) {
+        connectionStats.validatedMilliseconds = dx_getNowMilliseconds() - connectStartedMs;
+    }
+
+    IoTCSetConnected(true);
+    Log_Debug("[AVT IoTConnect] Set the IoTCConnected flag to true!\n");
+    IoTCSessionSave();
+}
+
+bool dx_avnetRegisterReadyNotification(void (*readyCallback)(bool ready))
+{
+    for (size_t i = 0; i < MAX_READY_CALLBACKS; i++) {
+        if (_readyCallback[i] == NULL) {
+            _readyCallback[i] = readyCallback;
+            return true;
+        }
+    }
+    return false;
+}
+
+void dx_avnetUnregisterReadyNotification(void (*readyCallback)(bool ready))
+{
+    for (size_t i = 0; i < MAX_READY_CALLBACKS; i++) {
+        if (_readyCallback[i] == readyCallback) {
+            _readyCallback[i] = NULL;
+        }
+    }
+}
+
+void dx_avnetGetConnectionStats(DX_AVNET_CONNECTION_STATS *stats)
+{
+    *stats = connectionStats;
+}
+
+static void IoTCDropQueuedTelemetry(void)
+{
+    free(publishQueue[publishQueueHead].childId);
+    publishQueueHead = (publishQueueHead + 1) % DX_AVNET_IOT_CONNECT_QUEUE_LENGTH;
+    publishQueueCount--;
+}
+
+bool dx_avnetPublish(const char *telemetryJson, gw_child_list_node_t *childDevice)
+{
+    if (telemetryJson == NULL) {
+        return false;
+    }
 
-        if (dx_isAzureConnected()) {
-            IoTCSend200HelloMessage();
+    // Queue only telemetry that will go out, the check that fails it now would fail it later
+#ifndef DX_AVNET_IOT_CONNECT_TRUSTED_PAYLOAD
+    if (!json_is_well_formed(telemetryJson, strlen(telemetryJson))) {
+        Log_Debug("[AVT IoTConnect] Telemetry is not valid JSON, not published\n");
+        return false;
+    }
+#endif
+
+    // Keep the order, nothing new goes out ahead of the queue
+    if (avnetConnected && publishQueueCount == 0) {
+        if (!dx_avnetJsonSerializePayload(telemetryJson, publishBuffer, sizeof(publishBuffer), childDevice)) {
+            Log_Debug("[AVT IoTConnect] Telemetry does not fit DX_AVNET_IOT_CONNECT_PUBLISH_BUFFER_SIZE, not published\n");
+            return false;
+        }
+        if (dx_azurePublish(publishBuffer, strlen(publishBuffer), NULL, 0, NULL)) {
+            return true;
+        }
+    }
+
+    const char *childId = childDevice != NULL ? childDevice->id : "";
+    size_t idSize = strlen(childId) + 1;
+    size_t jsonSize = strlen(telemetryJson) + 1;
+
+    char *entry = malloc(idSize + jsonSize);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(entry, childId, idSize);
+    memcpy(entry + idSize, telemetryJson, jsonSize);
+
+    if (publishQueueCount == DX_AVNET_IOT_CONNECT_QUEUE_LENGTH) {
+        IoTCDropQueuedTelemetry();
+        connectionStats.dropped++;
+    }
+
+    size_t tail = (publishQueueHead + publishQueueCount) % DX_AVNET_IOT_CONNECT_QUEUE_LENGTH;
+    publishQueue[tail] = (AVNET_QUEUED_TELEMETRY){.childId = entry, .telemetryJson = entry + idSize};
+    publishQueueCount++;
+    connectionStats.queued++;
+
+    // The queue may only be waiting on IoT Hub, try to drain it now
+    IoTCFlushPublishQueue();
+    return true;
+}
+
+static void IoTCFlushPublishQueue(void)
+{
+    while (avnetConnected && publishQueueCount > 0) {
+        AVNET_QUEUED_TELEMETRY *queued = &publishQueue[publishQueueHead];
+        gw_child_list_node_t *childDevice = NULL;
+
+        if (queued->childId[0] != '\0') {
+            childDevice = IoTCListFindNodeById(queued->childId);
+            if (childDevice == NULL) {
+                IoTCDropQueuedTelemetry();
+                connectionStats.dropped++;
+                continue;
+            }
+        }
+
+        if (!dx_avnetJsonSerializePayload(queued->telemetryJson, publishBuffer, sizeof(publishBuffer), childDevice)) {
+            Log_Debug("[AVT IoTConnect] Queued telemetry does not fit DX_AVNET_IOT_CONNECT_PUBLISH_BUFFER_SIZE, dropped\n");
+            IoTCDropQueuedTelemetry();
+            connectionStats.dropped++;
+            continue;
+        }
+
+        // IoT Hub isn't taking messages, keep the rest for the next attempt
+        if (!dx_azurePublish(publishBuffer, strlen(publishBuffer), NULL, 0, NULL)) {
+            break;
         }
+
+        IoTCDropQueuedTelemetry();
+        connectionStats.flushed++;
     }
 }
 
@@ -120,98 +447,105 @@ static void MonitorAvnetConnectionHandler(EventLoopTimer *timer)
 /// invocation time</param>
 /// <returns>Return value to indicates the message procession status (i.e. accepted, rejected,
 /// abandoned)</returns>
-static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(IOTHUB_MESSAGE_HANDLE message, void *context)
+static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(DX_MESSAGE_SUBSCRIPTION *subscription, const void *payload,
+                                                               size_t payloadLength, IOTHUB_MESSAGE_HANDLE message)
 {
-    const unsigned char *buffer = NULL;
-    size_t msgSize = 0;
-    if (IoTHubMessage_GetByteArray(message, &buffer, &msgSize) != IOTHUB_MESSAGE_OK) {
-        Log_Debug("[AVT IoTConnect] Failure performing IoTHubMessage_GetByteArray\n");
-        return IOTHUBMESSAGE_REJECTED;
-    }
-
-    // 'buffer' is not null terminated, make a copy and null terminate it.
-    unsigned char *str_msg = (unsigned char *)malloc(msgSize + 1);
+    const unsigned char *buffer = (const unsigned char *)payload;
+    size_t msgSize = payloadLength;
+    DX_AVNET_C2D_HANDLER handler = NULL;
+    JSON_Object *properties = NULL;
+    int code = -1;
+
+    // 'buffer' is not null terminated and is read only, parse a copy of it in place.  Messages
+    // arrive on the event loop thread one at a time, so small ones share a static buffer
+    char *str_msg = msgSize < sizeof(c2dBuffer) ? c2dBuffer : (char *)malloc(msgSize + 1);
     if (str_msg == NULL) {
         Log_Debug("[AVT IoTConnect] Could not allocate buffer for incoming message\n");
-        abort();
+        return IOTHUBMESSAGE_ABANDONED;
     }
-
-    // Copy the buffer and null terminate it
     memcpy(str_msg, buffer, msgSize);
-    str_msg[msgSize] = '\0';
-
-    Log_Debug("[AVT IoTConnect] Received C2D message '%s'\n", str_msg);
 
-    // Using the mesage string get a pointer to the rootMessage
-    JSON_Value *rootMessage = NULL;
-    rootMessage = json_parse_string(str_msg);
-    if (rootMessage == NULL) {
-        Log_Debug("[AVT IoTConnect] Cannot parse the string as JSON content.\n");
-        goto cleanup;
-    }
+#if DX_LOGGING_ENABLED
+    Log_Debug("[AVT IoTConnect] Received C2D message '%.*s'\n", (int)msgSize, str_msg);
+#endif
 
-    // Using the rootMessage pointer get a pointer to the rootObject
+    // Strings in rootMessage reference str_msg
+    JSON_Value *rootMessage = json_parse_string_in_situ(str_msg, msgSize);
     JSON_Object *rootObject = json_value_get_object(rootMessage);
 
-    // Using the root object get a pointer to the d object
-    JSON_Object *dProperties = json_object_dotget_object(rootObject, "d");
-    if (dProperties == NULL) {
-        Log_Debug("[AVT IoTConnect] dProperties == NULL\n");
+    // Responses carry the code in "d.ct", commands in a hex "cmdType" string
+    JSON_Object *dProperties = json_object_get_object(rootObject, "d");
+    const char *cmdType = json_object_get_string(rootObject, "cmdType");
+
+    // Each subscription handles its own kind, so a message carrying both members is handled
+    // once, as a response
+    bool isResponse = json_object_has_value_of_type(dProperties, "ct", JSONNumber);
+    bool ours = subscription == &responseSubscription ? isResponse || cmdType == NULL : !isResponse;
+
+    if (ours && isResponse) {
+        code = (int)json_object_get_number(dProperties, "ct");
+        handler = IoTCFindC2DHandler(responseHandlers, responseHandlerCount, code);
+        properties = dProperties;
+    } else if (ours && cmdType != NULL) {
+        code = (int)strtol(cmdType, NULL, 16);
+        handler = IoTCFindC2DHandler(commandHandlers, commandHandlerCount, code);
+        properties = json_object_get_object(rootObject, "data");
+        if (properties == NULL) {
+            properties = rootObject;
+        }
     }
-    else{ // There is a "d" object, drill into it and pull the data
 
-        // Check to see if this is a 200 or 204 response, call the routine to process each
+    if (handler != NULL && !handler(properties)) {
+        Log_Debug("[AVT IoTConnect] Error processing %s %d\n", properties == dProperties ? "ct" : "cmdType", code);
+    }
 
-        int ctVal = -1;
+    json_value_free(rootMessage);
+    if (str_msg != c2dBuffer) {
+        free(str_msg);
+    }
 
-        // The "d" object contains a "ct" field that we can use to identify the response
-        if (json_object_has_value(dProperties, "ct") != 0) {
-            ctVal = (int)json_object_get_number(dProperties, "ct");
-            //Log_Debug("[AVT IoTConnect] ct: %d\n", ctVal);
+    if (ours && handler == NULL) {
+        Log_Debug("[AVT IoTConnect] C2D message not handled, code %d\n", code);
+    }
 
-        }
+    return IOTHUBMESSAGE_ACCEPTED;
+}
 
-        switch(ctVal){
-            case 200:
-                if(!IoTCProcessHelloResponse(dProperties)){
-                    Log_Debug("[AVT IoTConnect] Error processing IoTCProcessHelloResponse()\n");
-                    goto cleanup;
-                }                   
-                break;
-            case 204:
-                if(!IoTCProcess204Response(dProperties)){
-                    Log_Debug("[AVT IoTConnect] Error processing IoTCProcess204Response()\n");
-                    goto cleanup;
-                }
-                break;
-            case 221: 
-                if(!IoTCProcess221Response(dProperties)){
-                    Log_Debug("[AVT IoTConnect] Error processing IoTCProcess221Response()\n");
-                    goto cleanup;
-                }
-                break;
-            case 222: 
-                if(!IoTCProcess222Response(dProperties)){
-                    Log_Debug("[AVT IoTConnect] Error processing IoTCProcess221Response()\n");
-                    goto cleanup;
-                }
-                break;
-            default:
-                Log_Debug("[AVT IoTConnect] Error response code %d not handled\n", ctVal);
-                break;
+static DX_AVNET_C2D_HANDLER IoTCFindC2DHandler(const AVNET_C2D_ROUTE *routes, size_t routeCount, int code)
+{
+    for (size_t i = 0; i < routeCount; i++) {
+        if (routes[i].code == code) {
+            return routes[i].handler;
         }
     }
+    return NULL;
+}
 
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootMessage);
-    free(str_msg);
+static bool IoTCAddC2DRoute(AVNET_C2D_ROUTE *routes, size_t *routeCount, int code, DX_AVNET_C2D_HANDLER handler)
+{
+    if (handler == NULL || responseHandlerCount + commandHandlerCount >= DX_AVNET_IOT_CONNECT_MAX_C2D_HANDLERS ||
+        IoTCFindC2DHandler(routes, *routeCount, code) != NULL) {
+        return false;
+    }
 
-    return IOTHUBMESSAGE_ACCEPTED;
+    routes[*routeCount] = (AVNET_C2D_ROUTE){.code = code, .handler = handler};
+    (*routeCount)++;
+    return true;
+}
+
+bool dx_avnetRegisterResponseHandler(int ct, DX_AVNET_C2D_HANDLER handler)
+{
+    return IoTCAddC2DRoute(responseHandlers, &responseHandlerCount, ct, handler);
+}
+
+bool dx_avnetRegisterCommandHandler(int cmdType, DX_AVNET_C2D_HANDLER handler)
+{
+    return IoTCAddC2DRoute(commandHandlers, &commandHandlerCount, cmdType, handler);
 }
 
 static void IoTCSend200HelloMessage(void)
 {
+    connectionStats.helloAttempts++;
 
     // Send the IoT Connect hello message to inform the platform that we're on-line!
     JSON_Value *rootValue = json_value_init_object();
@@ -232,172 +566,298 @@ static void IoTCSend200HelloMessage(void)
     json_value_free(rootValue);
 }
 
+// Writes the start of a telemetry message, {"sid":"<sid>","dtg":"<dtg>","mt":0,"d":[
+static void avnetWriteEnvelopeStart(DX_JSON_WRITER *writer)
+{
+    dx_jsonWriterLiteral(writer, "{\"sid\":");
+    dx_jsonWriterString(writer, sidString);
+    dx_jsonWriterLiteral(writer, ",\"dtg\":");
+    dx_jsonWriterString(writer, dtgGUID);
+    dx_jsonWriterLiteral(writer, ",\"mt\":0,\"d\":[");
+}
+
+// Writes the start of a "d" array entry up to its telemetry object, {"id":"<id>","tg":"<tg>","d":
+// for a gateway child or {"d": for the device itself
+static void avnetWriteEntryStart(DX_JSON_WRITER *writer, gw_child_list_node_t *childDevice)
+{
+    if (childDevice != NULL) {
+        dx_jsonWriterLiteral(writer, "{\"id\":");
+        dx_jsonWriterString(writer, childDevice->id);
+        dx_jsonWriterLiteral(writer, ",\"tg\":");
+        dx_jsonWriterString(writer, childDevice->tg);
+        dx_jsonWriterLiteral(writer, ",\"d\":");
+    } else {
+        dx_jsonWriterLiteral(writer, "{\"d\":");
+    }
+}
+
 // Construct a new message that contains all the required IoTConnect data and the original telemetry
-// message. Returns false if we have not received the first response from IoTConnect, if the
-// target buffer is not large enough, or if the incoming data is not valid JSON.
+// message. Returns false if the target buffer is not large enough, or if the incoming data is not
+// valid JSON. The message is checked with a validator that builds no document, define
+// DX_AVNET_IOT_CONNECT_TRUSTED_PAYLOAD to skip the check when telemetry always comes from a serializer.
 bool dx_avnetJsonSerializePayload(const char *originalJsonMessage, char *modifiedJsonMessage, size_t modifiedBufferSize, gw_child_list_node_t* childDevice)
 {
+    size_t originalLength = strlen(originalJsonMessage);
 
-    bool result = false;
-
+#ifndef DX_AVNET_IOT_CONNECT_TRUSTED_PAYLOAD
     // Verify that the incomming JSON is valid
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(originalJsonMessage);
-    if (rootProperties != NULL) {
-
-        // Define the Json string format for sending telemetry to IoT Connect, note that the
-        // actual telemetry data is inserted as the last string argument
-        static const char IoTCTelemetryJson[] = "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\":0,\"d\":[{\"d\":%s}]}";
-        static const char IoTCGwTelemetryJson[] = "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\":0,\"d\":[{\"id\":\"%s\",\"tg\":\"%s\",\"d\":%s}]}";
-
-        // Determine the largest message size needed.  We'll use this to validate the incoming target
-        // buffer is large enough
-        size_t maxModifiedMessageSize = strlen(originalJsonMessage) + DX_AVNET_IOT_CONNECT_METADATA;
-
-        // Verify that the passed in buffer is large enough for the modified message
-        if (maxModifiedMessageSize > modifiedBufferSize) {
-            Log_Debug(
-                "\n[AVT IoTConnect] "
-                "ERROR: dx_avnetJsonSerializePayload() modified buffer size can't hold modified "
-                "message\n");
-            Log_Debug("[AVT IoTConnect]                  Original message size: %d\n", strlen(originalJsonMessage));
-            Log_Debug("[AVT IoTConnect] Additional IoTConnect message overhead: %d\n", DX_AVNET_IOT_CONNECT_METADATA);
-            Log_Debug("[AVT IoTConnect]            Required target buffer size: %d\n", maxModifiedMessageSize);
-            Log_Debug("[AVT IoTConnect]               Actual target buffersize: %d\n\n", modifiedBufferSize);
-
-            result = false;
-            goto cleanup;
-        }
-
-        // Build up the IoTC message and insert the telemetry JSON
-        if(childDevice != NULL){
-            snprintf(modifiedJsonMessage, maxModifiedMessageSize, IoTCGwTelemetryJson, sidString, dtgGUID, childDevice->id, childDevice->tg, originalJsonMessage);
-        }
-        else{
-            snprintf(modifiedJsonMessage, maxModifiedMessageSize, IoTCTelemetryJson, sidString, dtgGUID, originalJsonMessage);
+    if (!json_is_well_formed(originalJsonMessage, originalLength)) {
+        Log_Debug("[AVT IoTConnect] ERROR: dx_avnetJsonSerializePayload was passed invalid JSON\n");
+        if (modifiedBufferSize > 0) {
+            modifiedJsonMessage[0] = '\0';
         }
-       
-        result = true;
-
+        return false;
     }
-    else{
-        Log_Debug("[AVT IoTConnect] ERROR: dx_avnetJsonSerializePayload was passed invalid JSON\n");
+#endif
+
+    // Build up the IoTC message around the telemetry JSON, straight into the target buffer
+    // "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\":0,\"d\":[{\"id\":\"%s\",\"tg\":\"%s\",\"d\":%s}]}"
+    DX_JSON_WRITER writer;
+    dx_jsonWriterInit(&writer, modifiedJsonMessage, modifiedBufferSize);
+
+    avnetWriteEnvelopeStart(&writer);
+    avnetWriteEntryStart(&writer, childDevice);
+    dx_jsonWriterRaw(&writer, originalJsonMessage, originalLength);
+    dx_jsonWriterLiteral(&writer, "}]}");
+
+    if (!dx_jsonWriterFinish(&writer)) {
+        Log_Debug("\n[AVT IoTConnect] "
+                  "ERROR: dx_avnetJsonSerializePayload() modified buffer size can't hold modified "
+                  "message\n");
+        Log_Debug("[AVT IoTConnect]    Original message size: %zu\n", originalLength);
+        Log_Debug("[AVT IoTConnect] Actual target buffersize: %zu\n\n", modifiedBufferSize);
+        return false;
     }
 
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-
-    return result;
+    return true;
 }
 
 bool dx_avnetJsonSerialize(char *jsonMessageBuffer, size_t bufferSize, gw_child_list_node_t* childDevice, int key_value_pair_count, ...)
 {
-    bool result = false;
-    char *serializedJson = NULL;
-    char *keyString = NULL;
+    bool result = true;
+    const char *keyString = NULL;
     int dataType;
 
-    // Prepare the JSON object for the telemetry data
-    JSON_Value *root_value = json_value_init_object();
-    JSON_Object *root_object = json_value_get_object(root_value);
-
-    // Create a Json_Array
-    JSON_Value *myArrayValue = json_value_init_array();
-    JSON_Array *myArray = json_value_get_array(myArrayValue);
+    // We need to format the data as shown below, written straight into the buffer the calling
+    // routine passed in
+    // "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\":0,\"d\":[{\"id\":\"%s\",\"tg\":\"%s\",\"d\":{<new telemetry "key": value pairs>}}]}";
+    DX_JSON_WRITER writer;
+    dx_jsonWriterInit(&writer, jsonMessageBuffer, bufferSize);
 
-    // Prepare the JSON object for the telemetry data
-    JSON_Value *array_value_object = json_value_init_object();
-    JSON_Object *array_object = json_value_get_object(array_value_object);
-
-    // Allocate a buffer that we used to dynamically create the list key names d.<keyname>
-    char *keyBuffer = (char *)malloc(DX_AVNET_IOT_CONNECT_JSON_BUFFER_SIZE);
-    if (keyBuffer == NULL) {
-        Log_Debug("[AVT IoTConnect] ERROR: not enough memory to send telemetry.");
-        return false;
-    }
-
-    // We need to format the data as shown below
-    // "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\": 0,\"dt\": \"%s\",\"d\":[{\"d\":<new telemetry "key": value pairs>}]}";
-
-    serializedJson = NULL;
-    json_object_dotset_string(root_object, "sid", sidString);
-    json_object_dotset_string(root_object, "dtg", dtgGUID);
-    json_object_dotset_number(root_object, "mt", 0);
-
-    // If the telemetry is for a GW child device, then add the child id and tag strings
-    // "{\"sid\":\"%s\",\"dtg\":\"%s\",\"mt\":0,\"d\":[{\"id\":\"%s\",\"tg\":\"%s\",\"d\":%s}]}";
-    //                                                    ^^^^^^^^^^^^^^^^^^^^^^^^^
-    if(childDevice != NULL){
-        json_object_dotset_string(array_object, "id", childDevice->id);    
-        json_object_dotset_string(array_object, "tg", childDevice->tg);    
-    }
+    avnetWriteEnvelopeStart(&writer);
+    avnetWriteEntryStart(&writer, childDevice);
+    dx_jsonWriterLiteral(&writer, "{");
 
     // Prepare the argument list
     va_list inputList;
     va_start(inputList, key_value_pair_count);
 
     // Consume the data in the argument list and build out the json
-    while (key_value_pair_count--) {
+    for (int i = 0; i < key_value_pair_count && result; i++) {
 
         // Pull the data type from the list
         dataType = va_arg(inputList, int);
 
         // Pull the current "key"
-        keyString = va_arg(inputList, char *);
+        keyString = va_arg(inputList, const char *);
+
+        // "<newKey>": <value>
+        if (i > 0) {
+            dx_jsonWriterLiteral(&writer, ",");
+        }
+        dx_jsonWriterString(&writer, keyString);
+        dx_jsonWriterLiteral(&writer, ":");
 
-        // "d.<newKey>: <value>"
-        snprintf(keyBuffer, DX_AVNET_IOT_CONNECT_JSON_BUFFER_SIZE, "d.%s", keyString);
         switch (dataType) {
 
-            // report current device twin data as reported properties to IoTHub
         case DX_JSON_BOOL:
-            json_object_dotset_boolean(array_object, keyBuffer, va_arg(inputList, int));
+            dx_jsonWriterBool(&writer, va_arg(inputList, int) != 0);
             break;
+            // floats are cast to doubles for valists
         case DX_JSON_FLOAT:
         case DX_JSON_DOUBLE:
-            json_object_dotset_number(array_object, keyBuffer, va_arg(inputList, double));
+            dx_jsonWriterDouble(&writer, va_arg(inputList, double));
             break;
         case DX_JSON_INT:
-            json_object_dotset_number(array_object, keyBuffer, va_arg(inputList, int));
+            dx_jsonWriterInt(&writer, va_arg(inputList, int));
             break;
         case DX_JSON_STRING:
-            json_object_dotset_string(array_object, keyBuffer, va_arg(inputList, char *));
+            dx_jsonWriterString(&writer, va_arg(inputList, const char *));
             break;
         default:
             result = false;
-            goto cleanup;
+            break;
         }
     }
 
     // Clean up the argument list
     va_end(inputList);
 
-    // Add the telemetry data to the Json
-    json_array_append_value(myArray, array_value_object);
-    json_object_dotset_value(root_object, "d", myArrayValue);
+    dx_jsonWriterLiteral(&writer, "}}]}");
 
-    // Serialize the structure
-    serializedJson = json_serialize_to_string(root_value);
+    // An unknown data type fails the same way as a buffer that was too small, with an empty string
+    if (!result) {
+        writer.overflow = true;
+    }
 
-    // Copy the new JSON into the buffer the calling routine passed in
-    if (strlen(serializedJson) < bufferSize) {
-        strncpy(jsonMessageBuffer, serializedJson, bufferSize);
-        result = true;
+    return dx_jsonWriterFinish(&writer);
+}
+
+// Room kept back in the batch buffer for the "]}" closing every message
+#define AVNET_BATCH_CLOSING_LEN 2
+
+void dx_avnetBatchInit(DX_AVNET_BATCH *batch, char *buffer, size_t bufferSize)
+{
+    memset(batch, 0, sizeof(DX_AVNET_BATCH));
+    dx_jsonWriterInit(&batch->writer, buffer, bufferSize > AVNET_BATCH_CLOSING_LEN ? bufferSize - AVNET_BATCH_CLOSING_LEN : 0);
+}
+
+// Writes one entry, starting the envelope if this is the first entry of the message
+static bool avnetBatchWriteEntry(DX_AVNET_BATCH *batch, gw_child_list_node_t *childDevice, const char *telemetryJson)
+{
+    DX_JSON_WRITER *writer = &batch->writer;
+
+    if (batch->entries == 0) {
+        avnetWriteEnvelopeStart(writer);
+    } else {
+        dx_jsonWriterLiteral(writer, ",");
     }
 
-cleanup:
-    // Clean up
-    json_free_serialized_string(serializedJson);
-    json_value_free(root_value);
-    free(keyBuffer);
+    avnetWriteEntryStart(writer, childDevice);
+    dx_jsonWriterRaw(writer, telemetryJson, strlen(telemetryJson));
+    dx_jsonWriterLiteral(writer, "}");
+
+    return !writer->overflow;
+}
 
+bool dx_avnetBatchAdd(DX_AVNET_BATCH *batch, gw_child_list_node_t *childDevice, const char *telemetryJson)
+{
+    size_t entryStart = batch->writer.length;
+
+    if (telemetryJson == NULL) {
+        batch->entriesDropped++;
+        return false;
+    }
+
+#ifndef DX_AVNET_IOT_CONNECT_TRUSTED_PAYLOAD
+    if (!json_is_well_formed(telemetryJson, strlen(telemetryJson))) {
+        Log_Debug("[AVT IoTConnect] ERROR: dx_avnetBatchAdd was passed invalid JSON\n");
+        batch->entriesDropped++;
+        return false;
+    }
+#endif
+
+    if (!avnetBatchWriteEntry(batch, childDevice, telemetryJson)) {
+
+        // Roll the partial entry back and retry it at the start of a new message
+        batch->writer.length = entryStart;
+        batch->writer.overflow = false;
+
+        if (batch->entries == 0) {
+            Log_Debug("[AVT IoTConnect] Telemetry entry larger than the batch buffer dropped\n");
+            batch->entriesDropped++;
+            return false;
+        }
+
+        dx_avnetBatchFlush(batch);
+
+        if (!avnetBatchWriteEntry(batch, childDevice, telemetryJson)) {
+            Log_Debug("[AVT IoTConnect] Telemetry entry larger than the batch buffer dropped\n");
+            batch->writer.length = 0;
+            batch->writer.overflow = false;
+            batch->entriesDropped++;
+            return false;
+        }
+    }
+
+    batch->entries++;
+    return true;
+}
+
+// Room for the envelope avnetWriteEnvelopeStart writes, with every sid and dtg character escaped
+#define AVNET_ENVELOPE_MAX_LEN (32 + 6 * (DX_AVNET_IOT_CONNECT_SID_LEN + DX_AVNET_IOT_CONNECT_GUID_LEN))
+
+// True if the batch message was started with the current session, the envelope is written when
+// the first entry is added, which may have been before the hello response
+static bool avnetBatchEnvelopeCurrent(DX_AVNET_BATCH *batch)
+{
+    char envelope[AVNET_ENVELOPE_MAX_LEN];
+    DX_JSON_WRITER writer;
+
+    dx_jsonWriterInit(&writer, envelope, sizeof(envelope));
+    avnetWriteEnvelopeStart(&writer);
+
+    return dx_jsonWriterFinish(&writer) && writer.length <= batch->writer.length &&
+           memcmp(batch->writer.buffer, envelope, writer.length) == 0;
+}
+
+// Hands each entry of the finished batch message to dx_avnetPublish, which sends it with the
+// current session or queues it until IoTConnect is ready. Returns false if an entry was dropped.
+static bool avnetBatchRequeue(DX_AVNET_BATCH *batch)
+{
+    JSON_Value *message = json_parse_string(batch->writer.buffer);
+    JSON_Array *entries = json_object_get_array(json_object(message), "d");
+    size_t requeued = 0;
+
+    for (size_t i = 0; i < json_array_get_count(entries); i++) {
+        JSON_Object *entry = json_array_get_object(entries, i);
+        const char *childId = json_object_get_string(entry, "id");
+        gw_child_list_node_t *childDevice = childId != NULL ? IoTCListFindNodeById(childId) : NULL;
+        char *telemetryJson = NULL;
+
+        // A child removed since the entry was added has nowhere to go
+        if (childId != NULL && childDevice == NULL) {
+            continue;
+        }
+
+        telemetryJson = json_serialize_to_string(json_object_get_value(entry, "d"));
+        if (telemetryJson != NULL && dx_avnetPublish(telemetryJson, childDevice)) {
+            requeued++;
+        }
+        json_free_serialized_string(telemetryJson);
+    }
+
+    json_value_free(message);
+
+    batch->entriesQueued += requeued;
+    batch->entriesDropped += batch->entries - requeued;
+    return requeued == batch->entries;
+}
+
+bool dx_avnetBatchFlush(DX_AVNET_BATCH *batch)
+{
+    DX_JSON_WRITER *writer = &batch->writer;
+    bool result = true;
+
+    if (batch->entries == 0) {
+        return true;
+    }
+
+    // dx_avnetBatchInit held back room for the closing brackets and the terminator
+    memcpy(writer->buffer + writer->length, "]}", AVNET_BATCH_CLOSING_LEN + 1);
+    size_t messageLength = writer->length + AVNET_BATCH_CLOSING_LEN;
+
+    // The same rules as dx_avnetPublish, nothing goes out before the hello response or ahead of
+    // queued telemetry, and what can't go out now is queued rather than lost
+    if (dx_isAvnetConnected() && publishQueueCount == 0 && avnetBatchEnvelopeCurrent(batch) &&
+        dx_azurePublish(writer->buffer, messageLength, NULL, 0, NULL)) {
+        batch->messagesSent++;
+        batch->entriesSent += batch->entries;
+        batch->bytesSent += messageLength;
+    } else if (!avnetBatchRequeue(batch)) {
+        Log_Debug("[AVT IoTConnect] Batched telemetry could not be queued, %zu entries dropped\n", batch->entries);
+        result = false;
+    }
+
+    writer->length = 0;
+    batch->entries = 0;
     return result;
 }
 
 bool dx_isAvnetConnected(void)
 {
-    return avnetConnected;
+    // A held session is no use while IoT Hub is unreachable
+    return avnetConnected && dx_isAzureConnected();
 }
 
 static const char *response221CodeToString(int iotResponseCode)
@@ -498,18 +958,33 @@ static void IoTCrequestChildDeviceInfo(void)
 */
 static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
 
+    // dx_avnetConnect has already called dx_terminate if the paths failed to compile
+    if (helloFields == NULL) {
+        return false;
+    }
+
     // Use a flag to track if we rx the dtg value
     bool dtgFlag = false;
     bool hasDValue = false;
 
+    // Keep the identifiers we were using so a change of session can be reported
+    char previousSid[DX_AVNET_IOT_CONNECT_SID_LEN + 1];
+    char previousDtg[DX_AVNET_IOT_CONNECT_GUID_LEN + 1];
+    memcpy(previousSid, sidString, sizeof(previousSid));
+    memcpy(previousDtg, dtgGUID, sizeof(previousDtg));
+
+    // Pull every field we need out of the response in one pass
+    JSON_Value *fields[HELLO_FIELD_COUNT] = {0};
+    json_path_get_values(dProperties, helloFields, fields);
+
     if (json_object_has_value(dProperties, "ed") != 0) {
         int ecVal = (int)json_object_get_number(dProperties, "ec");
         Log_Debug("ec: %s\n", ErrorCodeToString(ecVal));
     }
 
     // The d properties should have a "sid" key
-    if (json_object_has_value(dProperties, "sid") != 0) {
-        strncpy(sidString, (char *)json_object_get_string(dProperties, "sid"), DX_AVNET_IOT_CONNECT_SID_LEN);
+    if (json_value_get_type(fields[HELLO_SID]) == JSONString) {
+        strncpy(sidString, json_value_get_string(fields[HELLO_SID]), DX_AVNET_IOT_CONNECT_SID_LEN);
         //Log_Debug("[AVT IoTConnect] sid: %s\n", sidString);
 
     } else {
@@ -517,29 +992,27 @@ static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
     }
 
     // The d object has a "has" object
-    JSON_Object *hasProperties = json_object_dotget_object(dProperties, "has");
-    if (hasProperties == NULL) {
+    if (json_value_get_object(fields[HELLO_HAS]) == NULL) {
         Log_Debug("[AVT IoTConnect] hasProperties == NULL\n");
     }
 
     // The "has" properties should have a "d" key
-    if (json_object_has_value(hasProperties, "d") != 0) {
-        hasDValue = (uint8_t)json_object_dotget_boolean(hasProperties, "d");
+    if (fields[HELLO_HAS_D] != NULL) {
+        hasDValue = (uint8_t)json_value_get_boolean(fields[HELLO_HAS_D]);
         //Log_Debug("[AVT IoTConnect] has:d: %d\n", hasDValue);
     } else {
         Log_Debug("[AVT IoTConnect] has:d not found!\n");
     }
 
     // Check to see if the object contains a "meta" object
-    JSON_Object *metaProperties = json_object_dotget_object(dProperties, "meta");
-    if (metaProperties == NULL) {
+    if (json_value_get_object(fields[HELLO_META]) == NULL) {
         Log_Debug("[AVT IoTConnect] metaProperties not found\n");
     }
     else{
 
         // The meta properties should have a "g" key
-        if (json_object_has_value(metaProperties, "g") != 0) {
-            strncpy(deviceGUID, (char *)json_object_get_string(metaProperties, "g"), DX_AVNET_IOT_CONNECT_GUID_LEN);
+        if (json_value_get_type(fields[HELLO_META_G]) == JSONString) {
+            strncpy(deviceGUID, json_value_get_string(fields[HELLO_META_G]), DX_AVNET_IOT_CONNECT_GUID_LEN);
             //Log_Debug("[AVT IoTConnect] g: %s\n", deviceGUID);
 
         } else {
@@ -547,8 +1020,8 @@ static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
         }
 
         // The meta properties should have a "eg" key
-        if (json_object_has_value(metaProperties, "eg") != 0) {
-            strncpy(entityGUID, (char *)json_object_get_string(metaProperties, "eg"), DX_AVNET_IOT_CONNECT_GUID_LEN);
+        if (json_value_get_type(fields[HELLO_META_EG]) == JSONString) {
+            strncpy(entityGUID, json_value_get_string(fields[HELLO_META_EG]), DX_AVNET_IOT_CONNECT_GUID_LEN);
             //Log_Debug("[AVT IoTConnect] eg: %s\n", entityGUID);
 
         } else {
@@ -556,8 +1029,8 @@ static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
         }
 
         // The meta properties should have a "dtg" key
-        if (json_object_has_value(metaProperties, "dtg") != 0) {
-            strncpy(dtgGUID, (char *)json_object_get_string(metaProperties, "dtg"), DX_AVNET_IOT_CONNECT_GUID_LEN);
+        if (json_value_get_type(fields[HELLO_META_DTG]) == JSONString) {
+            strncpy(dtgGUID, json_value_get_string(fields[HELLO_META_DTG]), DX_AVNET_IOT_CONNECT_GUID_LEN);
             dtgFlag = true;
             //Log_Debug("[AVT IoTConnect] dtg: %s\n", dtgGUID);
         }
@@ -572,21 +1045,29 @@ static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
         // Verify that the new dtg is a valid GUID, if not then we just received an empty dtg.
         if(DX_AVNET_IOT_CONNECT_GUID_LEN == strnlen(dtgGUID, DX_AVNET_IOT_CONNECT_GUID_LEN+1)){
 
-            if(avnetConnected == false){
+            if(sessionHeld && !sessionValidated &&
+               (strcmp(previousSid, sidString) != 0 || strcmp(previousDtg, dtgGUID) != 0)){
+                Log_Debug("[AVT IoTConnect] Session changed since it was saved, using the new sid/dtg\n");
+            }
+
+            if(avnetConnected == false || sessionValidated == false){
                 
                 // If the hasDValue is greater than 0, then this is a gateway device and there are child
                 // devices configured for this device.  Send the request for child details.  Note that we
                 // don't set the avnetConnected flag in this case.  When the child device information is 
-                // received we'll set the flag true.
+                // received we'll set the flag true.  A restored session keeps its cached children until
+                // the 204 response arrives.
                 if(hasDValue > 0){
                     //Log_Debug("[AVT IoTConnect] has:d: %d\n", hasDValue);
                     IoTCrequestChildDeviceInfo();
                 }
                 else{
-                    
+
+                    // No children configured, drop any restored from a saved session
+                    IoTClistDelete();
+
                     // We have all the data we need set the IoTConnect Connected flag to true
-                    avnetConnected = true;
-                    Log_Debug("[AVT IoTConnect] Set the IoTCConnected flag to true!\n");
+                    IoTCSessionValidated();
 
                 }
             }
@@ -594,8 +1075,11 @@ static bool IoTCProcessHelloResponse(JSON_Object* dProperties){
     }
     else{
 
-        // Set the IoTConnect Connected flag to false
-        avnetConnected = false;
+        // Set the IoTConnect Connected flag to false, the saved session can't be trusted either
+        sessionValidated = false;
+        sessionHeld = false;
+        IoTCSetConnected(false);
+        IoTCSessionDelete();
         Log_Debug("[AVT IoTConnect] Did not receive all the required data from IoTConnect\n");
         Log_Debug("[AVT IoTConnect] Set the IoTCConnected flag to false!\n");
 
@@ -627,6 +1111,7 @@ static bool IoTCProcess204Response(JSON_Object *dProperties){
 
     JSON_Array *gwArray = NULL;
     JSON_Object *childEntry;
+    size_t added = 0, removed = 0, retagged = 0;
 
     // The d properties should have a "d" array
     if (json_object_has_value(dProperties, "d") != 0) {
@@ -634,32 +1119,70 @@ static bool IoTCProcess204Response(JSON_Object *dProperties){
         gwArray = json_object_dotget_array(dProperties, "d");
         if(gwArray != NULL){
 
-            // For each item in the array: Allocate a new gw_child_t structure, fill it in and add it to the 
-            // list of children
+            // Compare the array against the children we have.  Children listed in the array are
+            // stamped with this sync's generation, only new children are allocated and only
+            // changed tags are replaced
+            if(++childSyncGeneration == 0){
+                childSyncGeneration = 1; // nodes start out unstamped at 0
+            }
+
             for(size_t i = 0; i < json_array_get_count(gwArray); i++){
                 
                 // Get a pointer to the next object in the array
                 childEntry = json_array_get_object(gwArray, i);
+                const char* id = json_object_get_string(childEntry, "id");
+                const char* tg = json_object_get_string(childEntry, "tg");
+
+                if(id == NULL || tg == NULL){
+                    Log_Debug("[AVT IoTConnect] Skipping child entry without an id or tg\n");
+                    continue;
+                }
 
-                // Check to see if this id is already in the list.  If so,then remove it and add it back in
-                // in case the tag changed
-                if(IoTCListFindNodeById((char*)json_object_get_string(childEntry, "id"))!= NULL){
-                    IoTCListDeleteNodeById((char*)json_object_get_string(childEntry,"id"));
+                if(strlen(id) >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN || strlen(tg) >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN){
+                    Log_Debug("[AVT IoTConnect] Skipping child %.32s..., id or tg longer than DX_AVNET_IOT_CONNECT_GW_FIELD_LEN\n", id);
+                    continue;
                 }
 
-                //Log_Debug("[AVT IoTConnect] tg: %s\n", json_object_get_string(childEntry, "tg"));
-                //Log_Debug("[AVT IoTConnect] id: %s\n", json_object_get_string(childEntry, "id"));
+                //Log_Debug("[AVT IoTConnect] tg: %s\n", tg);
+                //Log_Debug("[AVT IoTConnect] id: %s\n", id);
 
-                // Add the child device to the linked list of children devices
-                if(!IoTCListAddChild(json_object_get_string(childEntry, "id"), json_object_get_string(childEntry, "tg"))){
+                gw_child_list_node_t* child = IoTCListFindNodeById(id);
+                if(child == NULL){
+                    child = IoTCListInsertNode(id, tg);
+                    if(child != NULL){
+                        IoTCNotifyChildChanged(DX_AVNET_CHILD_ADDED, child, NULL);
+                    }
+                    added++;
+                }
+                else if(strcmp(child->tg, tg) != 0){
+                    if(!IoTCListSetTag(child, tg)){
+                        child = NULL;
+                    }
+                    retagged++;
+                }
 
+                if(child == NULL){
                     dx_terminate(DX_ExitCode_Avnet_Add_Child_Failed);
+                    return false;
                 }
+                child->syncMark = childSyncGeneration;
             }
+
+            // Anything not in the array has been removed from IoTConnect
+            gw_child_list_node_t* child = gwChildrenListHead;
+            while(child != NULL){
+                gw_child_list_node_t* next = child->next;
+                if(child->syncMark != childSyncGeneration){
+                    IoTCListDeleteNode(child);
+                    removed++;
+                }
+                child = next;
+            }
+
+            Log_Debug("[AVT IoTConnect] Child sync: %zu added, %zu removed, %zu retagged, %zu total\n", added, removed, retagged, childCount);
             
             // We have all the data we need set the IoTConnect Connected flag to true
-            avnetConnected = true;
-            Log_Debug("[AVT IoTConnect] Set the IoTCConnected flag to true!\n");
+            IoTCSessionValidated();
 
         }
     } else {
@@ -770,14 +1293,50 @@ void dx_avnetDeleteChildOnIoTConnect(const char* id){
 }
 
 
-bool IoTCListAddChild(const char* id, const char* tg){
+// Adds a child, or updates the tag of a child we already know about.  Returns NULL on failure
+gw_child_list_node_t* IoTCListAddChild(const char* id, const char* tg){
+
+    gw_child_list_node_t* childNode = IoTCListFindNodeById(id);
+    if(childNode != NULL){
+        return IoTCListSetTag(childNode, tg) ? childNode : NULL;
+    }
 
     gw_child_list_node_t* newChildNode = IoTCListInsertNode(id, tg);
     if(newChildNode == NULL){
-        return false;
+        return NULL;
     }
 
-    return true;
+    IoTCNotifyChildChanged(DX_AVNET_CHILD_ADDED, newChildNode, NULL);
+    return newChildNode;
+}
+
+bool dx_avnetRegisterChildChangedNotification(DX_AVNET_CHILD_CHANGED_HANDLER childChangedHandler){
+
+    for(size_t i = 0; i < MAX_CHILD_CHANGED_CALLBACKS; i++){
+        if(_childChangedCallback[i] == NULL){
+            _childChangedCallback[i] = childChangedHandler;
+            return true;
+        }
+    }
+    return false;
+}
+
+void dx_avnetUnregisterChildChangedNotification(DX_AVNET_CHILD_CHANGED_HANDLER childChangedHandler){
+
+    for(size_t i = 0; i < MAX_CHILD_CHANGED_CALLBACKS; i++){
+        if(_childChangedCallback[i] == childChangedHandler){
+            _childChangedCallback[i] = NULL;
+        }
+    }
+}
+
+static void IoTCNotifyChildChanged(DX_AVNET_CHILD_CHANGE change, gw_child_list_node_t* child, const char* previousTag){
+
+    for(size_t i = 0; i < MAX_CHILD_CHANGED_CALLBACKS; i++){
+        if(_childChangedCallback[i] != NULL){
+            _childChangedCallback[i](change, child, previousTag);
+        }
+    }
 }
 
 /* 
@@ -815,7 +1374,7 @@ static bool IoTCProcess221Response(JSON_Object *dProperties){
 
         // The d properties should have a "tg" key
         if (json_object_has_value(childProperties, "tg") != 0) {
-            strncpy(tagString, (char *)json_object_get_string(childProperties, "tg"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
+            strncpy(tagString, (char *)json_object_get_string(childProperties, "tg"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN - 1);
             //Log_Debug("[AVT IoTConnect] tg: %s\n", tagString);
 
         } else {
@@ -825,7 +1384,7 @@ static bool IoTCProcess221Response(JSON_Object *dProperties){
 
         // The d properties should have a "id" key
         if (json_object_has_value(childProperties, "id") != 0) {
-            strncpy(idString, (char *)json_object_get_string(childProperties, "id"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
+            strncpy(idString, (char *)json_object_get_string(childProperties, "id"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN - 1);
             //Log_Debug("[AVT IoTConnect] id: %s\n", idString);
 
         } else {
@@ -835,6 +1394,7 @@ static bool IoTCProcess221Response(JSON_Object *dProperties){
 
         // The child was added on IoTConnect, now add it to the dynamic list of children on the device
         IoTCListAddChild(idString, tagString);
+        IoTCSessionSave();
 
         Log_Debug("[AVT IoTConnect] Add GW Child id: %s, tag: %s\n", idString, tagString);
     }
@@ -878,7 +1438,7 @@ static bool IoTCProcess222Response(JSON_Object *dProperties){
 
         // The d properties should have a "tg" key
         if (json_object_has_value(childProperties, "tg") != 0) {
-            strncpy(tagString, (char *)json_object_get_string(childProperties, "tg"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
+            strncpy(tagString, (char *)json_object_get_string(childProperties, "tg"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN - 1);
             //Log_Debug("[AVT IoTConnect] tg: %s\n", tagString);
 
         } else {
@@ -888,7 +1448,7 @@ static bool IoTCProcess222Response(JSON_Object *dProperties){
 
         // The d properties should have a "id" key
         if (json_object_has_value(childProperties, "id") != 0) {
-            strncpy(idString, (char *)json_object_get_string(childProperties, "id"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
+            strncpy(idString, (char *)json_object_get_string(childProperties, "id"), DX_AVNET_IOT_CONNECT_GW_FIELD_LEN - 1);
             //Log_Debug("[AVT IoTConnect] id: %s\n", idString);
 
         } else {
@@ -898,35 +1458,182 @@ static bool IoTCProcess222Response(JSON_Object *dProperties){
 
         // The child was removed from IoTconnect remove it from our list
         IoTCListDeleteNodeById(idString);
+        IoTCSessionSave();
         Log_Debug("[AVT IoTConnect] Delete GW Child id: %s, tag: %s\n", idString, tagString);
     }
 
     return true;
 }
 
+// Save the confirmed session so the next start can use it before the hello response arrives
+static void IoTCSessionSave(void){
+
+    if(DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS == 0 || !sessionValidated){
+        return;
+    }
+
+    uint8_t* record = malloc(DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE);
+    if(record == NULL){
+        return;
+    }
+
+    AVNET_SESSION_RECORD header = {.version = AVNET_SESSION_VERSION, .childCount = (uint32_t)childCount, .savedAt = (int64_t)time(NULL)};
+    memcpy(header.sid, sidString, sizeof(header.sid));
+    memcpy(header.dtg, dtgGUID, sizeof(header.dtg));
+    memcpy(header.deviceGUID, deviceGUID, sizeof(header.deviceGUID));
+    memcpy(header.entityGUID, entityGUID, sizeof(header.entityGUID));
+
+    size_t length = sizeof(header);
+    bool fits = length <= DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE;
+
+    for(gw_child_list_node_t* child = gwChildrenListHead; child != NULL && fits; child = child->next){
+        size_t idLen = strlen(child->id) + 1;
+        size_t tgLen = strlen(child->tg) + 1;
+
+        if(idLen + tgLen > DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE - length){
+            fits = false;
+            break;
+        }
+        memcpy(record + length, child->id, idLen);
+        memcpy(record + length + idLen, child->tg, tgLen);
+        length += idLen + tgLen;
+    }
+
+    if(fits){
+        memcpy(record, &header, sizeof(header));
+        if(!dx_storageWrite(DX_STORAGE_TAG_AVNET_SESSION, record, length)){
+            Log_Debug("[AVT IoTConnect] Could not save the session\n");
+        }
+    }
+    else{
+        // A partial child list would hide children until the next 204 response, don't cache it
+        Log_Debug("[AVT IoTConnect] Session with %zu children exceeds DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE, not saved\n", childCount);
+        dx_storageDelete(DX_STORAGE_TAG_AVNET_SESSION);
+    }
+
+    free(record);
+}
+
+// Load an unexpired session saved by an earlier run, returns false if there isn't one
+static bool IoTCSessionRestore(void){
+
+    bool restored = false;
+    size_t length = 0;
+
+    if(DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS == 0){
+        return false;
+    }
+
+    uint8_t* record = malloc(DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE);
+    if(record == NULL){
+        return false;
+    }
+
+    if(!dx_storageRead(DX_STORAGE_TAG_AVNET_SESSION, record, DX_AVNET_IOT_CONNECT_SESSION_MAX_SIZE, &length) ||
+       length < sizeof(AVNET_SESSION_RECORD)){
+        goto cleanup;
+    }
+
+    AVNET_SESSION_RECORD header;
+    memcpy(&header, record, sizeof(header));
+
+    // A clock behind savedAt hasn't been set yet since boot, the hello revalidates the session anyway
+    int64_t now = (int64_t)time(NULL);
+    if(header.version != AVNET_SESSION_VERSION ||
+       (now >= header.savedAt && now - header.savedAt >= DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS)){
+        Log_Debug("[AVT IoTConnect] Saved session expired\n");
+        goto cleanup;
+    }
+
+    // Every string must be terminated inside its field, and the dtg a full GUID
+    if(memchr(header.sid, 0, sizeof(header.sid)) == NULL || header.sid[0] == 0 ||
+       memchr(header.deviceGUID, 0, sizeof(header.deviceGUID)) == NULL ||
+       memchr(header.entityGUID, 0, sizeof(header.entityGUID)) == NULL ||
+       strnlen(header.dtg, sizeof(header.dtg)) != DX_AVNET_IOT_CONNECT_GUID_LEN){
+        goto cleanup;
+    }
+
+    // Check the child list holds childCount complete "id\0tg\0" pairs before touching the
+    // children, so handlers never see children from a truncated record
+    const char* children = (const char*)record + sizeof(header);
+    const char* end = (const char*)record + length;
+    const char* cursor = children;
+    uint32_t pairs = 0;
+
+    while(pairs < header.childCount){
+        const char* idEnd = memchr(cursor, 0, (size_t)(end - cursor));
+        const char* tgEnd = idEnd == NULL ? NULL : memchr(idEnd + 1, 0, (size_t)(end - idEnd - 1));
+        if(tgEnd == NULL || idEnd - cursor >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN ||
+           tgEnd - idEnd - 1 >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN){
+            break;
+        }
+        cursor = tgEnd + 1;
+        pairs++;
+    }
+
+    if(pairs != header.childCount){
+        Log_Debug("[AVT IoTConnect] Saved session child list is truncated, ignoring it\n");
+        goto cleanup;
+    }
+
+    IoTClistDelete();
+
+    for(cursor = children; pairs > 0; pairs--){
+        const char* tg = cursor + strlen(cursor) + 1;
+        if(IoTCListAddChild(cursor, tg) == NULL){
+            dx_terminate(DX_ExitCode_Avnet_Add_Child_Failed);
+            goto cleanup;
+        }
+        cursor = tg + strlen(tg) + 1;
+    }
+
+    memcpy(sidString, header.sid, sizeof(sidString));
+    memcpy(dtgGUID, header.dtg, sizeof(dtgGUID));
+    memcpy(deviceGUID, header.deviceGUID, sizeof(deviceGUID));
+    memcpy(entityGUID, header.entityGUID, sizeof(entityGUID));
+    restored = true;
+
+cleanup:
+    free(record);
+    return restored;
+}
+
+static void IoTCSessionDelete(void){
+
+    if(DX_AVNET_IOT_CONNECT_SESSION_TTL_SECONDS > 0){
+        dx_storageDelete(DX_STORAGE_TAG_AVNET_SESSION);
+    }
+}
+
 gw_child_list_node_t* IoTCListInsertNode(const char* id, const char* tg){
 
     // Create the new node on the heap
     gw_child_list_node_t* newNode = IoTCListGetNewNode(id, tg);
+    if(newNode == NULL){
+        return NULL;
+    }
 
-    // Check to see if the list is empty
-    if(gwChildrenListHead == NULL){
+    // Grow the id index before it gets crowded, chains stay short at under one node per bucket
+    if(childCount >= childBucketCount && !IoTCGrowBuckets((void***)&childBuckets, &childBucketCount, IoTCRehashChildren)){
+        IoTCListFreeNode(newNode);
+        return NULL;
+    }
 
+    size_t bucket = newNode->hash & (childBucketCount - 1);
+    newNode->hashNext = childBuckets[bucket];
+    childBuckets[bucket] = newNode;
+    childCount++;
+
+    // Add the new node to the end of the list, the tail pointer saves walking the list
+    if(gwChildrenListHead == NULL){
         gwChildrenListHead = newNode;
     }
     else{
-
-        // The list is not empty, find the last node in the list
-        gw_child_list_node_t* lastNodePtr = gwChildrenListHead;
-        while(lastNodePtr->next != NULL){
-            lastNodePtr = lastNodePtr->next;
-        } 
-
-        // We found the last node, add the new node to the end of the list    
-        lastNodePtr->next = newNode;
-        newNode->prev = lastNodePtr;    
+        gwChildrenListTail->next = newNode;
+        newNode->prev = gwChildrenListTail;
     }
-    
+    gwChildrenListTail = newNode;
+
 	return newNode;
 }
 
@@ -935,29 +1642,37 @@ void IoTClistDelete(void){
     gw_child_list_node_t* currentNode = gwChildrenListHead;
     gw_child_list_node_t* nextNodePtr = NULL;
 
-    // Traverse the list removing nodes as we go
+    // Detach the whole list before notifying, so a callback that looks children up only sees
+    // an empty list and never a node that has already been freed.  The buckets are kept for
+    // the next sync.
+    gwChildrenListHead = NULL;
+    gwChildrenListTail = NULL;
+    childCount = 0;
+    if(childBuckets != NULL){
+        memset(childBuckets, 0, childBucketCount * sizeof(gw_child_list_node_t*));
+    }
+
+    // Traverse the detached chain removing nodes as we go
     while(currentNode != NULL){
         
         nextNodePtr = currentNode->next;
+        IoTCNotifyChildChanged(DX_AVNET_CHILD_REMOVED, currentNode, NULL);
         
         // Free the memory from the heap
-        free(currentNode);
+        IoTCListFreeNode(currentNode);
         currentNode = nextNodePtr;
     }
-
-    // Reset the head pointer
-    gwChildrenListHead = NULL;
 }
 
 void dx_avnetPrintGwChildrenList(void){
 
     gw_child_list_node_t* currentNode = gwChildrenListHead;
-    uint8_t numChildren = 0;
+    size_t numChildren = 0;
 
     // Traverse the list printing node details as we go
     while(currentNode != NULL){
 
-        Log_Debug("Child node #%d, ID: %s, Tag: %s\n", ++numChildren, currentNode->id, currentNode->tg);
+        Log_Debug("Child node #%zu, ID: %s, Tag: %s\n", ++numChildren, currentNode->id, currentNode->tg);
         currentNode = currentNode->next;
     }
 }
@@ -971,20 +1686,17 @@ bool IoTCListDeleteNodeById(const char* id){
 gw_child_list_node_t* IoTCListFindNodeById(const char* id){
 
     // Check to see if the list is empty
-    if(gwChildrenListHead == NULL){
-
+    if(id == NULL || childCount == 0){
         return NULL;
     }
-    else{
 
-        // The list is not empty, traverse the list looking for the node 
-        gw_child_list_node_t* nodePtr = gwChildrenListHead;
-        while(nodePtr != NULL){
-            if(strncmp(nodePtr->id, id, DX_AVNET_IOT_CONNECT_GW_FIELD_LEN)==0){
-                return nodePtr;
-            }
-            nodePtr = nodePtr->next;
-        } 
+    uint32_t hash = IoTCHashString(id);
+    gw_child_list_node_t* nodePtr = childBuckets[hash & (childBucketCount - 1)];
+    while(nodePtr != NULL){
+        if(nodePtr->hash == hash && strcmp(nodePtr->id, id) == 0){
+            return nodePtr;
+        }
+        nodePtr = nodePtr->hashNext;
     }
 
     // We did not find the node, return NULL    
@@ -998,35 +1710,51 @@ bool IoTCListDeleteNode(gw_child_list_node_t* nodeToRemove){
         return false;
     }
 
-    // First check to see if the node is the head
-    if(gwChildrenListHead == nodeToRemove){
+    IoTCNotifyChildChanged(DX_AVNET_CHILD_REMOVED, nodeToRemove, NULL);
 
-        // Check to see if there is a node after the head
-        if(nodeToRemove->next != NULL){
-            nodeToRemove->next->prev = NULL;
-            gwChildrenListHead = nodeToRemove->next;
-        }
-        // Else the list has one entry and it's the head node
-        else{
-            gwChildrenListHead = NULL;
-        }
+    // Unlink the node from its hash chain
+    gw_child_list_node_t** link = &childBuckets[nodeToRemove->hash & (childBucketCount - 1)];
+    while(*link != nodeToRemove){
+        link = &(*link)->hashNext;
+    }
+    *link = nodeToRemove->hashNext;
+    childCount--;
 
-        free(nodeToRemove);
-        return true;
+    // Unlink the node from the list, fixing up the head and tail as needed
+    if(nodeToRemove->prev != NULL){
+        nodeToRemove->prev->next = nodeToRemove->next;
     }
+    else{
+        gwChildrenListHead = nodeToRemove->next;
+    }
+
+    if(nodeToRemove->next != NULL){
+        nodeToRemove->next->prev = nodeToRemove->prev;
+    }
+    else{
+        gwChildrenListTail = nodeToRemove->prev;
+    }
+
+    IoTCListFreeNode(nodeToRemove);
+    return true;
+}
 
-    // Check if the node to remove is at the end of the list
-    if(nodeToRemove->next == NULL){
+// Replaces the tag of an existing child in place so pointers to the node stay valid
+bool IoTCListSetTag(gw_child_list_node_t* node, const char* tg){
 
-        nodeToRemove->prev->next = NULL;
-        free(nodeToRemove);
+    if(strcmp(node->tg, tg) == 0){
         return true;
     }
 
-    // Else the node is not at the head or tail
-    nodeToRemove->prev->next = nodeToRemove->next;
-    nodeToRemove->next->prev = nodeToRemove->prev;
-    free(nodeToRemove);
+    if(strlen(tg) >= sizeof(node->tg)){
+        return false;
+    }
+
+    // Keep a copy of the old tag for the handlers
+    char previousTag[sizeof(node->tg)];
+    memcpy(previousTag, node->tg, sizeof(previousTag));
+    strcpy(node->tg, tg);
+    IoTCNotifyChildChanged(DX_AVNET_CHILD_RETAGGED, node, previousTag);
     return true;
 }
 
@@ -1034,21 +1762,65 @@ bool IoTCListDeleteNode(gw_child_list_node_t* nodeToRemove){
 // into a list, it's simply created on the heap.
 gw_child_list_node_t* IoTCListGetNewNode(const char* id, const char* tg) {
 
-	size_t nodeSize = sizeof(gw_child_list_node_t);
+	// Ids and tags that don't fit the node are skipped by the 204 sync, never truncate them as a
+	// truncated id would no longer match its hash
+	if(strlen(id) >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN || strlen(tg) >= DX_AVNET_IOT_CONNECT_GW_FIELD_LEN){
+		return NULL;
+	}
 
-	gw_child_list_node_t* newNode = malloc(nodeSize);
-	memset(newNode, 0,  nodeSize);
+	gw_child_list_node_t* newNode = calloc(1, sizeof(gw_child_list_node_t));
 
 	// Verify we were able to allocate memory for the new node, if not
 	// then set exitCode to reflect the erro.  The main loop will see this
 	// change and exit.
 	if(newNode == NULL){
 		dx_terminate(DX_ExitCode_Add_List_Node_Malloc_Failed);
+		return NULL;
 	}
 
-	newNode->prev = NULL;
-	newNode->next = NULL;
-	strncpy(newNode->id, id, DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
-	strncpy(newNode->tg, tg, DX_AVNET_IOT_CONNECT_GW_FIELD_LEN);
+	strcpy(newNode->id, id);
+	strcpy(newNode->tg, tg);
+	newNode->hash = IoTCHashString(id);
 	return newNode;
 }
+
+static void IoTCListFreeNode(gw_child_list_node_t* node){
+
+    free(node);
+}
+
+// FNV-1a
+static uint32_t IoTCHashString(const char* string){
+
+    uint32_t hash = 2166136261u;
+    while(*string){
+        hash ^= (unsigned char)*string++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Doubles a power of two bucket array, or creates it, and lets rehash move the entries across
+static bool IoTCGrowBuckets(void*** buckets, size_t* bucketCount, void (*rehash)(void** newBuckets, size_t newCount)){
+
+    size_t newCount = *bucketCount == 0 ? 64 : *bucketCount * 2;
+    void** newBuckets = calloc(newCount, sizeof(void*));
+    if(newBuckets == NULL){
+        return false;
+    }
+
+    rehash(newBuckets, newCount);
+    free(*buckets);
+    *buckets = newBuckets;
+    *bucketCount = newCount;
+    return true;
+}
+
+static void IoTCRehashChildren(void** newBuckets, size_t newCount){
+
+    for(gw_child_list_node_t* node = gwChildrenListHead; node != NULL; node = node->next){
+        size_t bucket = node->hash & (newCount - 1);
+        node->hashNext = newBuckets[bucket];
+        newBuckets[bucket] = node;
+    }
+}
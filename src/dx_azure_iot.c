@@ -1,6 +1,9 @@
 #include "dx_azure_iot.h"
+#include "dx_profiler.h"
+#include "dx_timestamp.h"
 
 #define MAX_CONNECTION_STATUS_CALLBACKS 5
+#define MESSAGE_MEMBER_KEY_LENGTH 64
 
 static bool SetupAzureClient(void);
 static bool SetUpAzureIoTHubClientWithDaa(void);
@@ -17,13 +20,16 @@ static char *iotHubUri = NULL;
 static const char *_networkInterface = NULL;
 static DX_USER_CONFIG *_userConfig = NULL;
 static int outstandingMessageCount = 0;
+static unsigned long confirmedMessageCount = 0;
 static bool connection_initialized = false;
 
 static char *_pnpModelIdJson = NULL;
 static const char *_pnpModelId = NULL;
 static const char *_pnpModelIdJsonTemplate = "{\"modelId\":\"%s\"}";
 
-static IOTHUBMESSAGE_DISPOSITION_RESULT (*_messageReceivedCallback)(IOTHUB_MESSAGE_HANDLE message, void *context) = NULL;
+static DX_MESSAGE_RECEIVED_HANDLER _messageReceivedCallback = NULL;
+static DX_MESSAGE_SUBSCRIPTION *_messageSubscriptions[DX_AZURE_MAX_MESSAGE_SUBSCRIPTIONS];
+static size_t _messageSubscriptionSlots = 0; // slots in use are all below this
 static void (*_deviceTwinCallbackHandler)(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t payloadSize,
                                           void *userContextCallback);
 
@@ -85,10 +91,11 @@ void dx_azureRegisterDirectMethodCallback(int (*directMethodCallbackHandler)(con
     _directMethodCallbackHandler = directMethodCallbackHandler;
 }
 
-void dx_azureRegisterMessageReceivedNotification(IOTHUBMESSAGE_DISPOSITION_RESULT (*messageReceivedCallback)(IOTHUB_MESSAGE_HANDLE message,
-                                                                                                             void *context))
+DX_MESSAGE_RECEIVED_HANDLER dx_azureRegisterMessageReceivedNotification(DX_MESSAGE_RECEIVED_HANDLER messageReceivedCallback)
 {
+    DX_MESSAGE_RECEIVED_HANDLER previous = _messageReceivedCallback;
     _messageReceivedCallback = messageReceivedCallback;
+    return previous;
 }
 
 bool dx_azureRegisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected))
@@ -164,6 +171,32 @@ bool createPnpModelIdJson(void)
     return true;
 }
 
+static size_t TelemetryPending(void)
+{
+    return outstandingMessageCount > 0 ? (size_t)outstandingMessageCount : 0;
+}
+
+static unsigned long TelemetryConfirmed(void)
+{
+    return confirmedMessageCount;
+}
+
+static void TelemetryPump(void)
+{
+    if (iothubClientHandle != NULL) {
+        DX_PROFILE(&iothubClientHandle, "IoTHubDeviceClient_LL_DoWork", IoTHubDeviceClient_LL_DoWork(iothubClientHandle));
+    }
+}
+
+static bool TelemetryStalled(void)
+{
+    return iothubClientHandle == NULL || iotHubClientAuthenticationState != IoTHubClientAuthenticationState_Authenticated;
+}
+
+// Messages handed to the SDK but not yet acknowledged by IoT Hub, flushed by dx_terminateDrain
+static const DX_DRAIN_SOURCE telemetryDrain = {
+    .name = "telemetry", .pending = TelemetryPending, .completed = TelemetryConfirmed, .pump = TelemetryPump, .stalled = TelemetryStalled};
+
 void dx_azureConnect(DX_USER_CONFIG *userConfig, const char *networkInterface, const char *plugAndPlayModelId)
 {
     if (connection_initialized) {
@@ -187,6 +220,7 @@ void dx_azureConnect(DX_USER_CONFIG *userConfig, const char *networkInterface, c
     }
 
     dx_azureToDeviceStart();
+    dx_terminateRegisterDrain(&telemetryDrain);
 
     connection_initialized = true;
 }
@@ -234,6 +268,7 @@ bool dx_isAzureConnected(void)
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     outstandingMessageCount--;
+    confirmedMessageCount++;
 #if DX_LOGGING_ENABLED
     Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
 #endif
@@ -263,11 +298,11 @@ static void AzureConnectionHandler(EventLoopTimer *eventLoopTimer)
         nextEventPeriod = (struct timespec){1, 0};
         break;
     case IoTHubClientAuthenticationState_AuthenticationInitiated:
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+        DX_PROFILE(&iothubClientHandle, "IoTHubDeviceClient_LL_DoWork", IoTHubDeviceClient_LL_DoWork(iothubClientHandle));
         nextEventPeriod = (struct timespec){1, 0};
         break;
     case IoTHubClientAuthenticationState_Authenticated:
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+        DX_PROFILE(&iothubClientHandle, "IoTHubDeviceClient_LL_DoWork", IoTHubDeviceClient_LL_DoWork(iothubClientHandle));
         nextEventPeriod = (struct timespec){IOT_HUB_POLL_TIME_SECONDS, IOT_HUB_POLL_TIME_NANOSECONDS};
         break;
     case IoTHubClientAuthenticationState_Device_Disbled:
@@ -355,8 +390,252 @@ IOTHUB_DEVICE_CLIENT_LL_HANDLE dx_azureClientHandleGet(void)
     return iothubClientHandle;
 }
 
+bool dx_azureSubscribeMessages(DX_MESSAGE_SUBSCRIPTION *subscription)
+{
+    if (subscription == NULL || subscription->handler == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < DX_AZURE_MAX_MESSAGE_SUBSCRIPTIONS; i++) {
+        if (_messageSubscriptions[i] == NULL) {
+            _messageSubscriptions[i] = subscription;
+            if (i >= _messageSubscriptionSlots) {
+                _messageSubscriptionSlots = i + 1;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void dx_azureUnsubscribeMessages(DX_MESSAGE_SUBSCRIPTION *subscription)
+{
+    for (size_t i = 0; i < _messageSubscriptionSlots; i++) {
+        if (_messageSubscriptions[i] == subscription) {
+            _messageSubscriptions[i] = NULL;
+        }
+    }
+
+    // Slots are not compacted, a handler unsubscribing itself mustn't move the ones after it
+    while (_messageSubscriptionSlots > 0 && _messageSubscriptions[_messageSubscriptionSlots - 1] == NULL) {
+        _messageSubscriptionSlots--;
+    }
+}
+
+// Looked up at most once per message, whichever subscriptions need them
+typedef struct MESSAGE_MATCH_STATE {
+    IOTHUB_MESSAGE_HANDLE message;
+    const char *payload;
+    size_t payloadLength;
+    bool contentTypeRead;
+    const char *contentType;
+    char memberKey[MESSAGE_MEMBER_KEY_LENGTH]; // copy of the last JSON member looked up, a handler may free the
+                                               // subscription it came from
+    bool memberFound;
+    const char *memberValue;
+    size_t memberValueLength;
+} MESSAGE_MATCH_STATE;
+
+static int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static long ReadHex4(const char *text, const char *end)
+{
+    long code = 0;
+
+    if (end - text < 4) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        int digit = HexDigit(text[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        code = code * 16 + digit;
+    }
+    return code;
+}
+
+/// <summary>
+/// Compare the text of a JSON string, without its quotes, to value after decoding escapes, so
+/// "a\/b" and "\u0041" match "a/b" and "A" as they would once parsed
+/// </summary>
+static bool JsonStringEquals(const char *text, size_t length, const char *value)
+{
+    const char *end = text + length;
+    char decoded[4];
+    size_t decodedLength;
+
+    while (text < end) {
+        if (*text != '\\') {
+            if (*value++ != *text++) {
+                return false;
+            }
+            continue;
+        }
+
+        if (++text == end) {
+            return false;
+        }
+
+        decodedLength = 1;
+        switch (*text++) {
+        case 'b':
+            decoded[0] = '\b';
+            break;
+        case 'f':
+            decoded[0] = '\f';
+            break;
+        case 'n':
+            decoded[0] = '\n';
+            break;
+        case 'r':
+            decoded[0] = '\r';
+            break;
+        case 't':
+            decoded[0] = '\t';
+            break;
+        case 'u': {
+            long code = ReadHex4(text, end);
+            if (code < 0) {
+                return false;
+            }
+            text += 4;
+            // A high surrogate must be followed by an escaped low surrogate
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                long low = end - text >= 6 && text[0] == '\\' && text[1] == 'u' ? ReadHex4(text + 2, end) : -1;
+                if (low < 0xDC00 || low > 0xDFFF) {
+                    return false;
+                }
+                text += 6;
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            if (code < 0x80) {
+                decoded[0] = (char)code;
+            } else if (code < 0x800) {
+                decoded[0] = (char)(0xC0 | (code >> 6));
+                decoded[1] = (char)(0x80 | (code & 0x3F));
+                decodedLength = 2;
+            } else if (code < 0x10000) {
+                decoded[0] = (char)(0xE0 | (code >> 12));
+                decoded[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+                decoded[2] = (char)(0x80 | (code & 0x3F));
+                decodedLength = 3;
+            } else {
+                decoded[0] = (char)(0xF0 | (code >> 18));
+                decoded[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+                decoded[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+                decoded[3] = (char)(0x80 | (code & 0x3F));
+                decodedLength = 4;
+            }
+            break;
+        }
+        default: // '"', '\\' and '/' stand for themselves
+            decoded[0] = text[-1];
+            break;
+        }
+
+        // A decoded NUL can't match inside value, strncmp stops at value's terminator
+        if (decoded[0] == '\0' || strncmp(value, decoded, decodedLength) != 0) {
+            return false;
+        }
+        value += decodedLength;
+    }
+
+    return *value == '\0';
+}
+
+static bool MessageMatches(const DX_MESSAGE_SUBSCRIPTION *subscription, MESSAGE_MATCH_STATE *state)
+{
+    const char *text = NULL;
+
+    switch (subscription->match) {
+    case DX_MESSAGE_MATCH_ALL:
+        return true;
+
+    case DX_MESSAGE_MATCH_PROPERTY:
+        text = IoTHubMessage_GetProperty(state->message, subscription->key);
+        return text != NULL && (subscription->value == NULL || strcmp(text, subscription->value) == 0);
+
+    case DX_MESSAGE_MATCH_CONTENT_TYPE:
+        if (!state->contentTypeRead) {
+            state->contentType = IoTHubMessage_GetContentTypeSystemProperty(state->message);
+            state->contentTypeRead = true;
+        }
+        return state->contentType != NULL && subscription->value != NULL && strcmp(state->contentType, subscription->value) == 0;
+
+    case DX_MESSAGE_MATCH_JSON_MEMBER:
+        if (subscription->key == NULL) {
+            return false;
+        }
+        // Subscriptions on the same member share one scan of the payload, keys too long to cache
+        // are looked up each time
+        if (state->memberKey[0] == '\0' || strcmp(state->memberKey, subscription->key) != 0) {
+            size_t keyLength = strlen(subscription->key);
+            if (keyLength < sizeof(state->memberKey)) {
+                memcpy(state->memberKey, subscription->key, keyLength + 1);
+            } else {
+                state->memberKey[0] = '\0';
+            }
+            state->memberFound = json_find_member(state->payload, state->payloadLength, subscription->key, &state->memberValue,
+                                                  &state->memberValueLength) == 1;
+        }
+        if (!state->memberFound || subscription->value == NULL) {
+            return state->memberFound;
+        }
+
+        text = state->memberValue;
+        size_t length = state->memberValueLength;
+        if (length >= 2 && text[0] == '"') {
+            return JsonStringEquals(text + 1, length - 2, subscription->value);
+        }
+        return strlen(subscription->value) == length && memcmp(text, subscription->value, length) == 0;
+
+    default:
+        return false;
+    }
+}
+
 static IOTHUBMESSAGE_DISPOSITION_RESULT HubMessageReceivedCallback(IOTHUB_MESSAGE_HANDLE message, void *context)
 {
+    const unsigned char *payload = NULL;
+    size_t payloadLength = 0;
+    bool matched = false, accepted = false, abandoned = false;
+
+    if (_messageSubscriptionSlots > 0 && IoTHubMessage_GetByteArray(message, &payload, &payloadLength) == IOTHUB_MESSAGE_OK) {
+        MESSAGE_MATCH_STATE state = {.message = message, .payload = (const char *)payload, .payloadLength = payloadLength};
+
+        for (size_t i = 0; i < _messageSubscriptionSlots; i++) {
+            DX_MESSAGE_SUBSCRIPTION *subscription = _messageSubscriptions[i];
+
+            if (subscription == NULL || !MessageMatches(subscription, &state)) {
+                continue;
+            }
+
+            matched = true;
+            switch (subscription->handler(subscription, payload, payloadLength, message)) {
+            case IOTHUBMESSAGE_ACCEPTED:
+                accepted = true;
+                break;
+            case IOTHUBMESSAGE_ABANDONED:
+                abandoned = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    if (matched) {
+        return accepted ? IOTHUBMESSAGE_ACCEPTED : abandoned ? IOTHUBMESSAGE_ABANDONED : IOTHUBMESSAGE_REJECTED;
+    }
+
     if (_messageReceivedCallback != NULL) {
         return _messageReceivedCallback(message, context);
     }
@@ -690,6 +969,8 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 
     } else {
         iotHubClientAuthenticationState = IoTHubClientAuthenticationState_Authenticated;
+        // The TLS handshake with the hub checked certificate validity, so the wall clock is good
+        dx_timestampSetClockValid();
     }
 
     dx_isAzureConnected();
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_coroutine.h"
+#include "dx_profiler.h"
+#include "dx_utilities.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+// Delays and fd timeouts of every coroutine share one timer, armed for the earliest wakeup in
+// this list, which is kept sorted by wakeNs
+static DX_COROUTINE_BINDING *sleepers = NULL;
+static EventLoopTimer *coroutineTimer = NULL;
+
+static void RemoveSleeper(DX_COROUTINE_BINDING *coroutine)
+{
+    DX_COROUTINE_BINDING **link;
+
+    for (link = &sleepers; *link != NULL; link = &(*link)->nextSleeper) {
+        if (*link == coroutine) {
+            *link = coroutine->nextSleeper;
+            break;
+        }
+    }
+
+    coroutine->nextSleeper = NULL;
+    coroutine->wakeNs = 0;
+}
+
+static bool ArmCoroutineTimer(void)
+{
+    int64_t delay;
+    struct timespec delaySpec;
+
+    if (sleepers == NULL) {
+        return DisarmEventLoopTimer(coroutineTimer) == 0;
+    }
+
+    // A zero timespec would disarm the timer, a due wakeup is armed for 1 ns from now instead
+    delay = sleepers->wakeNs - dx_getNowNanoseconds();
+    if (delay < 1) {
+        delay = 1;
+    }
+
+    delaySpec.tv_sec = (time_t)(delay / 1000000000LL);
+    delaySpec.tv_nsec = (long)(delay % 1000000000LL);
+
+    return SetEventLoopTimerOneShot(coroutineTimer, &delaySpec) == 0;
+}
+
+static void CancelWait(DX_COROUTINE_BINDING *coroutine)
+{
+    if (coroutine->registration != NULL) {
+        EventLoop_UnregisterIo(dx_timerGetEventLoop(), coroutine->registration);
+        coroutine->registration = NULL;
+    }
+
+    if (coroutine->wakeNs != 0) {
+        bool first = sleepers == coroutine;
+
+        RemoveSleeper(coroutine);
+        if (first) {
+            ArmCoroutineTimer();
+        }
+    }
+
+    coroutine->intercore = NULL;
+}
+
+static void Resume(DX_COROUTINE_BINDING *coroutine)
+{
+    DX_COROUTINE_STATE state;
+
+    DX_PROFILE(coroutine, coroutine->name, state = coroutine->handler(coroutine));
+
+    // Also covers a handler that called dx_coroutineStop on itself and then awaited
+    if (state == DX_COROUTINE_DONE || !coroutine->running) {
+        CancelWait(coroutine);
+        coroutine->running = false;
+        coroutine->resumePoint = 0;
+    }
+}
+
+static void CoroutineTimerHandler(EventLoopTimer *eventLoopTimer)
+{
+    DX_COROUTINE_BINDING *coroutine;
+    int64_t now;
+
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    now = dx_getNowNanoseconds();
+
+    // A coroutine that awaits again is due strictly after now, so one pass can't run it twice
+    while ((coroutine = sleepers) != NULL && coroutine->wakeNs <= now) {
+        RemoveSleeper(coroutine);
+
+        if (coroutine->registration != NULL) {
+            EventLoop_UnregisterIo(dx_timerGetEventLoop(), coroutine->registration);
+            coroutine->registration = NULL;
+            coroutine->timedOut = true;
+            coroutine->events = 0;
+            coroutine->received = -1;
+            coroutine->intercore = NULL;
+        }
+
+        Resume(coroutine);
+    }
+
+    ArmCoroutineTimer();
+}
+
+static bool AddSleeper(DX_COROUTINE_BINDING *coroutine, uint32_t milliseconds)
+{
+    DX_COROUTINE_BINDING **link;
+
+    if (coroutineTimer == NULL) {
+        coroutineTimer = CreateEventLoopDisarmedTimer(dx_timerGetEventLoop(), CoroutineTimerHandler);
+        if (coroutineTimer == NULL) {
+            Log_Debug("ERROR: Unable to create coroutine timer: %s (%d).\n", strerror(errno), errno);
+            return false;
+        }
+    }
+
+    // At least 1 ns ahead so a yield waits for the next pass of the event loop
+    coroutine->wakeNs = dx_getNowNanoseconds() + (int64_t)milliseconds * ONE_MS + 1;
+
+    for (link = &sleepers; *link != NULL && (*link)->wakeNs <= coroutine->wakeNs; link = &(*link)->nextSleeper) {
+    }
+
+    coroutine->nextSleeper = *link;
+    *link = coroutine;
+
+    if (sleepers == coroutine && !ArmCoroutineTimer()) {
+        Log_Debug("ERROR: Unable to arm coroutine timer: %s (%d).\n", strerror(errno), errno);
+        RemoveSleeper(coroutine);
+        return false;
+    }
+
+    return true;
+}
+
+static void CoroutineIoHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    DX_COROUTINE_BINDING *coroutine = (DX_COROUTINE_BINDING *)context;
+    DX_INTERCORE_BINDING *intercore = coroutine->intercore;
+
+    coroutine->intercore = NULL;
+    CancelWait(coroutine);
+
+    coroutine->timedOut = false;
+    coroutine->events = events;
+
+    if (intercore != NULL) {
+        coroutine->received = recv(intercore->sockFd, intercore->intercore_recv_block,
+                                   intercore->intercore_recv_block_length, MSG_DONTWAIT);
+        if (coroutine->received == -1) {
+            Log_Debug("ERROR: Unable to read intercore reply: %s (%d).\n", strerror(errno), errno);
+        }
+    }
+
+    Resume(coroutine);
+}
+
+bool dx_coroutineWaitDelay(DX_COROUTINE_BINDING *coroutine, uint32_t milliseconds)
+{
+    return AddSleeper(coroutine, milliseconds);
+}
+
+bool dx_coroutineWaitFd(DX_COROUTINE_BINDING *coroutine, int fd, EventLoop_IoEvents events, uint32_t timeoutMilliseconds)
+{
+    coroutine->registration = EventLoop_RegisterIo(dx_timerGetEventLoop(), fd, events, CoroutineIoHandler, coroutine);
+    if (coroutine->registration == NULL) {
+        Log_Debug("ERROR: Coroutine %s unable to register fd %d: %s (%d).\n", coroutine->name ? coroutine->name : "",
+                  fd, strerror(errno), errno);
+        return false;
+    }
+
+    if (timeoutMilliseconds != 0 && !AddSleeper(coroutine, timeoutMilliseconds)) {
+        EventLoop_UnregisterIo(dx_timerGetEventLoop(), coroutine->registration);
+        coroutine->registration = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool dx_coroutineWaitIntercore(DX_COROUTINE_BINDING *coroutine, DX_INTERCORE_BINDING *intercore_binding,
+                               uint32_t timeoutMilliseconds)
+{
+    if (intercore_binding == NULL || !intercore_binding->initialized || intercore_binding->interCoreCallback != NULL ||
+        intercore_binding->intercore_recv_block == NULL) {
+        Log_Debug("ERROR: Coroutine %s needs a connected intercore binding with a receive block and no callback\n",
+                  coroutine->name ? coroutine->name : "");
+        coroutine->received = -1;
+        return false;
+    }
+
+    if (!dx_coroutineWaitFd(coroutine, intercore_binding->sockFd, EventLoop_Input, timeoutMilliseconds)) {
+        coroutine->received = -1;
+        return false;
+    }
+
+    coroutine->intercore = intercore_binding;
+    return true;
+}
+
+bool dx_coroutineStart(DX_COROUTINE_BINDING *coroutine)
+{
+    if (coroutine->running || coroutine->handler == NULL) {
+        return false;
+    }
+
+#if defined(DX_PROFILER_ENABLED)
+    dx_profilerName(coroutine, coroutine->name);
+#endif
+
+    coroutine->running = true;
+    coroutine->resumePoint = 0;
+    coroutine->timedOut = false;
+    coroutine->events = 0;
+    coroutine->received = 0;
+
+    Resume(coroutine);
+    return true;
+}
+
+void dx_coroutineStop(DX_COROUTINE_BINDING *coroutine)
+{
+    CancelWait(coroutine);
+    coroutine->running = false;
+    coroutine->resumePoint = 0;
+}
+
+bool dx_coroutineIsRunning(DX_COROUTINE_BINDING *coroutine)
+{
+    return coroutine->running;
+}
+
+void dx_coroutineSetStart(DX_COROUTINE_BINDING *coroutineSet[], size_t coroutineCount)
+{
+    for (size_t i = 0; i < coroutineCount; i++) {
+        dx_coroutineStart(coroutineSet[i]);
+    }
+}
+
+void dx_coroutineSetStop(DX_COROUTINE_BINDING *coroutineSet[], size_t coroutineCount)
+{
+    for (size_t i = 0; i < coroutineCount; i++) {
+        dx_coroutineStop(coroutineSet[i]);
+    }
+}
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "dx_device_twins.h"
+#include "dx_profiler.h"
 
 static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state,
                                   bool deviceTwinPnPAcknowledgment,
@@ -10,24 +11,87 @@ static bool deviceTwinUpdateReportedState(char *reportedPropertiesString);
 static void deviceTwinClose(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void deviceTwinOpen(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void deviceTwinsReportStatusCallback(int result, void *context);
-static void SetDesiredState(JSON_Object *desiredProperties,
+static void SetDesiredState(JSON_Value *version, JSON_Value *jsonValue,
                             DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t payloadSize,
                                       void *userContextCallback);
 
 static DX_DEVICE_TWIN_BINDING **_deviceTwins = NULL;
 static size_t _deviceTwinCount = 0;
+static size_t outstandingReportedCount = 0;
+static unsigned long acknowledgedReportedCount = 0;
 
-void dx_deviceTwinSubscribe(DX_DEVICE_TWIN_BINDING *deviceTwins[], size_t deviceTwinCount)
+// "$version" followed by every twin property name, resolved against the desired properties in one
+// pass per update. Twin property names cannot contain '.', so they compile to single segment paths.
+// Held from dx_deviceTwinSubscribe to dx_deviceTwinUnsubscribe. Compiled paths and _desiredValues
+// come from malloc, never the JSON pool, so they don't hold off a dx_jsonPoolReset.
+static JSON_Path *_desiredPaths = NULL;
+static JSON_Value **_desiredValues = NULL;
+
+static size_t ReportedPending(void)
 {
-    dx_azureRegisterDeviceTwinCallback(DeviceTwinCallbackHandler);
+    return outstandingReportedCount;
+}
+
+static unsigned long ReportedAcknowledged(void)
+{
+    return acknowledgedReportedCount;
+}
+
+static bool ReportedStalled(void)
+{
+    return !dx_isAzureConnected();
+}
+
+// Reported properties the SDK has not had acknowledged, pumped by the telemetry drain's DoWork
+static const DX_DRAIN_SOURCE reportedDrain = {
+    .name = "reported properties", .pending = ReportedPending, .completed = ReportedAcknowledged, .stalled = ReportedStalled};
+
+static bool desiredPathsCompile(void)
+{
+    const char **names = (const char **)malloc((_deviceTwinCount + 1) * sizeof(char *));
+    if (names == NULL) {
+        return false;
+    }
+
+    names[0] = "$version";
+    for (int i = 0; i < _deviceTwinCount; i++) {
+        names[i + 1] = _deviceTwins[i]->propertyName;
+    }
+
+    _desiredPaths = json_path_compile_set(names, _deviceTwinCount + 1);
+    _desiredValues = (JSON_Value **)malloc((_deviceTwinCount + 1) * sizeof(JSON_Value *));
+    free(names);
 
+    return _desiredPaths != NULL && _desiredValues != NULL;
+}
+
+static void desiredPathsFree(void)
+{
+    json_path_free(_desiredPaths);
+    _desiredPaths = NULL;
+
+    free(_desiredValues);
+    _desiredValues = NULL;
+}
+
+void dx_deviceTwinSubscribe(DX_DEVICE_TWIN_BINDING *deviceTwins[], size_t deviceTwinCount)
+{
     _deviceTwins = deviceTwins;
     _deviceTwinCount = deviceTwinCount;
 
     for (int i = 0; i < _deviceTwinCount; i++) {
         deviceTwinOpen(_deviceTwins[i]);
     }
+
+    desiredPathsFree();
+    if (!desiredPathsCompile()) {
+        dx_terminate(DX_ExitCode_Json_Path_Compile_Failed);
+        return;
+    }
+
+    dx_azureRegisterDeviceTwinCallback(DeviceTwinCallbackHandler);
+    dx_terminateRegisterDrain(&reportedDrain);
 }
 
 void dx_deviceTwinUnsubscribe(void)
@@ -37,6 +101,8 @@ void dx_deviceTwinUnsubscribe(void)
     for (int i = 0; i < _deviceTwinCount; i++) {
         deviceTwinClose(_deviceTwins[i]);
     }
+
+    desiredPathsFree();
 }
 
 static void deviceTwinOpen(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
@@ -107,12 +173,10 @@ static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState,
         goto cleanup;
     }
 
-    memset(payLoadString, 0x00, payloadSize + 1);
-
+    // Parse in place, strings in root_value reference payLoadString so free it after root_value
     memcpy(payLoadString, payload, payloadSize);
-    payLoadString[payloadSize] = 0; // null terminate string
 
-    root_value = json_parse_string(payLoadString);
+    root_value = json_parse_string_in_situ(payLoadString, payloadSize);
     if (root_value == NULL) {
         goto cleanup;
     }
@@ -127,11 +191,13 @@ static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState,
         desiredProperties = root_object;
     }
 
+    if (json_path_get_values(desiredProperties, _desiredPaths, _desiredValues) == 0) {
+        goto cleanup;
+    }
+
     for (int i = 0; i < _deviceTwinCount; i++) {
-        JSON_Value *jsonValue =
-            json_object_get_value(desiredProperties, _deviceTwins[i]->propertyName);
-        if (jsonValue != NULL) {
-            SetDesiredState(desiredProperties, _deviceTwins[i]);
+        if (_desiredValues[i + 1] != NULL) {
+            SetDesiredState(_desiredValues[0], _desiredValues[i + 1], _deviceTwins[i]);
         }
     }
 
@@ -148,88 +214,82 @@ cleanup:
 }
 
 /// <summary>
-///     Checks to see if the device twin propertyName(name) is found in the json object. If yes,
-///     then act upon the request
+///     Checks the desired value found for the device twin propertyName(name) has the expected
+///     type. If yes, then act upon the request
 /// </summary>
-static void SetDesiredState(JSON_Object *jsonObject, DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+static void SetDesiredState(JSON_Value *version, JSON_Value *jsonValue, DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
 {
-    if (json_object_has_value_of_type(jsonObject, "$version", JSONNumber)) {
-        deviceTwinBinding->propertyVersion = (int)json_object_get_number(jsonObject, "$version");
+    if (json_value_get_type(version) == JSONNumber) {
+        deviceTwinBinding->propertyVersion = (int)json_value_get_number(version);
     }
 
     switch (deviceTwinBinding->twinType) {
     case DX_DEVICE_TWIN_INT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
+        if (json_value_get_type(jsonValue) == JSONNumber) {
             *(int *)deviceTwinBinding->propertyValue =
-                (int)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+                (int)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
         }
         break;
     case DX_DEVICE_TWIN_FLOAT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
+        if (json_value_get_type(jsonValue) == JSONNumber) {
             *(float *)deviceTwinBinding->propertyValue =
-                (float)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+                (float)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
         }
         break;
     case DX_DEVICE_TWIN_DOUBLE:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
+        if (json_value_get_type(jsonValue) == JSONNumber) {
             *(double *)deviceTwinBinding->propertyValue =
-                (double)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+                (double)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
         }
         break;
     case DX_DEVICE_TWIN_BOOL:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONBoolean)) {
+        if (json_value_get_type(jsonValue) == JSONBoolean) {
             *(bool *)deviceTwinBinding->propertyValue =
-                (bool)json_object_get_boolean(jsonObject, deviceTwinBinding->propertyName);
+                (bool)json_value_get_boolean(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
         }
         break;
     case DX_DEVICE_TWIN_STRING:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONString)) {
+        if (json_value_get_type(jsonValue) == JSONString) {
             deviceTwinBinding->propertyValue =
-                (char *)json_object_get_string(jsonObject, deviceTwinBinding->propertyName);
+                (char *)json_value_get_string(jsonValue);
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
             deviceTwinBinding->propertyValue = NULL;
         }
         break;
     case DX_DEVICE_TWIN_JSON_OBJECT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONObject)) {
+        if (json_value_get_type(jsonValue) == JSONObject) {
             deviceTwinBinding->propertyValue =
-                (JSON_Object *)json_object_get_object(jsonObject, deviceTwinBinding->propertyName);
+                (JSON_Object *)json_value_get_object(jsonValue);
 
             if (deviceTwinBinding->handler != NULL) {
-                deviceTwinBinding->handler(deviceTwinBinding);
+                DX_PROFILE(deviceTwinBinding, deviceTwinBinding->propertyName, deviceTwinBinding->handler(deviceTwinBinding));
             }
             deviceTwinBinding->propertyValue = NULL;
         }
@@ -416,6 +476,7 @@ static bool deviceTwinUpdateReportedState(char *reportedPropertiesString)
 
         return false;
     } else {
+        outstandingReportedCount++;
 #if DX_LOGGING_ENABLED
         Log_Debug("INFO: Reported state propertyUpdated '%s'.\n", reportedPropertiesString);
 #endif
@@ -431,6 +492,11 @@ static bool deviceTwinUpdateReportedState(char *reportedPropertiesString)
 /// </summary>
 void deviceTwinsReportStatusCallback(int result, void *context)
 {
+    if (outstandingReportedCount > 0) {
+        outstandingReportedCount--;
+    }
+    acknowledgedReportedCount++;
+
 #if DX_LOGGING_ENABLED
     Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
 #endif
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "dx_direct_methods.h"
+#include "dx_profiler.h"
 
 static int DirectMethodCallbackHandler(const char *method_name, const unsigned char *payload, size_t payloadSize,
                                        unsigned char **responsePayload, size_t *responsePayloadSize, void *userContextCallback);
@@ -61,12 +62,10 @@ static int DirectMethodCallbackHandler(const char *method_name, const unsigned c
         goto cleanup;
     }
 
-    memset(payLoadString, 0x00, payloadSize + 1);
-
+    // Parse in place, strings in root_value reference payLoadString so free it after root_value
     memcpy(payLoadString, payload, payloadSize);
-    payLoadString[payloadSize] = 0; // null terminate string
 
-    root_value = json_parse_string(payLoadString);
+    root_value = json_parse_string_in_situ(payLoadString, payloadSize);
     if (root_value == NULL) {
         responseMessage = invalidJsonMsg;
         result = DX_METHOD_FAILED;
@@ -84,7 +83,8 @@ static int DirectMethodCallbackHandler(const char *method_name, const unsigned c
     if (directMethodBinding != NULL &&
         directMethodBinding->handler != NULL) { // was a DX_DIRECT_METHOD_BINDING found
 
-        responseCode = directMethodBinding->handler(root_value, directMethodBinding, &responseMsg);
+        DX_PROFILE(directMethodBinding, directMethodBinding->methodName,
+                   responseCode = directMethodBinding->handler(root_value, directMethodBinding, &responseMsg));
 
         result = (int)responseCode;
 
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "dx_intercore.h"
+#include "dx_profiler.h"
 
 static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
 static bool ProcessMsg(DX_INTERCORE_BINDING *intercore_binding);
@@ -140,7 +141,8 @@ static bool ProcessMsg(DX_INTERCORE_BINDING *intercore_binding)
         return false;
     }
 
-    intercore_binding->interCoreCallback(intercore_binding->intercore_recv_block, (ssize_t)bytesReceived);
+    DX_PROFILE(intercore_binding, intercore_binding->rtAppComponentId,
+               intercore_binding->interCoreCallback(intercore_binding->intercore_recv_block, (ssize_t)bytesReceived));
 
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_json_pool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct FREE_BLOCK {
+    struct FREE_BLOCK *next;
+} FREE_BLOCK;
+
+typedef struct POOL_CLASS {
+    size_t blockSize;
+    size_t blockCount;
+    uint8_t *arena;
+    FREE_BLOCK *freeList;
+    size_t inUse;
+    size_t highWater;
+} POOL_CLASS;
+
+// malloc fallbacks carry their size for the byte counters.
+// The union keeps the payload 8 byte aligned for doubles on 32 bit targets.
+typedef union FALLBACK_HEADER {
+    size_t size;
+    double align;
+} FALLBACK_HEADER;
+
+// uint64_t backing keeps every block 8 byte aligned
+static uint64_t arena16[(16 * DX_JSON_POOL_BLOCKS_16) / sizeof(uint64_t)];
+static uint64_t arena32[(32 * DX_JSON_POOL_BLOCKS_32) / sizeof(uint64_t)];
+static uint64_t arena64[(64 * DX_JSON_POOL_BLOCKS_64) / sizeof(uint64_t)];
+static uint64_t arena128[(128 * DX_JSON_POOL_BLOCKS_128) / sizeof(uint64_t)];
+static uint64_t arena256[(256 * DX_JSON_POOL_BLOCKS_256) / sizeof(uint64_t)];
+
+static POOL_CLASS pool[DX_JSON_POOL_CLASS_COUNT] = {
+    {16, DX_JSON_POOL_BLOCKS_16, (uint8_t *)arena16, NULL, 0, 0},
+    {32, DX_JSON_POOL_BLOCKS_32, (uint8_t *)arena32, NULL, 0, 0},
+    {64, DX_JSON_POOL_BLOCKS_64, (uint8_t *)arena64, NULL, 0, 0},
+    {128, DX_JSON_POOL_BLOCKS_128, (uint8_t *)arena128, NULL, 0, 0},
+    {256, DX_JSON_POOL_BLOCKS_256, (uint8_t *)arena256, NULL, 0, 0},
+};
+
+static size_t fallbackInUse, fallbackHighWater, fallbackBytes, fallbackBytesHighWater, fallbackTotal;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void BuildFreeLists(void)
+{
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        POOL_CLASS *sizeClass = &pool[i];
+        sizeClass->freeList = NULL;
+        // Thread from the end so blocks are handed out in address order
+        for (size_t block = sizeClass->blockCount; block > 0; block--) {
+            FREE_BLOCK *freeBlock = (FREE_BLOCK *)(sizeClass->arena + (block - 1) * sizeClass->blockSize);
+            freeBlock->next = sizeClass->freeList;
+            sizeClass->freeList = freeBlock;
+        }
+        sizeClass->inUse = 0;
+    }
+}
+
+static POOL_CLASS *FindOwningClass(const void *ptr)
+{
+    const uint8_t *address = (const uint8_t *)ptr;
+
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        if (address >= pool[i].arena && address < pool[i].arena + pool[i].blockSize * pool[i].blockCount) {
+            return &pool[i];
+        }
+    }
+    return NULL;
+}
+
+static void *FallbackMalloc(size_t size)
+{
+    FALLBACK_HEADER *header = (FALLBACK_HEADER *)malloc(sizeof(FALLBACK_HEADER) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+
+    header->size = size;
+
+    fallbackTotal++;
+    fallbackBytes += size;
+    if (++fallbackInUse > fallbackHighWater) {
+        fallbackHighWater = fallbackInUse;
+    }
+    if (fallbackBytes > fallbackBytesHighWater) {
+        fallbackBytesHighWater = fallbackBytes;
+    }
+
+    return header + 1;
+}
+
+static void FallbackFree(void *ptr)
+{
+    FALLBACK_HEADER *header = (FALLBACK_HEADER *)ptr - 1;
+
+    fallbackInUse--;
+    fallbackBytes -= header->size;
+    free(header);
+}
+
+void *dx_jsonPoolMalloc(size_t size)
+{
+    void *block = NULL;
+
+    pthread_mutex_lock(&poolLock);
+
+    // Smallest class that fits, spilling upwards when a class is exhausted
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT && block == NULL; i++) {
+        POOL_CLASS *sizeClass = &pool[i];
+        if (size <= sizeClass->blockSize && sizeClass->freeList != NULL) {
+            block = sizeClass->freeList;
+            sizeClass->freeList = sizeClass->freeList->next;
+            if (++sizeClass->inUse > sizeClass->highWater) {
+                sizeClass->highWater = sizeClass->inUse;
+            }
+        }
+    }
+
+    if (block == NULL) {
+        block = FallbackMalloc(size);
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    return block;
+}
+
+void dx_jsonPoolFree(void *ptr)
+{
+    POOL_CLASS *sizeClass = NULL;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&poolLock);
+
+    if ((sizeClass = FindOwningClass(ptr)) != NULL) {
+        FREE_BLOCK *freeBlock = (FREE_BLOCK *)ptr;
+        freeBlock->next = sizeClass->freeList;
+        sizeClass->freeList = freeBlock;
+        sizeClass->inUse--;
+    } else {
+        FallbackFree(ptr);
+    }
+
+    pthread_mutex_unlock(&poolLock);
+}
+
+void dx_jsonPoolInit(void)
+{
+    pthread_mutex_lock(&poolLock);
+    BuildFreeLists();
+    pthread_mutex_unlock(&poolLock);
+
+    json_set_allocation_functions(dx_jsonPoolMalloc, dx_jsonPoolFree);
+}
+
+bool dx_jsonPoolReset(void)
+{
+    size_t live;
+
+    pthread_mutex_lock(&poolLock);
+
+    // Anything still allocated is a JSON value or string someone holds, leave the pool alone
+    live = fallbackInUse;
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        live += pool[i].inUse;
+    }
+
+    if (live == 0) {
+        fallbackTotal = 0;
+        BuildFreeLists();
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    return live == 0;
+}
+
+void dx_jsonPoolGetStats(DX_JSON_POOL_STATS *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&poolLock);
+
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        stats->sizeClass[i].blockSize = pool[i].blockSize;
+        stats->sizeClass[i].blockCount = pool[i].blockCount;
+        stats->sizeClass[i].inUse = pool[i].inUse;
+        stats->sizeClass[i].highWater = pool[i].highWater;
+    }
+    stats->fallbackInUse = fallbackInUse;
+    stats->fallbackHighWater = fallbackHighWater;
+    stats->fallbackBytesHighWater = fallbackBytesHighWater;
+    stats->fallbackTotal = fallbackTotal;
+
+    pthread_mutex_unlock(&poolLock);
+}
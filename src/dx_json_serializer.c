@@ -1,11 +1,11 @@
 #include "dx_json_serializer.h"
+#include <float.h>
 
 bool dx_jsonSerialize(char *buffer, size_t buffer_size, int key_value_pair_count, ...)
 {
     JSON_Value *root_value = json_value_init_object();
     JSON_Object *root_object = json_value_get_object(root_value);
 
-    char *json_string = NULL;
     char *key = NULL;
     bool result = false;
 
@@ -41,15 +41,172 @@ bool dx_jsonSerialize(char *buffer, size_t buffer_size, int key_value_pair_count
     }
     va_end(valist);
 
-    json_string = json_serialize_to_string(root_value);
+    // Serialize straight into the caller's buffer, fails if it is too small and leaves an empty
+    // string
+    result = json_serialize_to_buffer(root_value, buffer, buffer_size) == JSONSuccess;
 
-    if (strlen(json_string) < buffer_size) {
-        strncpy(buffer, json_string, buffer_size);
-        result = true;
-    }
-
-    json_free_serialized_string(json_string);
     json_value_free(root_value);
 
     return result;
 }
+
+void dx_jsonWriterInit(DX_JSON_WRITER *writer, char *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = size == 0;
+}
+
+void dx_jsonWriterRaw(DX_JSON_WRITER *writer, const char *data, size_t length)
+{
+    // Keep one byte spare for the terminating null written by dx_jsonWriterFinish
+    if (writer->overflow || length >= writer->size - writer->length) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+void dx_jsonWriterBool(DX_JSON_WRITER *writer, bool value)
+{
+    if (value) {
+        dx_jsonWriterLiteral(writer, "true");
+    } else {
+        dx_jsonWriterLiteral(writer, "false");
+    }
+}
+
+void dx_jsonWriterInt(DX_JSON_WRITER *writer, int value)
+{
+    char digits[12];
+    char *cursor = digits + sizeof(digits);
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        *--cursor = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+
+    if (value < 0) {
+        *--cursor = '-';
+    }
+
+    dx_jsonWriterRaw(writer, cursor, (size_t)(digits + sizeof(digits) - cursor));
+}
+
+void dx_jsonWriterUint64(DX_JSON_WRITER *writer, uint64_t value)
+{
+    char digits[20];
+    char *cursor = digits + sizeof(digits);
+
+    do {
+        *--cursor = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    dx_jsonWriterRaw(writer, cursor, (size_t)(digits + sizeof(digits) - cursor));
+}
+
+static void dx_jsonWriterNumber(DX_JSON_WRITER *writer, const char *format, double value)
+{
+    char number[32];
+    int length;
+
+    // JSON has no representation for NaN or infinity
+    if (value != value || value > DBL_MAX || value < -DBL_MAX) {
+        dx_jsonWriterLiteral(writer, "null");
+        return;
+    }
+
+    length = snprintf(number, sizeof(number), format, value);
+    if (length < 0 || (size_t)length >= sizeof(number)) {
+        writer->overflow = true;
+        return;
+    }
+    dx_jsonWriterRaw(writer, number, (size_t)length);
+}
+
+void dx_jsonWriterFloat(DX_JSON_WRITER *writer, float value)
+{
+    dx_jsonWriterNumber(writer, "%.9g", value);
+}
+
+void dx_jsonWriterDouble(DX_JSON_WRITER *writer, double value)
+{
+    dx_jsonWriterNumber(writer, "%1.17g", value);
+}
+
+void dx_jsonWriterString(DX_JSON_WRITER *writer, const char *value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run;
+    char escape[6] = {'\\', 'u', '0', '0'};
+
+    if (value == NULL) {
+        dx_jsonWriterLiteral(writer, "null");
+        return;
+    }
+
+    dx_jsonWriterLiteral(writer, "\"");
+
+    // Copy runs of characters that need no escaping in one go. Escapes match parson's
+    // json_serialize_string, including "\/", so both produce the same bytes for a string.
+    for (run = value; *value; value++) {
+        unsigned char c = (unsigned char)*value;
+
+        if (c >= 0x20 && c != '"' && c != '\\' && c != '/') {
+            continue;
+        }
+
+        dx_jsonWriterRaw(writer, run, (size_t)(value - run));
+        run = value + 1;
+
+        switch (c) {
+        case '"':
+            dx_jsonWriterLiteral(writer, "\\\"");
+            break;
+        case '\\':
+            dx_jsonWriterLiteral(writer, "\\\\");
+            break;
+        case '/':
+            dx_jsonWriterLiteral(writer, "\\/");
+            break;
+        case '\b':
+            dx_jsonWriterLiteral(writer, "\\b");
+            break;
+        case '\f':
+            dx_jsonWriterLiteral(writer, "\\f");
+            break;
+        case '\n':
+            dx_jsonWriterLiteral(writer, "\\n");
+            break;
+        case '\r':
+            dx_jsonWriterLiteral(writer, "\\r");
+            break;
+        case '\t':
+            dx_jsonWriterLiteral(writer, "\\t");
+            break;
+        default:
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0xf];
+            dx_jsonWriterRaw(writer, escape, sizeof(escape));
+            break;
+        }
+    }
+    dx_jsonWriterRaw(writer, run, (size_t)(value - run));
+
+    dx_jsonWriterLiteral(writer, "\"");
+}
+
+bool dx_jsonWriterFinish(DX_JSON_WRITER *writer)
+{
+    if (writer->size == 0) {
+        return false;
+    }
+
+    // dx_jsonWriterRaw always leaves room for the terminator
+    writer->buffer[writer->overflow ? 0 : writer->length] = 0;
+    return !writer->overflow;
+}
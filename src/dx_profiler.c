@@ -0,0 +1,303 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_profiler.h"
+#include "dx_json_serializer.h"
+#include "dx_timer.h"
+#include "dx_utilities.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// Open addressed on the key, only written from the event loop thread
+static DX_PROFILER_ENTRY profilerEntries[DX_PROFILER_MAX_ENTRIES];
+static DX_PROFILER_ENTRY profilerOther = {.key = &profilerOther, .name = "other"};
+static uint32_t defaultBudgetUs = DX_PROFILER_DEFAULT_BUDGET_US;
+
+// Handlers running on the event loop thread, innermost last
+static struct {
+    const void *key;
+    const DX_PROFILER_ENTRY *entry;
+    int64_t start;
+} runningStack[DX_PROFILER_MAX_DEPTH];
+static size_t runningDepth = 0;
+
+// Innermost running handler published for other threads. runningSequence is odd while the
+// event loop thread updates the fields, readers retry until they see the same even value.
+static atomic_uint runningSequence;
+static _Atomic(const DX_PROFILER_ENTRY *) runningEntry;
+static atomic_llong runningStart;
+
+static DX_PROFILER_ENTRY *ProfilerFind(const void *key)
+{
+    size_t slot = (size_t)(((uintptr_t)key >> 3) * 0x9E3779B1u) % DX_PROFILER_MAX_ENTRIES;
+
+    for (size_t probe = 0; probe < DX_PROFILER_MAX_ENTRIES; probe++) {
+        DX_PROFILER_ENTRY *entry = &profilerEntries[slot];
+
+        if (entry->key == key) {
+            return entry;
+        }
+
+        if (entry->key == NULL) {
+            entry->key = key;
+            return entry;
+        }
+
+        slot = (slot + 1) % DX_PROFILER_MAX_ENTRIES;
+    }
+
+    return NULL;
+}
+
+int64_t dx_profilerBegin(void)
+{
+    return dx_getNowNanoseconds();
+}
+
+static void PublishRunning(void)
+{
+    unsigned int sequence = atomic_load_explicit(&runningSequence, memory_order_relaxed);
+
+    atomic_store_explicit(&runningSequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (runningDepth == 0) {
+        atomic_store_explicit(&runningEntry, NULL, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(&runningEntry, runningStack[runningDepth - 1].entry, memory_order_relaxed);
+        atomic_store_explicit(&runningStart, runningStack[runningDepth - 1].start, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&runningSequence, sequence + 2, memory_order_release);
+}
+
+void dx_profilerEnter(const void *key, const char *name, int64_t start)
+{
+    DX_PROFILER_ENTRY *entry = ProfilerFind(key);
+
+    // Named now so a handler that hangs on its first run can still be reported by name
+    if (entry != NULL && entry->name == NULL) {
+        entry->name = name;
+    }
+
+    // Deeper nesting is timed as usual but not shown as running
+    if (runningDepth < DX_PROFILER_MAX_DEPTH) {
+        runningStack[runningDepth].key = key;
+        runningStack[runningDepth].entry = entry ? entry : &profilerOther;
+        runningStack[runningDepth].start = start;
+    }
+    runningDepth++;
+
+    if (runningDepth <= DX_PROFILER_MAX_DEPTH) {
+        PublishRunning();
+    }
+}
+
+static void ProfilerLeave(const void *key)
+{
+    if (runningDepth == 0 || (runningDepth <= DX_PROFILER_MAX_DEPTH && runningStack[runningDepth - 1].key != key)) {
+        return; // not entered through dx_profilerEnter
+    }
+
+    runningDepth--;
+
+    if (runningDepth < DX_PROFILER_MAX_DEPTH) {
+        PublishRunning();
+    }
+}
+
+bool dx_profilerRunning(const char **name, int64_t *start)
+{
+    const DX_PROFILER_ENTRY *entry;
+    unsigned int sequence;
+
+    do {
+        sequence = atomic_load_explicit(&runningSequence, memory_order_acquire);
+        entry = atomic_load_explicit(&runningEntry, memory_order_relaxed);
+        *start = atomic_load_explicit(&runningStart, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) != 0 || sequence != atomic_load_explicit(&runningSequence, memory_order_relaxed));
+
+    // Names are set before a handler first runs and never change afterwards
+    *name = entry != NULL ? entry->name : NULL;
+    return entry != NULL;
+}
+
+void dx_profilerEnd(const void *key, const char *name, int64_t start)
+{
+    dx_profilerRecord(key, name, dx_profilerBegin() - start);
+}
+
+void dx_profilerRecord(const void *key, const char *name, int64_t runNs)
+{
+    DX_PROFILER_ENTRY *entry = ProfilerFind(key);
+    uint64_t run = runNs > 0 ? (uint64_t)runNs : 0;
+
+    ProfilerLeave(key);
+    uint64_t us = run / 1000;
+    uint32_t budgetUs;
+    unsigned int bucket;
+
+    if (entry == NULL) {
+        entry = &profilerOther;
+    }
+
+    if (entry->name == NULL) {
+        entry->name = name;
+    }
+
+    budgetUs = entry->budgetUs ? entry->budgetUs : defaultBudgetUs;
+
+    if (us > budgetUs) {
+        entry->overBudget++;
+        if (run > entry->maxNs) {
+            Log_Debug("WARNING: Handler %s ran for %llu us, budget is %u us\n", entry->name ? entry->name : "(unnamed)",
+                      (unsigned long long)us, budgetUs);
+        }
+    }
+
+    if (run > entry->maxNs) {
+        entry->maxNs = run;
+    }
+
+    entry->count++;
+    entry->totalNs += run;
+
+    bucket = us == 0 ? 0 : 64 - (unsigned int)__builtin_clzll(us);
+    entry->histogram[bucket < DX_PROFILER_HISTOGRAM_BUCKETS ? bucket : DX_PROFILER_HISTOGRAM_BUCKETS - 1]++;
+}
+
+void dx_profilerName(const void *key, const char *name)
+{
+    DX_PROFILER_ENTRY *entry = ProfilerFind(key);
+
+    if (entry != NULL && name != NULL) {
+        entry->name = name;
+    }
+}
+
+bool dx_profilerSetBudget(const void *key, uint32_t budgetUs)
+{
+    DX_PROFILER_ENTRY *entry;
+
+    if (key == NULL) {
+        defaultBudgetUs = budgetUs;
+        return true;
+    }
+
+    if ((entry = ProfilerFind(key)) == NULL) {
+        return false;
+    }
+
+    entry->budgetUs = budgetUs;
+    return true;
+}
+
+size_t dx_profilerTop(const DX_PROFILER_ENTRY *top[], size_t topCount)
+{
+    size_t found = 0;
+
+    // Insertion into the caller's array, cheap for the handful of entries a report shows
+    for (int i = 0; i <= DX_PROFILER_MAX_ENTRIES; i++) {
+        const DX_PROFILER_ENTRY *entry = i < DX_PROFILER_MAX_ENTRIES ? &profilerEntries[i] : &profilerOther;
+        size_t position;
+
+        if (entry->count == 0) {
+            continue;
+        }
+
+        for (position = found; position > 0 && top[position - 1]->totalNs < entry->totalNs; position--) {
+            if (position < topCount) {
+                top[position] = top[position - 1];
+            }
+        }
+
+        if (position < topCount) {
+            top[position] = entry;
+            if (found < topCount) {
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+static uint32_t ProfilerMaxUs(const DX_PROFILER_ENTRY *entry)
+{
+    return entry->maxNs / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(entry->maxNs / 1000);
+}
+
+bool dx_profilerSerialize(size_t topCount, char *buffer, size_t bufferSize)
+{
+    const DX_PROFILER_ENTRY *top[DX_PROFILER_MAX_ENTRIES + 1];
+    DX_JSON_WRITER writer;
+    size_t count;
+
+    count = dx_profilerTop(top, topCount < DX_PROFILER_MAX_ENTRIES + 1 ? topCount : DX_PROFILER_MAX_ENTRIES + 1);
+
+    dx_jsonWriterInit(&writer, buffer, bufferSize);
+    dx_jsonWriterLiteral(&writer, "{");
+
+    for (size_t i = 0; i < count; i++) {
+        const DX_PROFILER_ENTRY *entry = top[i];
+
+        if (i > 0) {
+            dx_jsonWriterLiteral(&writer, ",");
+        }
+
+        if (entry->name != NULL) {
+            dx_jsonWriterString(&writer, entry->name);
+        } else {
+            char name[24];
+            snprintf(name, sizeof(name), "%p", entry->key);
+            dx_jsonWriterString(&writer, name);
+        }
+
+        dx_jsonWriterLiteral(&writer, ":{\"count\":");
+        dx_jsonWriterUint64(&writer, entry->count);
+        dx_jsonWriterLiteral(&writer, ",\"overBudget\":");
+        dx_jsonWriterUint64(&writer, entry->overBudget);
+        dx_jsonWriterLiteral(&writer, ",\"totalMs\":");
+        dx_jsonWriterUint64(&writer, entry->totalNs / 1000000);
+        dx_jsonWriterLiteral(&writer, ",\"avgUs\":");
+        dx_jsonWriterUint64(&writer, entry->totalNs / entry->count / 1000);
+        dx_jsonWriterLiteral(&writer, ",\"p99Us\":");
+        dx_jsonWriterUint64(&writer, dx_timerStatsPercentile(entry->histogram, ProfilerMaxUs(entry), 99));
+        dx_jsonWriterLiteral(&writer, ",\"maxUs\":");
+        dx_jsonWriterUint64(&writer, ProfilerMaxUs(entry));
+        dx_jsonWriterLiteral(&writer, "}");
+    }
+
+    dx_jsonWriterLiteral(&writer, "}");
+    return dx_jsonWriterFinish(&writer);
+}
+
+void dx_profilerLog(size_t topCount)
+{
+    const DX_PROFILER_ENTRY *top[DX_PROFILER_MAX_ENTRIES + 1];
+    size_t count = dx_profilerTop(top, topCount < DX_PROFILER_MAX_ENTRIES + 1 ? topCount : DX_PROFILER_MAX_ENTRIES + 1);
+
+    Log_Debug("%-32s %8s %10s %8s %8s %8s %6s\n", "handler", "count", "total ms", "avg us", "p99 us", "max us", "over");
+    for (size_t i = 0; i < count; i++) {
+        const DX_PROFILER_ENTRY *entry = top[i];
+
+        Log_Debug("%-32s %8u %10llu %8llu %8u %8u %6u\n", entry->name ? entry->name : "(unnamed)", entry->count,
+                  (unsigned long long)(entry->totalNs / 1000000), (unsigned long long)(entry->totalNs / entry->count / 1000),
+                  dx_timerStatsPercentile(entry->histogram, ProfilerMaxUs(entry), 99), ProfilerMaxUs(entry), entry->overBudget);
+    }
+}
+
+void dx_profilerReset(void)
+{
+    for (int i = 0; i <= DX_PROFILER_MAX_ENTRIES; i++) {
+        DX_PROFILER_ENTRY *entry = i < DX_PROFILER_MAX_ENTRIES ? &profilerEntries[i] : &profilerOther;
+
+        entry->count = 0;
+        entry->overBudget = 0;
+        entry->totalNs = 0;
+        entry->maxNs = 0;
+        memset(entry->histogram, 0, sizeof(entry->histogram));
+    }
+}
@@ -0,0 +1,302 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_storage.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// File layout: two slots of DX_STORAGE_SLOT_SIZE bytes, each a STORAGE_SLOT_HEADER followed by
+// records, each a STORAGE_RECORD_HEADER and its payload padded to a multiple of four bytes. A
+// save writes the whole image to the slot that does not hold the current one, with the next
+// sequence number, so a write cut short by a power loss damages only the slot being written and
+// the previous image still loads. Mutable storage is a single file, so there is no rename to
+// swap a temporary file into place.
+#define STORAGE_MAGIC 0x54535844 // "DXST"
+#define STORAGE_VERSION 2
+#define STORAGE_SLOT_COUNT 2
+#define STORAGE_PADDED(length) (((length) + 3) & ~(size_t)3)
+
+typedef struct STORAGE_SLOT_HEADER {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t length; // of the records that follow
+    uint32_t crc;    // covers the records
+} STORAGE_SLOT_HEADER;
+
+typedef struct STORAGE_RECORD_HEADER {
+    uint32_t tag;
+    uint32_t length;
+} STORAGE_RECORD_HEADER;
+
+static pthread_mutex_t storageLock = PTHREAD_MUTEX_INITIALIZER;
+static int storageFd = -1;
+
+static uint32_t Crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static bool StorageOpen(void)
+{
+    if (storageFd < 0) {
+        storageFd = Storage_OpenMutableFile();
+        if (storageFd < 0) {
+            Log_Debug("ERROR: Storage_OpenMutableFile failed: %s (%d). Is MutableStorage set in app_manifest.json?\n",
+                      strerror(errno), errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Read the records of one slot. Returns false if the slot is empty, not written by this module,
+/// or damaged, *records is NULL when the slot holds no records.
+/// </summary>
+static bool StorageLoadSlot(int slot, STORAGE_SLOT_HEADER *header, uint8_t **records)
+{
+    off_t slotOffset = (off_t)slot * DX_STORAGE_SLOT_SIZE;
+
+    *records = NULL;
+
+    if (pread(storageFd, header, sizeof(*header), slotOffset) != (ssize_t)sizeof(*header) ||
+        header->magic != STORAGE_MAGIC || header->version != STORAGE_VERSION ||
+        header->length > DX_STORAGE_SLOT_SIZE - sizeof(*header)) {
+        return false;
+    }
+
+    if (header->length == 0) {
+        return header->crc == Crc32(NULL, 0);
+    }
+
+    if ((*records = malloc(header->length)) == NULL) {
+        return false;
+    }
+
+    if (pread(storageFd, *records, header->length, slotOffset + (off_t)sizeof(*header)) != (ssize_t)header->length ||
+        Crc32(*records, header->length) != header->crc) {
+        Log_Debug("Mutable storage slot %d is damaged, ignoring it\n", slot);
+        free(*records);
+        *records = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Read the records of the newest intact slot. *slot is -1 and *records NULL when neither slot
+/// holds an image.
+/// </summary>
+static bool StorageLoad(uint8_t **records, size_t *recordsLength, int *slot, uint32_t *sequence)
+{
+    STORAGE_SLOT_HEADER header;
+    uint8_t *slotRecords;
+
+    *records = NULL;
+    *recordsLength = 0;
+    *slot = -1;
+    *sequence = 0;
+
+    for (int i = 0; i < STORAGE_SLOT_COUNT; i++) {
+        if (!StorageLoadSlot(i, &header, &slotRecords)) {
+            continue;
+        }
+
+        // Serial number comparison, so the sequence can wrap
+        if (*slot < 0 || (int32_t)(header.sequence - *sequence) > 0) {
+            free(*records);
+            *records = slotRecords;
+            *recordsLength = header.length;
+            *slot = i;
+            *sequence = header.sequence;
+        } else {
+            free(slotRecords);
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Returns the offset of the record with tag, or recordsLength if there is none
+/// </summary>
+static size_t StorageFind(const uint8_t *records, size_t recordsLength, uint32_t tag)
+{
+    size_t offset = 0;
+    STORAGE_RECORD_HEADER record;
+
+    while (offset < recordsLength) {
+        memcpy(&record, records + offset, sizeof(record));
+        if (record.tag == tag) {
+            return offset;
+        }
+        offset += sizeof(record) + STORAGE_PADDED(record.length);
+    }
+    return recordsLength;
+}
+
+/// <summary>
+/// Write records to the slot after currentSlot, leaving out the record at skipOffset if there is
+/// one, and appending a new record when data is not NULL
+/// </summary>
+static bool StorageRewrite(const uint8_t *records, size_t recordsLength, int currentSlot, uint32_t sequence,
+                           size_t skipOffset, uint32_t tag, const void *data, size_t length)
+{
+    STORAGE_SLOT_HEADER header = {.magic = STORAGE_MAGIC, .version = STORAGE_VERSION, .sequence = sequence + 1};
+    int slot = currentSlot < 0 ? 0 : (currentSlot + 1) % STORAGE_SLOT_COUNT;
+    size_t skipLength = 0, imageLength, offset;
+    uint8_t *image;
+    bool result = false;
+
+    if (skipOffset < recordsLength) {
+        STORAGE_RECORD_HEADER skipped;
+        memcpy(&skipped, records + skipOffset, sizeof(skipped));
+        skipLength = sizeof(skipped) + STORAGE_PADDED(skipped.length);
+    }
+
+    imageLength = sizeof(header) + recordsLength - skipLength;
+    if (data != NULL) {
+        imageLength += sizeof(STORAGE_RECORD_HEADER) + STORAGE_PADDED(length);
+    }
+
+    if (imageLength > DX_STORAGE_SLOT_SIZE) {
+        Log_Debug("ERROR: Mutable storage records need %zu bytes, more than DX_STORAGE_SLOT_SIZE\n", imageLength);
+        return false;
+    }
+
+    if ((image = calloc(1, imageLength)) == NULL) {
+        return false;
+    }
+
+    offset = sizeof(header);
+
+    if (recordsLength > 0) {
+        size_t keepBefore = skipOffset < recordsLength ? skipOffset : recordsLength;
+        memcpy(image + offset, records, keepBefore);
+        offset += keepBefore;
+
+        if (skipLength > 0) {
+            memcpy(image + offset, records + skipOffset + skipLength, recordsLength - skipOffset - skipLength);
+            offset += recordsLength - skipOffset - skipLength;
+        }
+    }
+
+    if (data != NULL) {
+        STORAGE_RECORD_HEADER record = {.tag = tag, .length = (uint32_t)length};
+        memcpy(image + offset, &record, sizeof(record));
+        memcpy(image + offset + sizeof(record), data, length);
+    }
+
+    header.length = (uint32_t)(imageLength - sizeof(header));
+    header.crc = Crc32(image + sizeof(header), header.length);
+    memcpy(image, &header, sizeof(header));
+
+    if (pwrite(storageFd, image, imageLength, (off_t)slot * DX_STORAGE_SLOT_SIZE) != (ssize_t)imageLength) {
+        Log_Debug("ERROR: Mutable storage write failed: %s (%d)\n", strerror(errno), errno);
+        goto cleanup;
+    }
+
+    if (fsync(storageFd) != 0) {
+        Log_Debug("ERROR: Mutable storage sync failed: %s (%d)\n", strerror(errno), errno);
+        goto cleanup;
+    }
+
+    result = true;
+
+cleanup:
+    free(image);
+    return result;
+}
+
+bool dx_storageWrite(uint32_t tag, const void *data, size_t length)
+{
+    uint8_t *records = NULL;
+    size_t recordsLength;
+    int slot;
+    uint32_t sequence;
+    bool result = false;
+
+    if (data == NULL || length > UINT32_MAX) {
+        return false;
+    }
+
+    pthread_mutex_lock(&storageLock);
+
+    if (StorageOpen() && StorageLoad(&records, &recordsLength, &slot, &sequence)) {
+        result = StorageRewrite(records, recordsLength, slot, sequence, StorageFind(records, recordsLength, tag), tag, data,
+                                length);
+    }
+
+    pthread_mutex_unlock(&storageLock);
+
+    free(records);
+    return result;
+}
+
+bool dx_storageRead(uint32_t tag, void *buffer, size_t bufferSize, size_t *length)
+{
+    uint8_t *records = NULL;
+    size_t recordsLength, offset;
+    int slot;
+    uint32_t sequence;
+    bool result = false;
+
+    pthread_mutex_lock(&storageLock);
+
+    if (StorageOpen() && StorageLoad(&records, &recordsLength, &slot, &sequence)) {
+        offset = StorageFind(records, recordsLength, tag);
+
+        if (offset < recordsLength) {
+            STORAGE_RECORD_HEADER record;
+            memcpy(&record, records + offset, sizeof(record));
+
+            if (length != NULL) {
+                *length = record.length;
+            }
+
+            if (record.length <= bufferSize) {
+                memcpy(buffer, records + offset + sizeof(record), record.length);
+                result = true;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&storageLock);
+
+    free(records);
+    return result;
+}
+
+bool dx_storageDelete(uint32_t tag)
+{
+    uint8_t *records = NULL;
+    size_t recordsLength, offset;
+    int slot;
+    uint32_t sequence;
+    bool result = false;
+
+    pthread_mutex_lock(&storageLock);
+
+    if (StorageOpen() && StorageLoad(&records, &recordsLength, &slot, &sequence)) {
+        offset = StorageFind(records, recordsLength, tag);
+        result = offset == recordsLength || StorageRewrite(records, recordsLength, slot, sequence, offset, 0, NULL, 0);
+    }
+
+    pthread_mutex_unlock(&storageLock);
+
+    free(records);
+    return result;
+}
@@ -2,9 +2,13 @@
    Licensed under the MIT License. */
 
 #include "dx_terminate.h"
+#include "dx_utilities.h"
+#include <stdatomic.h>
 
-static volatile sig_atomic_t terminationRequired = false;
-static volatile sig_atomic_t _exitCode = 0;
+// Atomic rather than volatile sig_atomic_t as worker threads also read it, lock free atomics are
+// safe to set from the signal handler
+static atomic_bool terminationRequired = false;
+static atomic_int _exitCode = 0;
 
 void dx_registerTerminationHandler(void)
 {
@@ -48,4 +52,118 @@ void dx_eventLoopRun(void)
             dx_terminate(DX_ExitCode_Main_EventLoopFail);
         }
     }
-}
\ No newline at end of file
+}
+
+static const DX_DRAIN_SOURCE *drainSources[DX_TERMINATE_MAX_DRAIN_SOURCES];
+static size_t drainSourceCount = 0;
+
+bool dx_terminateRegisterDrain(const DX_DRAIN_SOURCE *source)
+{
+    for (size_t i = 0; i < drainSourceCount; i++) {
+        if (drainSources[i] == source) {
+            return true;
+        }
+    }
+
+    if (drainSourceCount == DX_TERMINATE_MAX_DRAIN_SOURCES || source == NULL || source->pending == NULL) {
+        return false;
+    }
+
+    drainSources[drainSourceCount++] = source;
+    return true;
+}
+
+void dx_terminateUnregisterDrain(const DX_DRAIN_SOURCE *source)
+{
+    for (size_t i = 0; i < drainSourceCount; i++) {
+        if (drainSources[i] == source) {
+            memmove(&drainSources[i], &drainSources[i + 1], (drainSourceCount - i - 1) * sizeof(drainSources[0]));
+            drainSourceCount--;
+            return;
+        }
+    }
+}
+
+/// <summary>
+/// True while some source has pending items that can still be flushed
+/// </summary>
+static bool DrainOutstanding(void)
+{
+    for (size_t i = 0; i < drainSourceCount; i++) {
+        const DX_DRAIN_SOURCE *source = drainSources[i];
+
+        if (source->pending() > 0 && (source->stalled == NULL || !source->stalled())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool dx_terminateDrain(uint32_t deadlineMs, DX_DRAIN_REPORT *report)
+{
+    EventLoop *el = dx_timerGetEventLoop();
+    unsigned long completedAtStart[DX_TERMINATE_MAX_DRAIN_SOURCES];
+    unsigned long droppedAtStart[DX_TERMINATE_MAX_DRAIN_SOURCES];
+    int64_t start = dx_getNowMilliseconds();
+    int64_t deadline = start + deadlineMs;
+    int64_t nextPump = start;
+    int64_t now = start;
+    bool complete = true;
+
+    for (size_t i = 0; i < drainSourceCount; i++) {
+        completedAtStart[i] = drainSources[i]->completed ? drainSources[i]->completed() : 0;
+        droppedAtStart[i] = drainSources[i]->dropped ? drainSources[i]->dropped() : 0;
+    }
+
+    while (DrainOutstanding() && (now = dx_getNowMilliseconds()) < deadline) {
+        if (now >= nextPump) {
+            for (size_t i = 0; i < drainSourceCount; i++) {
+                if (drainSources[i]->pump != NULL) {
+                    drainSources[i]->pump();
+                }
+            }
+            nextPump = now + DX_TERMINATE_DRAIN_PUMP_MS;
+        }
+
+        // Timers, dx_async completions and socket events still run, bounded so the pumps keep
+        // their cadence and the deadline is honoured
+        int64_t wait = (nextPump < deadline ? nextPump : deadline) - dx_getNowMilliseconds();
+        if (EventLoop_Run(el, wait > 0 ? (int)wait : 0, true) == -1 && errno != EINTR) {
+            break;
+        }
+    }
+
+    if (report != NULL) {
+        memset(report, 0, sizeof(*report));
+        report->sourceCount = drainSourceCount;
+    }
+
+    for (size_t i = 0; i < drainSourceCount; i++) {
+        const DX_DRAIN_SOURCE *source = drainSources[i];
+        unsigned long flushed = source->completed ? source->completed() - completedAtStart[i] : 0;
+        size_t dropped = source->pending();
+
+        if (source->dropped != NULL) {
+            dropped += source->dropped() - droppedAtStart[i];
+        }
+
+        if (dropped > 0) {
+            complete = false;
+        }
+
+        Log_Debug("INFO: Shutdown drain %s: %lu flushed, %zu dropped\n", source->name ? source->name : "(unnamed)", flushed,
+                  dropped);
+
+        if (report != NULL) {
+            report->sources[i] = (DX_DRAIN_RESULT){.name = source->name, .flushed = flushed, .dropped = dropped};
+        }
+    }
+
+    if (report != NULL) {
+        report->elapsedMs = (uint32_t)(dx_getNowMilliseconds() - start);
+        report->complete = complete;
+    }
+
+    return complete;
+}
@@ -0,0 +1,329 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_threadpool.h"
+#include <pthread.h>
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWorkAvailable = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolWorkerExited = PTHREAD_COND_INITIALIZER;
+
+// Protected by poolLock
+static DX_THREADPOOL_JOB *queueHead = NULL;
+static DX_THREADPOOL_JOB *queueTail = NULL;
+static size_t queueDepth = 0;
+static int workersRunning = 0;
+static DX_THREADPOOL_JOB *undelivered = NULL; // completions that could not be posted while stopping
+
+// Only touched by the event loop thread
+static unsigned long jobsSubmitted = 0;
+static unsigned long jobsCompleted = 0;
+static DX_THREADPOOL_JOB *deferred = NULL; // completions waiting for room in the async queue
+
+static atomic_bool poolStopping = false;
+static char workerName[] = "dx_threadpool worker";
+
+/// <summary>
+/// Runs on the event loop thread through dx_async
+/// </summary>
+static void JobCompleted(void *arg)
+{
+    DX_THREADPOOL_JOB *job = (DX_THREADPOOL_JOB *)arg;
+
+    job->busy = false;
+    jobsCompleted++;
+
+    if (job->completed != NULL) {
+        job->completed(job, atomic_load(&job->cancelled));
+    }
+}
+
+static void DeferredRetryHandler(EventLoopTimer *eventLoopTimer);
+
+static DX_TIMER_BINDING deferredRetryTimer = {.handler = DeferredRetryHandler, .name = "dx_threadpool retry"};
+
+/// <summary>
+/// Deliver a completion from the event loop thread. completed always runs later from the event
+/// loop, never from inside the caller. If the async queue is full the job is kept and posted
+/// again by deferredRetryTimer, or by the drain's pump once the app is terminating.
+/// </summary>
+static void CompleteOnEventLoop(DX_THREADPOOL_JOB *job)
+{
+    DX_THREADPOOL_JOB **tail;
+
+    if (deferred == NULL && dx_asyncPost(JobCompleted, job)) {
+        return;
+    }
+
+    // Keep completions in order behind the ones already waiting
+    job->next = NULL;
+    for (tail = &deferred; *tail != NULL; tail = &(*tail)->next) {
+    }
+    *tail = job;
+
+    dx_timerOneShotSet(&deferredRetryTimer, &(struct timespec){0, DX_THREADPOOL_RETRY_MS * ONE_MS});
+}
+
+static void PostDeferred(void)
+{
+    DX_THREADPOOL_JOB *job;
+
+    while ((job = deferred) != NULL && dx_asyncPost(JobCompleted, job)) {
+        deferred = job->next;
+    }
+
+    if (deferred != NULL) {
+        dx_timerOneShotSet(&deferredRetryTimer, &(struct timespec){0, DX_THREADPOOL_RETRY_MS * ONE_MS});
+    }
+}
+
+static void DeferredRetryHandler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    PostDeferred();
+}
+
+static void CompleteFromWorker(DX_THREADPOOL_JOB *job)
+{
+    static const struct timespec retryDelay = {0, 1 * ONE_MS};
+
+    while (!dx_asyncPost(JobCompleted, job)) {
+        pthread_mutex_lock(&poolLock);
+        if (atomic_load(&poolStopping)) {
+            // The event loop is waiting in dx_threadpoolStop and can't drain the queue, leave the
+            // completion for it to run once the workers have exited
+            job->next = undelivered;
+            undelivered = job;
+            pthread_mutex_unlock(&poolLock);
+            return;
+        }
+        pthread_mutex_unlock(&poolLock);
+
+        nanosleep(&retryDelay, NULL);
+    }
+}
+
+static void *Worker(void *arg)
+{
+    DX_THREADPOOL_JOB *job;
+
+    pthread_mutex_lock(&poolLock);
+
+    for (;;) {
+        while (!atomic_load(&poolStopping) && queueHead == NULL) {
+            pthread_cond_wait(&poolWorkAvailable, &poolLock);
+        }
+
+        if (atomic_load(&poolStopping)) {
+            break; // dx_threadpoolStop cancels what is still queued
+        }
+
+        job = queueHead;
+        queueHead = job->next;
+        if (queueHead == NULL) {
+            queueTail = NULL;
+        }
+        queueDepth--;
+
+        pthread_mutex_unlock(&poolLock);
+
+        // Once the app is terminating queued jobs are completed as cancelled without running
+        if (dx_isTerminationRequired()) {
+            atomic_store(&job->cancelled, true);
+        }
+
+        if (!atomic_load(&job->cancelled)) {
+            job->work(job);
+        }
+
+        pthread_mutex_lock(&poolLock);
+
+        // Stopping while the job ran counts as cancelling it, the same as dx_threadpoolCancel.
+        // From here on dx_threadpoolCancel reports the job as finished instead of cancelling it.
+        if (atomic_load(&poolStopping) || dx_isTerminationRequired()) {
+            atomic_store(&job->cancelled, true);
+        }
+        job->finished = true;
+
+        pthread_mutex_unlock(&poolLock);
+
+        CompleteFromWorker(job);
+
+        pthread_mutex_lock(&poolLock);
+    }
+
+    workersRunning--;
+    pthread_cond_signal(&poolWorkerExited);
+    pthread_mutex_unlock(&poolLock);
+
+    return NULL;
+}
+
+static size_t JobsPending(void)
+{
+    return jobsSubmitted - jobsCompleted;
+}
+
+static unsigned long JobsCompleted(void)
+{
+    return jobsCompleted;
+}
+
+// Submitted jobs whose completed handler has not run. Queued jobs are cancelled once the app is
+// terminating, so the drain mostly waits for running jobs and their completions. The pump posts
+// completions that found the async queue full, the retry timer no longer runs by then.
+static const DX_DRAIN_SOURCE threadpoolDrain = {
+    .name = "threadpool", .pending = JobsPending, .completed = JobsCompleted, .pump = PostDeferred};
+
+bool dx_threadpoolStart(void)
+{
+    if (!dx_asyncInit() || !dx_timerStart(&deferredRetryTimer)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&poolLock);
+
+    while (workersRunning < DX_THREADPOOL_THREADS) {
+        workersRunning++;
+        if (!dx_startThreadDetached(Worker, NULL, workerName)) {
+            workersRunning--;
+            pthread_mutex_unlock(&poolLock);
+            return false;
+        }
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    dx_terminateRegisterDrain(&threadpoolDrain);
+    return true;
+}
+
+bool dx_threadpoolSubmit(DX_THREADPOOL_JOB *job)
+{
+    bool queued = false;
+
+    if (job == NULL || job->work == NULL || job->busy || dx_isTerminationRequired()) {
+        return false;
+    }
+
+    pthread_mutex_lock(&poolLock);
+
+    if (workersRunning > 0 && !atomic_load(&poolStopping) && queueDepth < DX_THREADPOOL_QUEUE_LENGTH) {
+        job->busy = true;
+        job->finished = false;
+        job->next = NULL;
+        atomic_store(&job->cancelled, false);
+
+        if (queueTail != NULL) {
+            queueTail->next = job;
+        } else {
+            queueHead = job;
+        }
+        queueTail = job;
+        queueDepth++;
+
+        pthread_cond_signal(&poolWorkAvailable);
+        jobsSubmitted++;
+        queued = true;
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    return queued;
+}
+
+bool dx_threadpoolCancel(DX_THREADPOOL_JOB *job)
+{
+    DX_THREADPOOL_JOB **link, *previous = NULL;
+    bool removed = false, cancelled = false;
+
+    if (job == NULL || !job->busy) {
+        return false;
+    }
+
+    pthread_mutex_lock(&poolLock);
+
+    // The worker sets finished under the lock, so the flag is either seen before the work
+    // returns or not set at all
+    if (!job->finished) {
+        atomic_store(&job->cancelled, true);
+        cancelled = true;
+    }
+
+    for (link = &queueHead; *link != NULL; previous = *link, link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            if (queueTail == job) {
+                queueTail = previous;
+            }
+            queueDepth--;
+            removed = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    // A job already running completes through its worker
+    if (removed) {
+        CompleteOnEventLoop(job);
+    }
+
+    return cancelled;
+}
+
+bool dx_threadpoolJobCancelled(DX_THREADPOOL_JOB *job)
+{
+    return atomic_load(&job->cancelled) || atomic_load(&poolStopping) || dx_isTerminationRequired();
+}
+
+size_t dx_threadpoolQueueDepth(void)
+{
+    size_t depth;
+
+    pthread_mutex_lock(&poolLock);
+    depth = queueDepth;
+    pthread_mutex_unlock(&poolLock);
+
+    return depth;
+}
+
+void dx_threadpoolStop(void)
+{
+    DX_THREADPOOL_JOB *queued, *pending, *job;
+
+    pthread_mutex_lock(&poolLock);
+
+    atomic_store(&poolStopping, true);
+    pthread_cond_broadcast(&poolWorkAvailable);
+
+    queued = queueHead;
+    queueHead = queueTail = NULL;
+    queueDepth = 0;
+
+    // Running jobs see dx_threadpoolJobCancelled and are expected to return promptly
+    while (workersRunning > 0) {
+        pthread_cond_wait(&poolWorkerExited, &poolLock);
+    }
+
+    pending = undelivered;
+    undelivered = NULL;
+    atomic_store(&poolStopping, false);
+
+    pthread_mutex_unlock(&poolLock);
+
+    while ((job = queued) != NULL) {
+        queued = job->next;
+        atomic_store(&job->cancelled, true);
+        CompleteOnEventLoop(job);
+    }
+
+    while ((job = pending) != NULL) {
+        pending = job->next;
+        CompleteOnEventLoop(job);
+    }
+}
@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 #include "dx_timer.h"
+#include "dx_json_serializer.h"
+#include "dx_profiler.h"
 
 static EventLoop *eventLoop = NULL;
 
@@ -37,6 +39,10 @@ bool dx_timerStart(DX_TIMER_BINDING *timer)
         return true;
     }
 
+#if defined(DX_PROFILER_ENABLED)
+    dx_profilerName((const void *)timer->handler, timer->name);
+#endif
+
     if (timer->delay != NULL && timer->repeat != NULL) {
         Log_Debug("Can't specify both a timer delay and a repeat period\n");
         dx_terminate(DX_ExitCode_Create_Timer_Failed);
@@ -46,7 +52,7 @@ bool dx_timerStart(DX_TIMER_BINDING *timer)
     // is this a oneshot timer
     if (timer->delay != NULL) {
         timer->eventLoopTimer = CreateEventLoopDisarmedTimer(eventLoop, timer->handler);
-        if (timer->eventLoopTimer == NULL) {
+        if (timer->eventLoopTimer == NULL || SetEventLoopTimerSlack(timer->eventLoopTimer, &timer->slack) != 0) {
             dx_terminate(DX_ExitCode_Create_Timer_Failed);
             return false;
         }
@@ -61,7 +67,7 @@ bool dx_timerStart(DX_TIMER_BINDING *timer)
     // is this a repeating timer
     if (timer->repeat != NULL) {
         timer->eventLoopTimer = CreateEventLoopPeriodicTimer(eventLoop, timer->handler, timer->repeat);
-        if (timer->eventLoopTimer == NULL) {
+        if (timer->eventLoopTimer == NULL || SetEventLoopTimerSlack(timer->eventLoopTimer, &timer->slack) != 0) {
             dx_terminate(DX_ExitCode_Create_Timer_Failed);
             return false;
         }
@@ -72,13 +78,13 @@ bool dx_timerStart(DX_TIMER_BINDING *timer)
     // if timer period is zero then create a disarmed timer
     if (timer->period.tv_nsec == 0 && timer->period.tv_sec == 0) { // Set up a disabled DX_TIMER_BINDING for oneshot or change timer
         timer->eventLoopTimer = CreateEventLoopDisarmedTimer(eventLoop, timer->handler);
-        if (timer->eventLoopTimer == NULL) {
+        if (timer->eventLoopTimer == NULL || SetEventLoopTimerSlack(timer->eventLoopTimer, &timer->slack) != 0) {
             dx_terminate(DX_ExitCode_Create_Timer_Failed);
             return false;
         }
     } else {
         timer->eventLoopTimer = CreateEventLoopPeriodicTimer(eventLoop, timer->handler, &timer->period);
-        if (timer->eventLoopTimer == NULL) {
+        if (timer->eventLoopTimer == NULL || SetEventLoopTimerSlack(timer->eventLoopTimer, &timer->slack) != 0) {
             dx_terminate(DX_ExitCode_Create_Timer_Failed);
             return false;
         }
@@ -130,4 +136,108 @@ bool dx_timerOneShotSet(DX_TIMER_BINDING *timer, const struct timespec *period)
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool dx_timerGetStats(DX_TIMER_BINDING *timer, DX_TIMER_STATS *stats, bool reset)
+{
+    if (timer->eventLoopTimer == NULL || stats == NULL) {
+        return false;
+    }
+
+    return GetEventLoopTimerStats(timer->eventLoopTimer, stats, reset) == 0;
+}
+
+uint32_t dx_timerStatsPercentile(const uint32_t *histogram, uint32_t max, unsigned int percentile)
+{
+    uint64_t total = 0, rank, seen = 0;
+
+    for (int bucket = 0; bucket < EVENTLOOP_TIMER_HISTOGRAM_BUCKETS; bucket++) {
+        total += histogram[bucket];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the sample at the percentile, rounded up so p100 is the largest sample
+    rank = (total * percentile + 99) / 100;
+
+    for (int bucket = 0; bucket < EVENTLOOP_TIMER_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += histogram[bucket];
+        if (seen >= rank) {
+            uint32_t upper = 1u << bucket;
+            return upper < max ? upper : max;
+        }
+    }
+
+    return max;
+}
+
+static void dx_timerStatsWrite(DX_JSON_WRITER *writer, const DX_TIMER_STATS *stats)
+{
+    uint32_t fired = stats->fired ? stats->fired : 1;
+
+    dx_jsonWriterLiteral(writer, "{\"fired\":");
+    dx_jsonWriterUint64(writer, stats->fired);
+    dx_jsonWriterLiteral(writer, ",\"missed\":");
+    dx_jsonWriterUint64(writer, stats->missed);
+    dx_jsonWriterLiteral(writer, ",\"lateAvgUs\":");
+    dx_jsonWriterUint64(writer, stats->totalLatenessUs / fired);
+    dx_jsonWriterLiteral(writer, ",\"lateP99Us\":");
+    dx_jsonWriterUint64(writer, dx_timerStatsPercentile(stats->lateness, stats->maxLatenessUs, 99));
+    dx_jsonWriterLiteral(writer, ",\"lateMaxUs\":");
+    dx_jsonWriterUint64(writer, stats->maxLatenessUs);
+    dx_jsonWriterLiteral(writer, ",\"runAvgUs\":");
+    dx_jsonWriterUint64(writer, stats->totalRunUs / fired);
+    dx_jsonWriterLiteral(writer, ",\"runP99Us\":");
+    dx_jsonWriterUint64(writer, dx_timerStatsPercentile(stats->runTime, stats->maxRunUs, 99));
+    dx_jsonWriterLiteral(writer, ",\"runMaxUs\":");
+    dx_jsonWriterUint64(writer, stats->maxRunUs);
+    dx_jsonWriterLiteral(writer, "}");
+}
+
+bool dx_timerStatsSerialize(DX_TIMER_BINDING *timerSet[], size_t timerCount, char *buffer, size_t bufferSize, bool reset)
+{
+    DX_JSON_WRITER writer;
+    DX_TIMER_STATS stats;
+    bool first = true;
+
+    dx_jsonWriterInit(&writer, buffer, bufferSize);
+    dx_jsonWriterLiteral(&writer, "{");
+
+    for (size_t i = 0; i < timerCount; i++) {
+        if (!dx_timerGetStats(timerSet[i], &stats, false)) {
+            continue;
+        }
+
+        if (!first) {
+            dx_jsonWriterLiteral(&writer, ",");
+        }
+        first = false;
+
+        if (timerSet[i]->name != NULL) {
+            dx_jsonWriterString(&writer, timerSet[i]->name);
+        } else {
+            dx_jsonWriterLiteral(&writer, "\"timer");
+            dx_jsonWriterUint64(&writer, i);
+            dx_jsonWriterLiteral(&writer, "\"");
+        }
+        dx_jsonWriterLiteral(&writer, ":");
+        dx_timerStatsWrite(&writer, &stats);
+    }
+
+    dx_jsonWriterLiteral(&writer, "}");
+    if (!dx_jsonWriterFinish(&writer)) {
+        return false;
+    }
+
+    // Only clear once the interval has been captured, a message that did not fit must not lose it.
+    // Timers fire on this thread, so nothing is counted between the copy and the reset.
+    if (reset) {
+        for (size_t i = 0; i < timerCount; i++) {
+            dx_timerGetStats(timerSet[i], &stats, true);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_timestamp.h"
+#include "dx_utilities.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define SECONDS_PER_DAY 86400
+
+static atomic_bool clockValid = false;
+static void (*clockValidCallbacks[DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS])(void);
+
+// Last second formatted on this thread
+static _Thread_local int64_t cachedSecond = -1;
+static _Thread_local char cachedUtc[DX_TIMESTAMP_UTC_LENGTH];
+
+static int64_t RealtimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+DX_TIMESTAMP dx_timestampNow(void)
+{
+    return dx_getNowNanoseconds();
+}
+
+bool dx_timestampClockValid(void)
+{
+    return atomic_load(&clockValid) && time(NULL) >= DX_TIMESTAMP_MIN_VALID_UTC;
+}
+
+void dx_timestampSetClockValid(void)
+{
+    if (atomic_exchange(&clockValid, true)) {
+        return;
+    }
+
+    for (size_t i = 0; i < DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS; i++) {
+        if (clockValidCallbacks[i] != NULL) {
+            clockValidCallbacks[i]();
+        }
+    }
+}
+
+bool dx_timestampRegisterClockValidNotification(void (*handler)(void))
+{
+    for (size_t i = 0; i < DX_TIMESTAMP_MAX_CLOCK_VALID_CALLBACKS; i++) {
+        if (clockValidCallbacks[i] == NULL) {
+            clockValidCallbacks[i] = handler;
+
+            if (atomic_load(&clockValid)) {
+                handler();
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool dx_timestampToUtcMs(DX_TIMESTAMP stamp, int64_t *utcMilliseconds)
+{
+    int64_t offset;
+
+    if (!dx_timestampClockValid()) {
+        return false;
+    }
+
+    // The current offset between the clocks, so stamps from before a clock step convert with
+    // the corrected wall clock
+    offset = RealtimeNs() - dx_getNowNanoseconds();
+    *utcMilliseconds = (stamp + offset) / 1000000;
+    return true;
+}
+
+bool dx_timestampFormatUtc(DX_TIMESTAMP stamp, char *buffer, size_t bufferSize)
+{
+    int64_t utcMilliseconds;
+
+    if (!dx_timestampToUtcMs(stamp, &utcMilliseconds)) {
+        return false;
+    }
+
+    return dx_timestampFormatUtcSeconds(utcMilliseconds / 1000, buffer, bufferSize);
+}
+
+static char *FormatDigits(char *out, unsigned int value, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--) {
+        out[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return out + digits;
+}
+
+/// <summary>
+/// Write utcSeconds as "YYYY-MM-DDTHH:MM:SSZ" without gmtime and strftime. The date comes from
+/// the day count with the days-to-civil algorithm on a calendar whose years start in March.
+/// </summary>
+static void FormatUtc(int64_t utcSeconds, char *out)
+{
+    int64_t days = utcSeconds / SECONDS_PER_DAY;
+    int64_t secondOfDay = utcSeconds % SECONDS_PER_DAY;
+
+    if (secondOfDay < 0) {
+        secondOfDay += SECONDS_PER_DAY;
+        days--;
+    }
+
+    days += 719468; // days from 0000-03-01 to 1970-01-01
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned int dayOfEra = (unsigned int)(days - era * 146097);
+    unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned int monthIndex = (5 * dayOfYear + 2) / 153;
+    unsigned int day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    unsigned int month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    int64_t year = (int64_t)yearOfEra + era * 400 + (month <= 2);
+
+    out = FormatDigits(out, (unsigned int)year, 4);
+    *out++ = '-';
+    out = FormatDigits(out, month, 2);
+    *out++ = '-';
+    out = FormatDigits(out, day, 2);
+    *out++ = 'T';
+    out = FormatDigits(out, (unsigned int)(secondOfDay / 3600), 2);
+    *out++ = ':';
+    out = FormatDigits(out, (unsigned int)(secondOfDay / 60 % 60), 2);
+    *out++ = ':';
+    out = FormatDigits(out, (unsigned int)(secondOfDay % 60), 2);
+    *out++ = 'Z';
+    *out = '\0';
+}
+
+bool dx_timestampFormatUtcSeconds(int64_t utcSeconds, char *buffer, size_t bufferSize)
+{
+    if (buffer == NULL || bufferSize < DX_TIMESTAMP_UTC_LENGTH) {
+        return false;
+    }
+
+    if (utcSeconds != cachedSecond) {
+        FormatUtc(utcSeconds, cachedUtc);
+        cachedSecond = utcSeconds;
+    }
+
+    memcpy(buffer, cachedUtc, DX_TIMESTAMP_UTC_LENGTH);
+    return true;
+}
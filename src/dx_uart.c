@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "dx_uart.h"
+#include "dx_profiler.h"
 
 // Forward declarations
 static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
@@ -69,7 +70,7 @@ static bool ProcessUartEvent(DX_UART_BINDING *uart_binding)
         return false;
     } else {
         // call the binding specific handler to read and process the data
-        uart_binding->handler(uart_binding);
+        DX_PROFILE(uart_binding, uart_binding->name, uart_binding->handler(uart_binding));
         return true;
     }
 }
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "dx_utilities.h"
+#include "dx_timestamp.h"
 
 static char *_log_debug_buffer = NULL;
 static size_t _log_debug_buffer_size;
@@ -94,9 +95,10 @@ bool dx_isDeviceAuthReady(void)
 
 char *dx_getCurrentUtc(char *buffer, size_t bufferSize)
 {
-    time_t now = time(NULL);
-    struct tm *t = gmtime(&now);
-    strftime(buffer, bufferSize - 1, "%Y-%m-%dT%H:%M:%SZ", t);
+    // Formatted once per second, callers in the same second get a copy
+    if (!dx_timestampFormatUtcSeconds((int64_t)time(NULL), buffer, bufferSize) && bufferSize > 0) {
+        buffer[0] = '\0';
+    }
     return buffer;
 }
 
@@ -104,7 +106,14 @@ int64_t dx_getNowMilliseconds(void)
 {
     struct timespec now = {0, 0};
     clock_gettime(CLOCK_MONOTONIC, &now);
-    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int64_t dx_getNowNanoseconds(void)
+{
+    struct timespec now = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
 int dx_stringEndsWith(const char *str, const char *suffix)
@@ -0,0 +1,362 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_watchdog.h"
+#include "dx_json_serializer.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// Bump when DX_WATCHDOG_REPORT changes so a report from an older build is ignored
+#define WATCHDOG_REPORT_VERSION 1
+
+static void HeartbeatHandler(EventLoopTimer *eventLoopTimer);
+
+static DX_TIMER_BINDING heartbeatTimer = {.period = {DX_WATCHDOG_HEARTBEAT_MS / 1000, (DX_WATCHDOG_HEARTBEAT_MS % 1000) * ONE_MS},
+                                          .handler = HeartbeatHandler,
+                                          .name = "dx_watchdog heartbeat"};
+static atomic_llong lastBeatNs;
+static int64_t lastSnapshotNs;
+
+// Loop statistics copied by the heartbeat for the watchdog thread to use in a report
+static pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static DX_WATCHDOG_REPORT snapshot;
+
+#if defined(DX_PROFILER_ENABLED)
+// Profiler totals at the previous snapshot, so the report shows the last interval only
+static struct {
+    const DX_PROFILER_ENTRY *entry;
+    uint32_t count;
+    uint64_t totalNs;
+} previousTotals[DX_PROFILER_MAX_ENTRIES + 1];
+static size_t previousTotalCount = 0;
+#endif
+
+static pthread_mutex_t watchdogLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchdogWake;
+static pthread_cond_t watchdogExited = PTHREAD_COND_INITIALIZER;
+static bool watchdogRunning = false;
+static bool watchdogStopping = false;
+static uint32_t thresholdMs = DX_WATCHDOG_STALL_MS;
+static char watchdogName[] = "dx_watchdog";
+
+static void CopyName(char *destination, const char *name)
+{
+    if (name == NULL) {
+        destination[0] = '\0';
+        return;
+    }
+
+    strncpy(destination, name, DX_WATCHDOG_NAME_LENGTH - 1);
+    destination[DX_WATCHDOG_NAME_LENGTH - 1] = '\0';
+}
+
+#if defined(DX_PROFILER_ENABLED)
+/// <summary>
+/// Fill top with the handlers that ran longest since the previous snapshot
+/// </summary>
+static uint32_t SnapshotHandlers(DX_WATCHDOG_HANDLER *top)
+{
+    const DX_PROFILER_ENTRY *entries[DX_PROFILER_MAX_ENTRIES + 1];
+    size_t count = dx_profilerTop(entries, NELEMS(entries));
+    uint32_t topCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const DX_PROFILER_ENTRY *entry = entries[i];
+        uint32_t runs = entry->count;
+        uint64_t totalNs = entry->totalNs;
+        size_t previous;
+
+        for (previous = 0; previous < previousTotalCount && previousTotals[previous].entry != entry; previous++) {
+        }
+
+        // A total below the previous one means the profiler was reset in between
+        if (previous < previousTotalCount && previousTotals[previous].totalNs <= totalNs) {
+            runs -= previousTotals[previous].count;
+            totalNs -= previousTotals[previous].totalNs;
+        }
+
+        if (runs > 0) {
+            size_t position = topCount < DX_WATCHDOG_TOP_HANDLERS ? topCount++ : DX_WATCHDOG_TOP_HANDLERS;
+
+            // Insertion, largest interval total first
+            while (position > 0 && top[position - 1].totalUs < totalNs / 1000) {
+                if (position < DX_WATCHDOG_TOP_HANDLERS) {
+                    top[position] = top[position - 1];
+                }
+                position--;
+            }
+
+            if (position < DX_WATCHDOG_TOP_HANDLERS) {
+                CopyName(top[position].name, entry->name);
+                top[position].count = runs;
+                top[position].totalUs = (uint32_t)(totalNs / 1000);
+                top[position].maxUs = entry->maxNs / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(entry->maxNs / 1000);
+            }
+        }
+    }
+
+    for (previousTotalCount = 0; previousTotalCount < count; previousTotalCount++) {
+        previousTotals[previousTotalCount].entry = entries[previousTotalCount];
+        previousTotals[previousTotalCount].count = entries[previousTotalCount]->count;
+        previousTotals[previousTotalCount].totalNs = entries[previousTotalCount]->totalNs;
+    }
+
+    return topCount;
+}
+#endif
+
+static void Snapshot(void)
+{
+    DX_TIMER_STATS stats;
+    DX_WATCHDOG_REPORT loop;
+
+    memset(&loop, 0, sizeof(loop));
+
+    if (dx_timerGetStats(&heartbeatTimer, &stats, true) && stats.fired > 0) {
+        loop.loopMaxLatenessUs = stats.maxLatenessUs;
+        loop.loopAvgLatenessUs = (uint32_t)(stats.totalLatenessUs / stats.fired);
+    }
+
+#if defined(DX_PROFILER_ENABLED)
+    loop.topCount = SnapshotHandlers(loop.top);
+#endif
+
+    pthread_mutex_lock(&snapshotLock);
+    snapshot = loop;
+    pthread_mutex_unlock(&snapshotLock);
+}
+
+static void HeartbeatHandler(EventLoopTimer *eventLoopTimer)
+{
+    int64_t now = dx_getNowNanoseconds();
+
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    atomic_store(&lastBeatNs, now);
+
+    if (now - lastSnapshotNs >= (int64_t)DX_WATCHDOG_SNAPSHOT_MS * ONE_MS) {
+        lastSnapshotNs = now;
+        Snapshot();
+    }
+}
+
+/// <summary>
+/// Start a report for a stall detected now, from the last snapshot and the running handler.
+/// Returns when that handler started, zero if none is known.
+/// </summary>
+static int64_t CaptureReport(DX_WATCHDOG_REPORT *report, int64_t now, uint32_t stalls)
+{
+    const char *name;
+    int64_t start = 0;
+
+    pthread_mutex_lock(&snapshotLock);
+    *report = snapshot;
+    pthread_mutex_unlock(&snapshotLock);
+
+    report->version = WATCHDOG_REPORT_VERSION;
+    report->thresholdMs = thresholdMs;
+    report->detectedAt = (int64_t)time(NULL);
+    report->stalls = stalls;
+
+    if (!dx_profilerRunning(&name, &start)) {
+        return 0;
+    }
+
+    CopyName(report->handler, name != NULL ? name : "(unnamed)");
+    report->handlerRunMs = (uint32_t)((now - start) / ONE_MS);
+    return start;
+}
+
+static void PersistReport(const DX_WATCHDOG_REPORT *report)
+{
+    if (!dx_storageWrite(DX_STORAGE_TAG_WATCHDOG, report, sizeof(*report))) {
+        Log_Debug("ERROR: Could not save the watchdog report\n");
+    }
+}
+
+static void *WatchdogThread(void *arg)
+{
+    DX_WATCHDOG_REPORT report;
+    struct timespec wake;
+    int64_t now, beat, stallBeat = 0, handlerStart = 0, lastPersist = 0;
+    uint32_t stalls = 0;
+    bool stalled = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+
+    pthread_mutex_lock(&watchdogLock);
+
+    while (!watchdogStopping) {
+        wake.tv_nsec += DX_WATCHDOG_HEARTBEAT_MS * ONE_MS;
+        while (wake.tv_nsec >= 1000000000L) {
+            wake.tv_nsec -= 1000000000L;
+            wake.tv_sec++;
+        }
+
+        if (pthread_cond_timedwait(&watchdogWake, &watchdogLock, &wake) == 0 && watchdogStopping) {
+            break;
+        }
+
+        pthread_mutex_unlock(&watchdogLock);
+
+        now = dx_getNowNanoseconds();
+        beat = atomic_load(&lastBeatNs);
+
+        if (now - beat > (int64_t)thresholdMs * ONE_MS) {
+            if (!stalled) {
+                stalled = true;
+                stallBeat = beat;
+                handlerStart = CaptureReport(&report, now, ++stalls);
+                report.stallMs = (uint32_t)((now - beat) / ONE_MS);
+                Log_Debug("WARNING: Event loop stalled for %u ms in %s\n", report.stallMs, report.handler[0] ? report.handler : "an unknown handler");
+                PersistReport(&report);
+                lastPersist = now;
+            } else if (now - lastPersist >= (int64_t)DX_WATCHDOG_PERSIST_MS * ONE_MS) {
+                report.stallMs = (uint32_t)((now - beat) / ONE_MS);
+                if (handlerStart != 0) {
+                    report.handlerRunMs = (uint32_t)((now - handlerStart) / ONE_MS);
+                }
+                PersistReport(&report);
+                lastPersist = now;
+            }
+        } else if (stalled) {
+            stalled = false;
+            report.recovered = true;
+            report.stallMs = (uint32_t)((beat - stallBeat) / ONE_MS);
+            if (handlerStart != 0) {
+                report.handlerRunMs = (uint32_t)((beat - handlerStart) / ONE_MS); // the next beat follows soon after it returned
+            }
+            Log_Debug("INFO: Event loop recovered after %u ms\n", report.stallMs);
+            PersistReport(&report);
+        }
+
+        pthread_mutex_lock(&watchdogLock);
+    }
+
+    watchdogRunning = false;
+    pthread_cond_signal(&watchdogExited);
+    pthread_mutex_unlock(&watchdogLock);
+
+    return NULL;
+}
+
+bool dx_watchdogStart(uint32_t stallMs)
+{
+    static bool condInitialized = false;
+    pthread_condattr_t attributes;
+
+    pthread_mutex_lock(&watchdogLock);
+
+    if (watchdogRunning) {
+        pthread_mutex_unlock(&watchdogLock);
+        return true;
+    }
+
+    if (!condInitialized) {
+        // The thread waits on CLOCK_MONOTONIC so wall clock changes don't affect stall detection
+        pthread_condattr_init(&attributes);
+        pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+        pthread_cond_init(&watchdogWake, &attributes);
+        pthread_condattr_destroy(&attributes);
+        condInitialized = true;
+    }
+
+    thresholdMs = stallMs;
+    watchdogStopping = false;
+    lastSnapshotNs = dx_getNowNanoseconds();
+    atomic_store(&lastBeatNs, lastSnapshotNs);
+
+    if (!dx_timerStart(&heartbeatTimer)) {
+        pthread_mutex_unlock(&watchdogLock);
+        return false;
+    }
+
+    watchdogRunning = true;
+    if (!dx_startThreadDetached(WatchdogThread, NULL, watchdogName)) {
+        watchdogRunning = false;
+        dx_timerStop(&heartbeatTimer);
+        pthread_mutex_unlock(&watchdogLock);
+        return false;
+    }
+
+    pthread_mutex_unlock(&watchdogLock);
+    return true;
+}
+
+void dx_watchdogStop(void)
+{
+    pthread_mutex_lock(&watchdogLock);
+
+    watchdogStopping = true;
+    pthread_cond_signal(&watchdogWake);
+
+    while (watchdogRunning) {
+        pthread_cond_wait(&watchdogExited, &watchdogLock);
+    }
+
+    pthread_mutex_unlock(&watchdogLock);
+
+    dx_timerStop(&heartbeatTimer);
+}
+
+bool dx_watchdogPreviousReport(DX_WATCHDOG_REPORT *report)
+{
+    size_t length = 0;
+
+    return dx_storageRead(DX_STORAGE_TAG_WATCHDOG, report, sizeof(*report), &length) && length == sizeof(*report) &&
+           report->version == WATCHDOG_REPORT_VERSION;
+}
+
+void dx_watchdogPreviousReportClear(void)
+{
+    dx_storageDelete(DX_STORAGE_TAG_WATCHDOG);
+}
+
+bool dx_watchdogReportSerialize(const DX_WATCHDOG_REPORT *report, char *buffer, size_t bufferSize)
+{
+    DX_JSON_WRITER writer;
+
+    dx_jsonWriterInit(&writer, buffer, bufferSize);
+
+    dx_jsonWriterLiteral(&writer, "{\"stallMs\":");
+    dx_jsonWriterUint64(&writer, report->stallMs);
+    dx_jsonWriterLiteral(&writer, ",\"thresholdMs\":");
+    dx_jsonWriterUint64(&writer, report->thresholdMs);
+    dx_jsonWriterLiteral(&writer, ",\"detectedAt\":");
+    dx_jsonWriterDouble(&writer, (double)report->detectedAt);
+    dx_jsonWriterLiteral(&writer, ",\"recovered\":");
+    dx_jsonWriterBool(&writer, report->recovered);
+    dx_jsonWriterLiteral(&writer, ",\"handler\":");
+    dx_jsonWriterString(&writer, report->handler[0] ? report->handler : NULL);
+    dx_jsonWriterLiteral(&writer, ",\"handlerRunMs\":");
+    dx_jsonWriterUint64(&writer, report->handlerRunMs);
+    dx_jsonWriterLiteral(&writer, ",\"stalls\":");
+    dx_jsonWriterUint64(&writer, report->stalls);
+    dx_jsonWriterLiteral(&writer, ",\"loopMaxLatenessUs\":");
+    dx_jsonWriterUint64(&writer, report->loopMaxLatenessUs);
+    dx_jsonWriterLiteral(&writer, ",\"loopAvgLatenessUs\":");
+    dx_jsonWriterUint64(&writer, report->loopAvgLatenessUs);
+    dx_jsonWriterLiteral(&writer, ",\"top\":{");
+
+    for (uint32_t i = 0; i < report->topCount && i < DX_WATCHDOG_TOP_HANDLERS; i++) {
+        if (i > 0) {
+            dx_jsonWriterLiteral(&writer, ",");
+        }
+        dx_jsonWriterString(&writer, report->top[i].name);
+        dx_jsonWriterLiteral(&writer, ":{\"count\":");
+        dx_jsonWriterUint64(&writer, report->top[i].count);
+        dx_jsonWriterLiteral(&writer, ",\"totalUs\":");
+        dx_jsonWriterUint64(&writer, report->top[i].totalUs);
+        dx_jsonWriterLiteral(&writer, ",\"maxUs\":");
+        dx_jsonWriterUint64(&writer, report->top[i].maxUs);
+        dx_jsonWriterLiteral(&writer, "}");
+    }
+
+    dx_jsonWriterLiteral(&writer, "}}");
+    return dx_jsonWriterFinish(&writer);
+}
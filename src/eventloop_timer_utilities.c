@@ -13,38 +13,552 @@
 #include <applibs/eventloop.h>
 
 #include "eventloop_timer_utilities.h"
+#include "dx_profiler.h"
+#include "dx_utilities.h"
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat);
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_USEC 1000LL
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat)
+// The timer whose handler is running, cleared if the handler disposes of it so the run time is
+// not recorded into freed memory
+static EventLoopTimer *dispatchingTimer = NULL;
+
+static int64_t TimespecToNs(const struct timespec *ts)
 {
-    static const struct timespec nullTimeSpec = {.tv_sec = 0, .tv_nsec = 0};
-    struct itimerspec newValue = {.it_value = initial ? *initial : nullTimeSpec,
-                                  .it_interval = repeat ? *repeat : nullTimeSpec};
+    return ts == NULL ? 0 : (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+// A negative slack would queue a timer before it is due and spin the event loop
+static bool IsValidSlack(const struct timespec *slack)
+{
+    return slack == NULL || (slack->tv_sec >= 0 && slack->tv_nsec >= 0 && slack->tv_nsec < NSEC_PER_SEC);
+}
+
+// Bucket n holds values below 2^n microseconds, the last bucket everything larger
+static void HistogramAdd(uint32_t *histogram, uint32_t us)
+{
+    unsigned int bucket = us == 0 ? 0 : 32 - (unsigned int)__builtin_clz(us);
+    histogram[bucket < EVENTLOOP_TIMER_HISTOGRAM_BUCKETS ? bucket : EVENTLOOP_TIMER_HISTOGRAM_BUCKETS - 1]++;
+}
+
+static uint32_t NsToUs(int64_t ns)
+{
+    if (ns <= 0) {
+        return 0;
+    }
+    return ns / NSEC_PER_USEC > UINT32_MAX ? UINT32_MAX : (uint32_t)(ns / NSEC_PER_USEC);
+}
+
+static void RecordTimerFired(EventLoopTimerStats *stats, int64_t lateness, uint64_t missed)
+{
+    uint32_t us = NsToUs(lateness);
+
+    stats->fired++;
+    stats->missed += missed > UINT32_MAX ? UINT32_MAX : (uint32_t)missed;
+    stats->totalLatenessUs += us;
+    if (us > stats->maxLatenessUs) {
+        stats->maxLatenessUs = us;
+    }
+    HistogramAdd(stats->lateness, us);
+}
+
+static void RecordTimerRunTime(EventLoopTimerStats *stats, int64_t runTime)
+{
+    uint32_t us = NsToUs(runTime);
+
+    stats->totalRunUs += us;
+    if (us > stats->maxRunUs) {
+        stats->maxRunUs = us;
+    }
+    HistogramAdd(stats->runTime, us);
+}
+
+/// <summary>
+/// Run the handler of a timer that expired at expected, with missed further expirations folded
+/// into this one. Returns the time the handler finished.
+/// </summary>
+static int64_t DispatchTimer(EventLoopTimer *timer, EventLoopTimerHandler handler, EventLoopTimerStats *stats,
+                             int64_t expected, uint64_t missed, int64_t now)
+{
+    RecordTimerFired(stats, now - expected, missed);
+
+    dispatchingTimer = timer;
+#if defined(DX_PROFILER_ENABLED)
+    dx_profilerEnter((const void *)handler, NULL, now);
+#endif
+    handler(timer);
+
+    int64_t finished = dx_getNowNanoseconds();
+    if (dispatchingTimer == timer) {
+        RecordTimerRunTime(stats, finished - now);
+    }
+    dispatchingTimer = NULL;
+
+#if defined(DX_PROFILER_ENABLED)
+    // Keyed on the handler, which outlives the timer if the handler disposed of it
+    dx_profilerRecord((const void *)handler, NULL, finished - now);
+#endif
+
+    return finished;
+}
+
+#if defined(DX_TIMER_MULTIPLEX_ENABLED)
+
+// All timers share one timerfd registered once with the event loop. Armed timers are kept in a
+// binary min-heap ordered by absolute expiry, and the timerfd is armed with TFD_TIMER_ABSTIME for
+// the earliest of them. Expiry is consumed by the dispatcher, so ConsumeEventLoopTimerEvent does
+// no I/O in this mode.
+//
+// A timer with slack is queued at its latest acceptable time, due plus slack. Every wakeup also
+// runs the timers that are already due but whose slack has not run out, so they ride along with
+// whichever timer wakes the loop first instead of waking it themselves.
+
+#define TIMER_NOT_QUEUED ((size_t)-1)
+
+struct EventLoopTimer {
+    EventLoop *eventLoop;
+    EventLoopTimerHandler handler;
+    int64_t expiry;  // absolute CLOCK_MONOTONIC nanoseconds the timer must run by, nominal + slack
+    int64_t nominal; // when the timer is due
+    int64_t period;  // zero for a one shot timer
+    int64_t slack;
+    size_t heapIndex;
+    EventLoopTimerStats stats;
+};
+
+static EventLoopTimer **timerHeap = NULL;
+static size_t timerHeapCount = 0;
+static size_t timerHeapCapacity = 0;
+
+static size_t multiplexTimerCount = 0; // live timers, the shared timerfd is closed with the last
+static EventLoop *multiplexEventLoop = NULL;
+static EventRegistration *multiplexRegistration = NULL;
+static int multiplexFd = -1;
+static int64_t multiplexArmedExpiry = 0; // zero when the timerfd is not armed
+static int64_t multiplexMaxSlack = 0;    // largest slack of any queued timer, bounds the due search
+static bool multiplexMaxSlackStale = false; // the timer holding the largest slack left the heap
+static bool multiplexDispatching = false;
+
+static void HeapSwap(size_t a, size_t b)
+{
+    EventLoopTimer *timer = timerHeap[a];
+    timerHeap[a] = timerHeap[b];
+    timerHeap[b] = timer;
+    timerHeap[a]->heapIndex = a;
+    timerHeap[b]->heapIndex = b;
+}
+
+static void HeapSiftUp(size_t index)
+{
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (timerHeap[parent]->expiry <= timerHeap[index]->expiry) {
+            break;
+        }
+        HeapSwap(parent, index);
+        index = parent;
+    }
+}
+
+static void HeapSiftDown(size_t index)
+{
+    for (;;) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+
+        if (left < timerHeapCount && timerHeap[left]->expiry < timerHeap[smallest]->expiry) {
+            smallest = left;
+        }
+        if (right < timerHeapCount && timerHeap[right]->expiry < timerHeap[smallest]->expiry) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        HeapSwap(smallest, index);
+        index = smallest;
+    }
+}
+
+/// <summary>
+/// Find a queued timer that is due by now. Expiries grow down the heap, so a subtree whose root
+/// expires after now plus the largest slack can't hold one.
+/// </summary>
+static EventLoopTimer *HeapFindDue(size_t index, int64_t now, int64_t maxSlack)
+{
+    if (index >= timerHeapCount || timerHeap[index]->expiry > now + maxSlack) {
+        return NULL;
+    }
+
+    if (timerHeap[index]->nominal <= now) {
+        return timerHeap[index];
+    }
 
-    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) < 0) {
+    EventLoopTimer *timer = HeapFindDue(2 * index + 1, now, maxSlack);
+    return timer != NULL ? timer : HeapFindDue(2 * index + 2, now, maxSlack);
+}
+
+/// <summary>
+/// Largest slack of the queued timers. Recomputed only after the timer that set it has left the
+/// heap, so one timer with a large slack doesn't widen the due search after it is gone.
+/// </summary>
+static int64_t MultiplexMaxSlack(void)
+{
+    if (multiplexMaxSlackStale) {
+        multiplexMaxSlack = 0;
+        for (size_t i = 0; i < timerHeapCount; i++) {
+            if (timerHeap[i]->slack > multiplexMaxSlack) {
+                multiplexMaxSlack = timerHeap[i]->slack;
+            }
+        }
+        multiplexMaxSlackStale = false;
+    }
+
+    return multiplexMaxSlack;
+}
+
+static void HeapRemove(EventLoopTimer *timer)
+{
+    size_t index = timer->heapIndex;
+
+    if (index == TIMER_NOT_QUEUED) {
+        return;
+    }
+
+    timer->heapIndex = TIMER_NOT_QUEUED;
+    if (timer->slack != 0 && timer->slack == multiplexMaxSlack) {
+        multiplexMaxSlackStale = true;
+    }
+
+    if (index != --timerHeapCount) {
+        timerHeap[index] = timerHeap[timerHeapCount];
+        timerHeap[index]->heapIndex = index;
+        HeapSiftDown(index);
+        HeapSiftUp(index);
+    }
+}
+
+static int HeapInsert(EventLoopTimer *timer)
+{
+    if (timerHeapCount == timerHeapCapacity) {
+        size_t capacity = timerHeapCapacity ? timerHeapCapacity * 2 : 16;
+        EventLoopTimer **heap = realloc(timerHeap, capacity * sizeof(*heap));
+        if (heap == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        timerHeap = heap;
+        timerHeapCapacity = capacity;
+    }
+
+    timer->heapIndex = timerHeapCount;
+    timerHeap[timerHeapCount++] = timer;
+    HeapSiftUp(timer->heapIndex);
+
+    if (timer->slack > multiplexMaxSlack) {
+        multiplexMaxSlack = timer->slack;
+    }
+    return 0;
+}
+
+/// <summary>
+/// Arm the shared timerfd for the earliest queued timer. The timerfd is only moved earlier: when
+/// the earliest timer is removed or pushed out, the pending expiry is left in place and costs one
+/// early wakeup instead of a syscall on every reschedule.
+/// </summary>
+static int ArmMultiplexTimer(void)
+{
+    if (multiplexDispatching || timerHeapCount == 0) {
+        return 0;
+    }
+
+    int64_t expiry = timerHeap[0]->expiry;
+    if (multiplexArmedExpiry != 0 && multiplexArmedExpiry <= expiry) {
+        return 0;
+    }
+
+    struct itimerspec newValue = {.it_value = {.tv_sec = expiry / NSEC_PER_SEC, .tv_nsec = expiry % NSEC_PER_SEC}};
+    if (timerfd_settime(multiplexFd, TFD_TIMER_ABSTIME, &newValue, NULL) < 0) {
         Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
 
+    multiplexArmedExpiry = expiry;
     return 0;
 }
 
+// This satisfies the EventLoopIoCallback signature.
+static void MultiplexTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+
+    // EAGAIN after an early wakeup that was already consumed is harmless
+    if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+    }
+
+    multiplexArmedExpiry = 0;
+    multiplexDispatching = true;
+
+    // Only timers due when the wakeup started run, so a handler that re-arms its own timer for
+    // a very short delay can't keep this loop going
+    int64_t now = dx_getNowNanoseconds();
+    int64_t due = now;
+
+    EventLoopTimer *timer;
+
+    while ((timer = HeapFindDue(0, due, MultiplexMaxSlack())) != NULL) {
+        int64_t expected = timer->nominal;
+        uint64_t missed = 0;
+
+        if (timer->period > 0) {
+            // A late periodic timer fires once, the same as a timerfd reporting several expirations.
+            // The schedule advances by whole periods, running early within the slack doesn't drift it
+            missed = (uint64_t)((now - expected) / timer->period);
+            expected += (int64_t)missed * timer->period;
+            timer->nominal = expected + timer->period;
+            timer->expiry = timer->nominal + timer->slack;
+            HeapSiftDown(timer->heapIndex);
+        } else {
+            HeapRemove(timer);
+        }
+
+        // The handler may dispose of or re-arm any timer, including this one
+        now = DispatchTimer(timer, timer->handler, &timer->stats, expected, missed, now);
+    }
+
+    multiplexDispatching = false;
+    ArmMultiplexTimer();
+}
+
+static int MultiplexInit(EventLoop *eventLoop)
+{
+    if (multiplexEventLoop != NULL) {
+        if (multiplexEventLoop != eventLoop) {
+            Log_Debug("ERROR: Multiplexed timers support a single event loop\n");
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    }
+
+    multiplexFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (multiplexFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    multiplexRegistration = EventLoop_RegisterIo(eventLoop, multiplexFd, EventLoop_Input, MultiplexTimerCallback, NULL);
+    if (multiplexRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        close(multiplexFd);
+        multiplexFd = -1;
+        return -1;
+    }
+
+    multiplexEventLoop = eventLoop;
+    return 0;
+}
+
+/// <summary>
+/// Queue the timer to expire after initial and then every repeat, matching timerfd_settime
+/// semantics: a zero or NULL initial disarms the timer.
+/// </summary>
+static int SetMultiplexTimer(EventLoopTimer *timer, const struct timespec *initial, const struct timespec *repeat)
+{
+    int64_t delay = TimespecToNs(initial);
+
+    HeapRemove(timer);
+
+    if (delay <= 0) {
+        return 0;
+    }
+
+    timer->nominal = dx_getNowNanoseconds() + delay;
+    timer->expiry = timer->nominal + timer->slack;
+    timer->period = TimespecToNs(repeat);
+
+    if (HeapInsert(timer) != 0) {
+        return -1;
+    }
+
+    return ArmMultiplexTimer();
+}
+
+EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                             const struct timespec *period)
+{
+    if (handler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    EventLoopTimer *timer = malloc(sizeof(EventLoopTimer));
+    if (timer == NULL) {
+        return NULL;
+    }
+
+    if (MultiplexInit(eventLoop) != 0) {
+        free(timer);
+        return NULL;
+    }
+
+    memset(timer, 0x00, sizeof(EventLoopTimer));
+
+    timer->eventLoop = eventLoop;
+    timer->handler = handler;
+    timer->heapIndex = TIMER_NOT_QUEUED;
+
+    multiplexTimerCount++;
+
+    if (SetMultiplexTimer(timer, /* initial */ period, /* repeat */ period) == -1) {
+        DisposeEventLoopTimer(timer);
+        return NULL;
+    }
+
+    return timer;
+}
+
+EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTimerHandler handler)
+{
+    return CreateEventLoopPeriodicTimer(eventLoop, handler, NULL);
+}
+
+void DisposeEventLoopTimer(EventLoopTimer *timer)
+{
+    if (timer == NULL) {
+        return;
+    }
+
+    if (dispatchingTimer == timer) {
+        dispatchingTimer = NULL;
+    }
+
+    HeapRemove(timer);
+    free(timer);
+
+    // Release the shared timerfd with the last timer, the same as each timer closing its own fd
+    if (--multiplexTimerCount == 0) {
+        EventLoop_UnregisterIo(multiplexEventLoop, multiplexRegistration);
+        close(multiplexFd);
+        free(timerHeap);
+
+        multiplexEventLoop = NULL;
+        multiplexRegistration = NULL;
+        multiplexFd = -1;
+        multiplexArmedExpiry = 0;
+        multiplexMaxSlack = 0;
+        multiplexMaxSlackStale = false;
+        timerHeap = NULL;
+        timerHeapCapacity = 0;
+    }
+}
+
+int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+{
+    // The dispatcher has already read the shared timerfd
+    return 0;
+}
+
+int GetEventLoopTimerStats(EventLoopTimer *timer, EventLoopTimerStats *stats, bool reset)
+{
+    *stats = timer->stats;
+    if (reset) {
+        memset(&timer->stats, 0, sizeof(timer->stats));
+    }
+    return 0;
+}
+
+int SetEventLoopTimerSlack(EventLoopTimer *timer, const struct timespec *slack)
+{
+    if (!IsValidSlack(slack)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Requeue a timer that is already armed at its new latest time
+    if (timer->heapIndex != TIMER_NOT_QUEUED) {
+        HeapRemove(timer);
+        timer->slack = TimespecToNs(slack);
+        timer->expiry = timer->nominal + timer->slack;
+        if (HeapInsert(timer) != 0) {
+            return -1;
+        }
+        return ArmMultiplexTimer();
+    }
+
+    timer->slack = TimespecToNs(slack);
+    return 0;
+}
+
+int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period)
+{
+    return SetMultiplexTimer(timer, /* initial */ period, /* period */ period);
+}
+
+int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay)
+{
+    return SetMultiplexTimer(timer, /* initial */ delay, /* repeat */ NULL);
+}
+
+int DisarmEventLoopTimer(EventLoopTimer *timer)
+{
+    return SetMultiplexTimer(timer, /* initial */ NULL, /* repeat */ NULL);
+}
+
+#else
+
 struct EventLoopTimer {
     EventLoop *eventLoop;
     EventLoopTimerHandler handler;
     int fd;
     EventRegistration *registration;
+    int64_t expiry; // when the timerfd is next due, tracked for the lateness statistics
+    int64_t period;
+    bool consumed;  // TimerCallback has read the timerfd for this expiry
+    EventLoopTimerStats stats;
 };
 
+static int SetTimerPeriod(EventLoopTimer *timer, const struct timespec *initial,
+                          const struct timespec *repeat);
+
+static int SetTimerPeriod(EventLoopTimer *timer, const struct timespec *initial,
+                          const struct timespec *repeat)
+{
+    static const struct timespec nullTimeSpec = {.tv_sec = 0, .tv_nsec = 0};
+    struct itimerspec newValue = {.it_value = initial ? *initial : nullTimeSpec,
+                                  .it_interval = repeat ? *repeat : nullTimeSpec};
+
+    timer->expiry = dx_getNowNanoseconds() + TimespecToNs(initial);
+    timer->period = TimespecToNs(repeat);
+
+    if (timerfd_settime(timer->fd, /* flags */ 0, &newValue, /* old_value */ NULL) < 0) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
 // This satisfies the EventLoopIoCallback signature.
 static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
 {
     EventLoopTimer *timer = (EventLoopTimer *)context;
+    uint64_t expirations = 0;
+
+    // Read the expiration count here so overruns are counted, ConsumeEventLoopTimerEvent then
+    // has nothing left to do
+    if (read(timer->fd, &expirations, sizeof(expirations)) == -1 || expirations == 0) {
+        timer->handler(timer);
+        return;
+    }
+    timer->consumed = true;
 
-    timer->handler(timer);
+    int64_t expected = timer->expiry + (int64_t)(expirations - 1) * timer->period;
+    timer->expiry = expected + timer->period;
+
+    DispatchTimer(timer, timer->handler, &timer->stats, expected, expirations - 1, dx_getNowNanoseconds());
 }
 
 EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
@@ -75,7 +589,7 @@ EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTime
         goto failed;
     }
 
-    if (SetTimerPeriod(timer->fd, /* initial */ period, /* repeat */ period) == -1) {
+    if (SetTimerPeriod(timer, /* initial */ period, /* repeat */ period) == -1) {
         goto failed;
     }
 
@@ -104,6 +618,10 @@ void DisposeEventLoopTimer(EventLoopTimer *timer)
         return;
     }
 
+    if (dispatchingTimer == timer) {
+        dispatchingTimer = NULL;
+    }
+
     EventLoop_UnregisterIo(timer->eventLoop, timer->registration);
 
     if (timer->fd != -1) {
@@ -117,6 +635,11 @@ int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
 {
     uint64_t timerData = 0;
 
+    if (timer->consumed) {
+        timer->consumed = false;
+        return 0;
+    }
+
     if (read(timer->fd, &timerData, sizeof(timerData)) == -1) {
         Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
         return -1;
@@ -125,17 +648,39 @@ int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
     return 0;
 }
 
+int GetEventLoopTimerStats(EventLoopTimer *timer, EventLoopTimerStats *stats, bool reset)
+{
+    *stats = timer->stats;
+    if (reset) {
+        memset(&timer->stats, 0, sizeof(timer->stats));
+    }
+    return 0;
+}
+
+int SetEventLoopTimerSlack(EventLoopTimer *timer, const struct timespec *slack)
+{
+    if (!IsValidSlack(slack)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Each timer has its own timerfd, there is nothing to coalesce with
+    return 0;
+}
+
 int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ period, /* period */ period);
+    return SetTimerPeriod(timer, /* initial */ period, /* period */ period);
 }
 
 int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ delay, /* repeat */ NULL);
+    return SetTimerPeriod(timer, /* initial */ delay, /* repeat */ NULL);
 }
 
 int DisarmEventLoopTimer(EventLoopTimer *timer)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ NULL, /* repeat */ NULL);
+    return SetTimerPeriod(timer, /* initial */ NULL, /* repeat */ NULL);
 }
+
+#endif // DX_TIMER_MULTIPLEX_ENABLED
@@ -41,6 +41,16 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <stdint.h>
+
+/* An SSE2 kernel skips runs of plain characters 16 bytes at a time, SWAR and scalar loops finish
+   the job and are all that is used elsewhere, including on the ARM target. Define
+   PARSON_SIMD_DISABLED to build only the SWAR and scalar path. */
+#if defined(PARSON_SIMD_DISABLED)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PARSON_SIMD_SSE2
+#endif
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
@@ -48,6 +58,9 @@
 
 #define STARTING_CAPACITY 16
 #define MAX_NESTING 2048
+#define OBJECT_HASH_THRESHOLD 16 /* objects with fewer names are searched linearly */
+#define OBJECT_HASH_MIN_CAPACITY 32
+#define OBJECT_INDEX_NOT_FOUND ((size_t)-1)
 
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
@@ -79,9 +92,14 @@ typedef union json_value_value {
     int null;
 } JSON_Value_Value;
 
+/* Value flags, used by in-situ parsing where strings point into a caller-owned buffer */
+#define VALUE_FLAG_BORROWED_STRING 0x1 /* value.string is not owned by the value */
+#define VALUE_FLAG_BORROWED_NAME 0x2   /* name of the value in its parent object is not owned */
+
 struct json_value_t {
     JSON_Value *parent;
-    JSON_Value_Type type;
+    short type; /* JSON_Value_Type, narrowed so flags fit without growing the struct */
+    unsigned short flags;
     JSON_Value_Value value;
 };
 
@@ -91,6 +109,8 @@ struct json_object_t {
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    unsigned int *hash_index; /* open addressing table of item index + 1 (0 is empty), built lazily */
+    size_t hash_capacity;     /* power of two, kept at least twice count */
 };
 
 struct json_array_t {
@@ -100,6 +120,24 @@ struct json_array_t {
     size_t capacity;
 };
 
+#define PATH_NODE_ROOT ((size_t)-1)
+
+typedef struct json_path_node_t {
+    const char *name; /* null terminated segment inside json_path_t.names */
+    size_t name_len;
+    unsigned int hash;
+    size_t parent; /* index of the parent node, always lower than this node's index */
+} JSON_Path_Node;
+
+struct json_path_t {
+    JSON_Path_Node *nodes; /* prefix tree, the first path's segments are nodes 0 to leaves[0] */
+    size_t node_count;
+    size_t *leaves; /* node holding the last segment of each path */
+    size_t path_count;
+    JSON_Value **resolved; /* per node scratch for json_path_get_values */
+    char *names;
+};
+
 /* Various */
 static void remove_comments(char *string, const char *start_token, const char *end_token);
 static char *parson_strndup(const char *string, size_t n);
@@ -110,15 +148,35 @@ static int num_bytes_in_utf8_sequence(unsigned char c);
 static int verify_utf8_sequence(const unsigned char *string, int *len);
 static int is_valid_utf8(const char *string, size_t string_len);
 static int is_decimal(const char *string, size_t length);
+static int validate_string(const char **string, const char *end);
+static int validate_member_name(const char **string, const char *end);
+static int validate_number(const char **string, const char *end);
+static int validate_literal(const char **string, const char *end, const char *literal,
+                            size_t literal_len);
+static int skip_value(const char **string, const char *end);
+static size_t span_ascii(const char *string, size_t n);
+static size_t span_plain(const char *string, size_t n, int stop_at_slash);
 
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value);
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
+static JSON_Status json_object_add_owned(JSON_Object *object, char *name, size_t name_len,
+                                         JSON_Value *value);
+static void json_object_free_name(JSON_Object *object, size_t index);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
+static size_t json_object_find_index(const JSON_Object *object, const char *name, size_t name_len);
+static size_t json_object_find_index_hashed(const JSON_Object *object, const char *name,
+                                            size_t name_len, const unsigned int *hash);
+static unsigned int hash_string(const char *string, size_t n);
+static void json_object_index_build(JSON_Object *object);
+static void json_object_index_free(JSON_Object *object);
+static size_t json_object_index_slot(const JSON_Object *object, size_t item_index);
+static void json_object_index_insert(JSON_Object *object, size_t item_index);
+static void json_object_index_remove(JSON_Object *object, size_t item_index, size_t last_item_index);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -137,22 +195,34 @@ static JSON_Value *json_value_init_string_no_copy(char *string);
 /* Parser */
 static JSON_Status skip_quotes(const char **string);
 static int parse_utf16(const char **unprocessed, char **processed);
+static JSON_Status process_string_into(const char *input, size_t len, char *output,
+                                       size_t *output_len);
 static char *process_string(const char *input, size_t len);
-static char *get_quoted_string(const char **string);
-static JSON_Value *parse_object_value(const char **string, size_t nesting);
-static JSON_Value *parse_array_value(const char **string, size_t nesting);
-static JSON_Value *parse_string_value(const char **string);
+static char *get_quoted_string(const char **string, int in_situ);
+static JSON_Value *parse_object_value(const char **string, size_t nesting, int in_situ);
+static JSON_Value *parse_array_value(const char **string, size_t nesting, int in_situ);
+static JSON_Value *parse_string_value(const char **string, int in_situ);
 static JSON_Value *parse_boolean_value(const char **string);
 static JSON_Value *parse_number_value(const char **string);
 static JSON_Value *parse_null_value(const char **string);
-static JSON_Value *parse_value(const char **string, size_t nesting);
+static JSON_Value *parse_value(const char **string, size_t nesting, int in_situ);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+typedef struct json_output_t {
+    char *buf;       /* NULL when only counting */
+    size_t size;     /* bytes written or counted, without terminating null */
+    size_t capacity; /* bytes available in buf, including terminating null */
+    int growable;    /* buf is owned and reallocated with parson_malloc when full */
+    int failed;      /* out of space or memory, further output is dropped */
+} JSON_Output;
+
+static int output_reserve(JSON_Output *out, size_t n);
+static void output_append(JSON_Output *out, const char *string, size_t n);
+static JSON_Status json_serialize_to_output(const JSON_Value *value, JSON_Output *out, int is_pretty);
+static void json_serialize_to_buffer_r(const JSON_Value *value, JSON_Output *out, int level,
+                                       int is_pretty, char *num_buf);
+static void json_serialize_string(const char *string, JSON_Output *out);
+static void append_indent(JSON_Output *out, int level);
 
 /* Various */
 static char *parson_strndup(const char *string, size_t n)
@@ -262,7 +332,13 @@ static int is_valid_utf8(const char *string, size_t string_len)
     int len = 0;
     const char *string_end = string + string_len;
     while (string < string_end) {
-        if (!verify_utf8_sequence((const unsigned char *)string, &len)) {
+        string += span_ascii(string, (size_t)(string_end - string));
+        if (string >= string_end) {
+            break;
+        }
+        len = num_bytes_in_utf8_sequence((unsigned char)*string);
+        if (len == 0 || len > string_end - string ||
+            !verify_utf8_sequence((const unsigned char *)string, &len)) {
             return 0;
         }
         string += len;
@@ -270,6 +346,89 @@ static int is_valid_utf8(const char *string, size_t string_len)
     return 1;
 }
 
+/* SWAR helpers, true if any byte of x is zero / below n (n <= 128) / has its top bit set */
+#define SWAR_ONES ((uint64_t)0x0101010101010101ULL)
+#define SWAR_HIGHS ((uint64_t)0x8080808080808080ULL)
+#define SWAR_HAS_ZERO(x) ((((x)-SWAR_ONES) & ~(x)) & SWAR_HIGHS)
+#define SWAR_HAS_LESS(x, n) ((((x)-SWAR_ONES * (n)) & ~(x)) & SWAR_HIGHS)
+#define SWAR_HAS_BYTE(x, c) SWAR_HAS_ZERO((x) ^ (SWAR_ONES * (unsigned char)(c)))
+
+/* Returns length of leading run of 7 bit ASCII characters */
+static size_t span_ascii(const char *string, size_t n)
+{
+    size_t i = 0;
+    uint64_t word;
+#if defined(PARSON_SIMD_SSE2)
+    int mask;
+    for (; i + 16 <= n; i += 16) {
+        mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(string + i)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&word, string + i, sizeof(word));
+        if (word & SWAR_HIGHS) {
+            break;
+        }
+    }
+    while (i < n && (unsigned char)string[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/* Returns length of leading run of characters that are not control characters, quotes or
+   backslashes (nor slashes if stop_at_slash), i.e. that string parsing and escaping copy as is */
+static size_t span_plain(const char *string, size_t n, int stop_at_slash)
+{
+    size_t i = 0;
+    unsigned char c;
+    uint64_t word;
+#if defined(PARSON_SIMD_SSE2)
+    const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+    const __m128i slash = _mm_set1_epi8(stop_at_slash ? '/' : '\"'), below_space = _mm_set1_epi8(0x1F);
+    __m128i chunk, special;
+    int mask;
+    for (; i + 16 <= n; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i *)(string + i));
+        special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, slash));
+        /* unsigned c <= 0x1F exactly when saturating c - 0x1F is zero */
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_subs_epu8(chunk, below_space), _mm_setzero_si128()));
+        mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&word, string + i, sizeof(word));
+        /* bytes >= 0x80 would confuse SWAR_HAS_LESS, they are plain so mask them out */
+        if (SWAR_HAS_LESS(word & ~SWAR_HIGHS, 0x20) & ~word) {
+            break;
+        }
+        if (SWAR_HAS_BYTE(word, '\"') || SWAR_HAS_BYTE(word, '\\') ||
+            (stop_at_slash && SWAR_HAS_BYTE(word, '/'))) {
+            break;
+        }
+    }
+    for (; i < n; i++) {
+        c = (unsigned char)string[i];
+        if (c < 0x20 || c == '\"' || c == '\\' || (stop_at_slash && c == '/')) {
+            break;
+        }
+    }
+    return i;
+}
+
+#undef SWAR_ONES
+#undef SWAR_HIGHS
+#undef SWAR_HAS_ZERO
+#undef SWAR_HAS_LESS
+#undef SWAR_HAS_BYTE
+
 static int is_decimal(const char *string, size_t length)
 {
     if (length > 1 && string[0] == '0' && string[1] != '.') {
@@ -334,6 +493,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->hash_index = NULL;
+    new_obj->hash_capacity = 0;
     return new_obj;
 }
 
@@ -347,6 +508,26 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value)
+{
+    char *name_copy = NULL;
+    if (object == NULL || name == NULL || value == NULL) {
+        return JSONFailure;
+    }
+    name_copy = parson_strndup(name, name_len);
+    if (name_copy == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_add_owned(object, name_copy, name_len, value) == JSONFailure) {
+        parson_free(name_copy);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Adds name without copying it. On success the object owns name (or borrows it, if value is
+   flagged with VALUE_FLAG_BORROWED_NAME), on failure the caller still does. */
+static JSON_Status json_object_add_owned(JSON_Object *object, char *name, size_t name_len,
+                                         JSON_Value *value)
 {
     size_t index = 0;
     if (object == NULL || name == NULL || value == NULL) {
@@ -362,13 +543,17 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
         }
     }
     index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
-    if (object->names[index] == NULL) {
-        return JSONFailure;
-    }
+    object->names[index] = name;
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
+    if (object->hash_index != NULL) {
+        if (object->count * 2 > object->hash_capacity) {
+            json_object_index_build(object); /* grow, linear search is used if this fails */
+        } else {
+            json_object_index_insert(object, index);
+        }
+    }
     return JSONSuccess;
 }
 
@@ -405,42 +590,157 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
+    size_t i = json_object_find_index(object, name, name_len);
+    return i == OBJECT_INDEX_NOT_FOUND ? NULL : object->values[i];
+}
+
+static size_t json_object_find_index(const JSON_Object *object, const char *name, size_t name_len)
+{
+    return json_object_find_index_hashed(object, name, name_len, NULL);
+}
+
+/* hash may point to a precomputed hash_string of name, otherwise it is computed if needed */
+static size_t json_object_find_index_hashed(const JSON_Object *object, const char *name,
+                                            size_t name_len, const unsigned int *hash)
+{
+    size_t i, name_length, mask, slot;
+    if (object == NULL) {
+        return OBJECT_INDEX_NOT_FOUND;
+    }
+    if (object->hash_index == NULL && object->count >= OBJECT_HASH_THRESHOLD) {
+        json_object_index_build((JSON_Object *)object); /* index is a cache, not logical state */
+    }
+    if (object->hash_index != NULL) {
+        mask = object->hash_capacity - 1;
+        slot = (hash != NULL ? *hash : hash_string(name, name_len)) & mask;
+        for (; object->hash_index[slot] != 0; slot = (slot + 1) & mask) {
+            i = object->hash_index[slot] - 1;
+            if (strncmp(object->names[i], name, name_len) == 0 &&
+                object->names[i][name_len] == '\0') {
+                return i;
+            }
+        }
+        return OBJECT_INDEX_NOT_FOUND;
+    }
+    for (i = 0; i < object->count; i++) {
         name_length = strlen(object->names[i]);
         if (name_length != name_len) {
             continue;
         }
         if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
+            return i;
         }
     }
-    return NULL;
+    return OBJECT_INDEX_NOT_FOUND;
+}
+
+/* FNV-1a */
+static unsigned int hash_string(const char *string, size_t n)
+{
+    unsigned int hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < n && string[i] != '\0'; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void json_object_index_build(JSON_Object *object)
+{
+    size_t i, new_capacity = OBJECT_HASH_MIN_CAPACITY;
+    json_object_index_free(object);
+    while (new_capacity < object->count * 2) {
+        new_capacity *= 2;
+    }
+    object->hash_index = (unsigned int *)parson_malloc(new_capacity * sizeof(unsigned int));
+    if (object->hash_index == NULL) {
+        return;
+    }
+    memset(object->hash_index, 0, new_capacity * sizeof(unsigned int));
+    object->hash_capacity = new_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, i);
+    }
+}
+
+static void json_object_index_free(JSON_Object *object)
+{
+    parson_free(object->hash_index);
+    object->hash_index = NULL;
+    object->hash_capacity = 0;
+}
+
+/* Returns slot holding item_index, which must be indexed */
+static size_t json_object_index_slot(const JSON_Object *object, size_t item_index)
+{
+    size_t mask = object->hash_capacity - 1;
+    size_t slot = hash_string(object->names[item_index], (size_t)-1) & mask;
+    while (object->hash_index[slot] != item_index + 1) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void json_object_index_insert(JSON_Object *object, size_t item_index)
+{
+    size_t mask = object->hash_capacity - 1;
+    size_t slot = hash_string(object->names[item_index], (size_t)-1) & mask;
+    while (object->hash_index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    object->hash_index[slot] = (unsigned int)(item_index + 1);
+}
+
+/* Unindexes item_index and repoints the last item, which is about to be moved into its place */
+static void json_object_index_remove(JSON_Object *object, size_t item_index, size_t last_item_index)
+{
+    size_t mask = object->hash_capacity - 1;
+    size_t hole = json_object_index_slot(object, item_index), slot = hole, home = 0;
+    object->hash_index[hole] = 0;
+    /* backward shift deletion keeps probe sequences unbroken without tombstones */
+    for (slot = (slot + 1) & mask; object->hash_index[slot] != 0; slot = (slot + 1) & mask) {
+        home = hash_string(object->names[object->hash_index[slot] - 1], (size_t)-1) & mask;
+        if (hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot)) {
+            continue; /* entry is still reachable from its home slot */
+        }
+        object->hash_index[hole] = object->hash_index[slot];
+        object->hash_index[slot] = 0;
+        hole = slot;
+    }
+    if (item_index != last_item_index) {
+        object->hash_index[json_object_index_slot(object, last_item_index)] =
+            (unsigned int)(item_index + 1);
+    }
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value)
 {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
+    if (object == NULL || name == NULL) {
+        return JSONFailure;
+    }
+    i = json_object_find_index(object, name, strlen(name));
+    if (i == OBJECT_INDEX_NOT_FOUND) {
         return JSONFailure;
     }
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
-            }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
+    if (object->hash_index != NULL) {
+        json_object_index_remove(object, i, last_item_index);
+    }
+    json_object_free_name(object, i);
+    if (free_value) {
+        json_value_free(object->values[i]);
+    } else {
+        object->values[i]->flags &= (unsigned short)~VALUE_FLAG_BORROWED_NAME;
     }
-    return JSONFailure; /* No execution path should end here */
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+    }
+    object->count -= 1;
+    return JSONSuccess;
 }
 
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -460,13 +760,21 @@ static JSON_Status json_object_dotremove_internal(JSON_Object *object, const cha
     return json_object_dotremove_internal(temp_object, dot_pos + 1, free_value);
 }
 
+static void json_object_free_name(JSON_Object *object, size_t index)
+{
+    if (!(object->values[index]->flags & VALUE_FLAG_BORROWED_NAME)) {
+        parson_free(object->names[index]);
+    }
+}
+
 static void json_object_free(JSON_Object *object)
 {
     size_t i;
     for (i = 0; i < object->count; i++) {
-        parson_free(object->names[i]);
+        json_object_free_name(object, i);
         json_value_free(object->values[i]);
     }
+    json_object_index_free(object);
     parson_free(object->names);
     parson_free(object->values);
     parson_free(object);
@@ -538,6 +846,7 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
     }
     new_value->parent = NULL;
     new_value->type = JSONString;
+    new_value->flags = 0;
     new_value->value.string = string;
     return new_value;
 }
@@ -613,20 +922,25 @@ static int parse_utf16(const char **unprocessed, char **processed)
     return JSONSuccess;
 }
 
-/* Copies and processes passed string up to supplied length.
+/* Processes passed string up to supplied length into output, which must hold len + 1 bytes.
+   Output may alias input since unescaping never makes a string longer.
 Example: "\u006Corem ipsum" -> lorem ipsum */
-static char *process_string(const char *input, size_t len)
+static JSON_Status process_string_into(const char *input, size_t len, char *output,
+                                       size_t *output_len)
 {
     const char *input_ptr = input;
-    size_t initial_size = (len + 1) * sizeof(char);
-    size_t final_size = 0;
-    char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
-    if (output == NULL) {
-        goto error;
-    }
-    output_ptr = output;
+    char *output_ptr = output;
+    size_t plain_len = 0;
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
+        plain_len = span_plain(input_ptr, len - (size_t)(input_ptr - input), 0);
+        if (plain_len > 0) {
+            if (output_ptr != input_ptr) {
+                memmove(output_ptr, input_ptr, plain_len); /* in situ output trails input */
+            }
+            output_ptr += plain_len;
+            input_ptr += plain_len;
+            continue;
+        }
         if (*input_ptr == '\\') {
             input_ptr++;
             switch (*input_ptr) {
@@ -656,15 +970,15 @@ static char *process_string(const char *input, size_t len)
                 break;
             case 'u':
                 if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure) {
-                    goto error;
+                    return JSONFailure;
                 }
                 break;
             default:
-                goto error;
+                return JSONFailure;
             }
         } else if ((unsigned char)*input_ptr < 0x20) {
-            goto error; /* 0x00-0x19 are invalid characters for json string
-                           (http://www.ietf.org/rfc/rfc4627.txt) */
+            return JSONFailure; /* 0x00-0x19 are invalid characters for json string
+                                   (http://www.ietf.org/rfc/rfc4627.txt) */
         } else {
             *output_ptr = *input_ptr;
         }
@@ -672,36 +986,61 @@ static char *process_string(const char *input, size_t len)
         input_ptr++;
     }
     *output_ptr = '\0';
-    /* resize to new length */
-    final_size = (size_t)(output_ptr - output) + 1;
-    /* todo: don't resize if final_size == initial_size */
-    resized_output = (char *)parson_malloc(final_size);
+    *output_len = (size_t)(output_ptr - output);
+    return JSONSuccess;
+}
+
+/* Copies and processes passed string up to supplied length. */
+static char *process_string(const char *input, size_t len)
+{
+    size_t final_len = 0;
+    char *output = NULL, *resized_output = NULL;
+    output = (char *)parson_malloc(len + 1);
+    if (output == NULL) {
+        return NULL;
+    }
+    if (process_string_into(input, len, output, &final_len) == JSONFailure) {
+        parson_free(output);
+        return NULL;
+    }
+    if (final_len == len) { /* nothing was unescaped, buffer is already the right size */
+        return output;
+    }
+    resized_output = (char *)parson_malloc(final_len + 1);
     if (resized_output == NULL) {
-        goto error;
+        parson_free(output);
+        return NULL;
     }
-    memcpy(resized_output, output, final_size);
+    memcpy(resized_output, output, final_len + 1);
     parson_free(output);
     return resized_output;
-error:
-    parson_free(output);
-    return NULL;
 }
 
 /* Return processed contents of a string between quotes and
-   skips passed argument to a matching quote. */
-static char *get_quoted_string(const char **string)
+   skips passed argument to a matching quote.
+   In situ the string is unescaped and terminated in place (at or before its closing quote,
+   which has already been consumed) and the returned pointer refers into the parsed buffer. */
+static char *get_quoted_string(const char **string, int in_situ)
 {
     const char *string_start = *string;
-    size_t string_len = 0;
+    size_t string_len = 0, processed_len = 0;
+    char *in_place = NULL;
     JSON_Status status = skip_quotes(string);
     if (status != JSONSuccess) {
         return NULL;
     }
     string_len = (size_t)(*string - string_start - 2); /* length without quotes */
-    return process_string(string_start + 1, string_len);
+    if (!in_situ) {
+        return process_string(string_start + 1, string_len);
+    }
+    in_place = (char *)string_start + 1; /* buffer handed to json_parse_string_in_situ is mutable */
+    if (process_string_into(in_place, string_len, in_place, &processed_len) == JSONFailure) {
+        return NULL;
+    }
+    return in_place;
 }
 
-static JSON_Value *parse_value(const char **string, size_t nesting)
+static JSON_Value *parse_value(const char **string, size_t nesting, int in_situ)
 {
     if (nesting > MAX_NESTING) {
         return NULL;
@@ -709,11 +1048,11 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
     SKIP_WHITESPACES(string);
     switch (**string) {
     case '{':
-        return parse_object_value(string, nesting + 1);
+        return parse_object_value(string, nesting + 1, in_situ);
     case '[':
-        return parse_array_value(string, nesting + 1);
+        return parse_array_value(string, nesting + 1, in_situ);
     case '\"':
-        return parse_string_value(string);
+        return parse_string_value(string, in_situ);
     case 'f':
     case 't':
         return parse_boolean_value(string);
@@ -736,7 +1075,7 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
     }
 }
 
-static JSON_Value *parse_object_value(const char **string, size_t nesting)
+static JSON_Value *parse_object_value(const char **string, size_t nesting, int in_situ)
 {
     JSON_Value *output_value = NULL, *new_value = NULL;
     JSON_Object *output_object = NULL;
@@ -757,31 +1096,41 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
         return output_value;
     }
     while (**string != '\0') {
-        new_key = get_quoted_string(string);
+        new_key = get_quoted_string(string, in_situ);
         if (new_key == NULL) {
             json_value_free(output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
         if (**string != ':') {
-            parson_free(new_key);
+            if (!in_situ) {
+                parson_free(new_key);
+            }
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(string, nesting, in_situ);
         if (new_value == NULL) {
-            parson_free(new_key);
+            if (!in_situ) {
+                parson_free(new_key);
+            }
             json_value_free(output_value);
             return NULL;
         }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure) {
-            parson_free(new_key);
+        /* object takes the key over instead of duplicating it */
+        if (json_object_add_owned(output_object, new_key, strlen(new_key), new_value) ==
+            JSONFailure) {
+            if (!in_situ) {
+                parson_free(new_key);
+            }
             json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
+        if (in_situ) {
+            new_value->flags |= VALUE_FLAG_BORROWED_NAME;
+        }
         SKIP_WHITESPACES(string);
         if (**string != ',') {
             break;
@@ -799,7 +1148,7 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_array_value(const char **string, size_t nesting)
+static JSON_Value *parse_array_value(const char **string, size_t nesting, int in_situ)
 {
     JSON_Value *output_value = NULL, *new_array_value = NULL;
     JSON_Array *output_array = NULL;
@@ -819,7 +1168,7 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
         return output_value;
     }
     while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+        new_array_value = parse_value(string, nesting, in_situ);
         if (new_array_value == NULL) {
             json_value_free(output_value);
             return NULL;
@@ -846,18 +1195,23 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_string_value(const char **string)
+static JSON_Value *parse_string_value(const char **string, int in_situ)
 {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    char *new_string = get_quoted_string(string, in_situ);
     if (new_string == NULL) {
         return NULL;
     }
     value = json_value_init_string_no_copy(new_string);
     if (value == NULL) {
-        parson_free(new_string);
+        if (!in_situ) {
+            parson_free(new_string);
+        }
         return NULL;
     }
+    if (in_situ) {
+        value->flags |= VALUE_FLAG_BORROWED_STRING;
+    }
     return value;
 }
 
@@ -899,32 +1253,74 @@ static JSON_Value *parse_null_value(const char **string)
 }
 
 /* Serialization */
-#define APPEND_STRING(str)                   \
-    do {                                     \
-        written = append_string(buf, (str)); \
-        if (written < 0) {                   \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL) {                   \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
-    } while (0)
-
-#define APPEND_INDENT(level)                   \
-    do {                                       \
-        written = append_indent(buf, (level)); \
-        if (written < 0) {                     \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL) {                     \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
-    } while (0)
-
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
+#define STARTING_OUTPUT_CAPACITY 256
+#define APPEND_STRING(str) output_append(out, (str), SIZEOF_TOKEN(str)) /* literals only */
+
+/* Makes room for n more bytes plus terminating null. Returns 0 if output must be dropped. */
+static int output_reserve(JSON_Output *out, size_t n)
+{
+    size_t needed = out->size + n + 1, new_capacity = 0;
+    char *new_buf = NULL;
+    if (out->failed) {
+        return 0;
+    }
+    if (out->buf == NULL && !out->growable) { /* counting */
+        return 1;
+    }
+    if (needed <= out->capacity) {
+        return 1;
+    }
+    if (!out->growable) {
+        out->failed = 1;
+        return 0;
+    }
+    new_capacity = MAX(out->capacity * 2, MAX(needed, STARTING_OUTPUT_CAPACITY));
+    new_buf = (char *)parson_malloc(new_capacity);
+    if (new_buf == NULL) {
+        out->failed = 1;
+        return 0;
+    }
+    if (out->buf != NULL) {
+        memcpy(new_buf, out->buf, out->size);
+        parson_free(out->buf);
+    }
+    out->buf = new_buf;
+    out->capacity = new_capacity;
+    return 1;
+}
+
+static void output_append(JSON_Output *out, const char *string, size_t n)
+{
+    if (!output_reserve(out, n)) {
+        return;
+    }
+    if (out->buf != NULL) {
+        memcpy(out->buf + out->size, string, n);
+    }
+    out->size += n;
+}
+
+/* Serializes value in a single pass, terminating the output on success. A caller's buffer is
+   left holding an empty string on failure rather than the part written before it ran out. */
+static JSON_Status json_serialize_to_output(const JSON_Value *value, JSON_Output *out, int is_pretty)
+{
+    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
+                                   it only once */
+    json_serialize_to_buffer_r(value, out, 0, is_pretty, num_buf);
+    if (out->failed) {
+        if (!out->growable && out->buf != NULL && out->capacity > 0) {
+            out->buf[0] = '\0';
+        }
+        return JSONFailure;
+    }
+    if (out->buf != NULL) {
+        out->buf[out->size] = '\0'; /* room is always reserved */
+    }
+    return JSONSuccess;
+}
+
+static void json_serialize_to_buffer_r(const JSON_Value *value, JSON_Output *out, int level,
+                                       int is_pretty, char *num_buf)
 {
     const char *key = NULL, *string = NULL;
     JSON_Value *temp_value = NULL;
@@ -932,8 +1328,11 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
     double num = 0.0;
-    int written = -1, written_total = 0;
+    int written = -1;
 
+    if (out->failed) {
+        return;
+    }
     switch (json_value_get_type(value)) {
     case JSONArray:
         array = json_value_get_array(value);
@@ -944,17 +1343,10 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
         }
         for (i = 0; i < count; i++) {
             if (is_pretty) {
-                APPEND_INDENT(level + 1);
+                append_indent(out, level + 1);
             }
             temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
+            json_serialize_to_buffer_r(temp_value, out, level + 1, is_pretty, num_buf);
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -963,10 +1355,10 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             }
         }
         if (count > 0 && is_pretty) {
-            APPEND_INDENT(level);
+            append_indent(out, level);
         }
         APPEND_STRING("]");
-        return written_total;
+        return;
     case JSONObject:
         object = json_value_get_object(value);
         count = json_object_get_count(object);
@@ -977,32 +1369,19 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
         for (i = 0; i < count; i++) {
             key = json_object_get_name(object, i);
             if (key == NULL) {
-                return -1;
+                out->failed = 1;
+                return;
             }
             if (is_pretty) {
-                APPEND_INDENT(level + 1);
+                append_indent(out, level + 1);
             }
-            written = json_serialize_string(key, buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
+            json_serialize_string(key, out);
             APPEND_STRING(":");
             if (is_pretty) {
                 APPEND_STRING(" ");
             }
-            temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
+            temp_value = json_object_get_value_at(object, i);
+            json_serialize_to_buffer_r(temp_value, out, level + 1, is_pretty, num_buf);
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -1011,63 +1390,60 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             }
         }
         if (count > 0 && is_pretty) {
-            APPEND_INDENT(level);
+            append_indent(out, level);
         }
         APPEND_STRING("}");
-        return written_total;
+        return;
     case JSONString:
         string = json_value_get_string(value);
         if (string == NULL) {
-            return -1;
-        }
-        written = json_serialize_string(string, buf);
-        if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
+            out->failed = 1;
+            return;
         }
-        written_total += written;
-        return written_total;
+        json_serialize_string(string, out);
+        return;
     case JSONBoolean:
         if (json_value_get_boolean(value)) {
             APPEND_STRING("true");
         } else {
             APPEND_STRING("false");
         }
-        return written_total;
+        return;
     case JSONNumber:
         num = json_value_get_number(value);
-        if (buf != NULL) {
-            num_buf = buf;
-        }
         written = sprintf(num_buf, FLOAT_FORMAT, num);
         if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
+            out->failed = 1;
+            return;
         }
-        written_total += written;
-        return written_total;
+        output_append(out, num_buf, (size_t)written);
+        return;
     case JSONNull:
         APPEND_STRING("null");
-        return written_total;
+        return;
     case JSONError:
-        return -1;
     default:
-        return -1;
+        out->failed = 1;
+        return;
     }
 }
 
-static int json_serialize_string(const char *string, char *buf)
+/* Copies runs of characters that need no escaping in one go */
+static void json_serialize_string(const char *string, JSON_Output *out)
 {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
+    static const char hex_digits[] = "0123456789abcdef";
+    size_t i = 0, plain_len = 0, len = strlen(string);
+    char escape[6] = {'\\', 'u', '0', '0', '0', '0'};
+    unsigned char c = '\0';
     APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
+    while (i < len) {
+        plain_len = span_plain(string + i, len - i, 1);
+        output_append(out, string + i, plain_len);
+        i += plain_len;
+        if (i >= len) {
+            break;
+        }
+        c = (unsigned char)string[i++];
         switch (c) {
         case '\"':
             APPEND_STRING("\\\"");
@@ -1093,125 +1469,25 @@ static int json_serialize_string(const char *string, char *buf)
         case '\t':
             APPEND_STRING("\\t");
             break;
-        case '\x00':
-            APPEND_STRING("\\u0000");
-            break;
-        case '\x01':
-            APPEND_STRING("\\u0001");
-            break;
-        case '\x02':
-            APPEND_STRING("\\u0002");
-            break;
-        case '\x03':
-            APPEND_STRING("\\u0003");
-            break;
-        case '\x04':
-            APPEND_STRING("\\u0004");
-            break;
-        case '\x05':
-            APPEND_STRING("\\u0005");
-            break;
-        case '\x06':
-            APPEND_STRING("\\u0006");
-            break;
-        case '\x07':
-            APPEND_STRING("\\u0007");
-            break;
-        /* '\x08' duplicate: '\b' */
-        /* '\x09' duplicate: '\t' */
-        /* '\x0a' duplicate: '\n' */
-        case '\x0b':
-            APPEND_STRING("\\u000b");
-            break;
-        /* '\x0c' duplicate: '\f' */
-        /* '\x0d' duplicate: '\r' */
-        case '\x0e':
-            APPEND_STRING("\\u000e");
-            break;
-        case '\x0f':
-            APPEND_STRING("\\u000f");
-            break;
-        case '\x10':
-            APPEND_STRING("\\u0010");
-            break;
-        case '\x11':
-            APPEND_STRING("\\u0011");
-            break;
-        case '\x12':
-            APPEND_STRING("\\u0012");
-            break;
-        case '\x13':
-            APPEND_STRING("\\u0013");
-            break;
-        case '\x14':
-            APPEND_STRING("\\u0014");
-            break;
-        case '\x15':
-            APPEND_STRING("\\u0015");
-            break;
-        case '\x16':
-            APPEND_STRING("\\u0016");
-            break;
-        case '\x17':
-            APPEND_STRING("\\u0017");
-            break;
-        case '\x18':
-            APPEND_STRING("\\u0018");
-            break;
-        case '\x19':
-            APPEND_STRING("\\u0019");
-            break;
-        case '\x1a':
-            APPEND_STRING("\\u001a");
-            break;
-        case '\x1b':
-            APPEND_STRING("\\u001b");
-            break;
-        case '\x1c':
-            APPEND_STRING("\\u001c");
-            break;
-        case '\x1d':
-            APPEND_STRING("\\u001d");
-            break;
-        case '\x1e':
-            APPEND_STRING("\\u001e");
-            break;
-        case '\x1f':
-            APPEND_STRING("\\u001f");
-            break;
-        default:
-            if (buf != NULL) {
-                buf[0] = c;
-                buf += 1;
-            }
-            written_total += 1;
+        default: /* remaining control characters as \u00xx */
+            escape[4] = hex_digits[c >> 4];
+            escape[5] = hex_digits[c & 0xF];
+            output_append(out, escape, sizeof(escape));
             break;
         }
     }
     APPEND_STRING("\"");
-    return written_total;
 }
 
-static int append_indent(char *buf, int level)
+static void append_indent(JSON_Output *out, int level)
 {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++) {
         APPEND_STRING("    ");
     }
-    return written_total;
-}
-
-static int append_string(char *buf, const char *string)
-{
-    if (buf == NULL) {
-        return (int)strlen(string);
-    }
-    return sprintf(buf, "%s", string);
 }
 
 #undef APPEND_STRING
-#undef APPEND_INDENT
 
 /* Parser API */
 JSON_Value *json_parse_string(const char *string)
@@ -1222,7 +1498,36 @@ JSON_Value *json_parse_string(const char *string)
     if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
         string = string + 3; /* Support for UTF-8 BOM */
     }
-    return parse_value((const char **)&string, 0);
+    return parse_value((const char **)&string, 0, 0);
+}
+
+JSON_Value *json_parse_stringn(const char *string, size_t string_len)
+{
+    JSON_Value *result = NULL;
+    char *string_copy = NULL;
+    if (string == NULL) {
+        return NULL;
+    }
+    string_copy = parson_strndup(string, string_len);
+    if (string_copy == NULL) {
+        return NULL;
+    }
+    result = json_parse_string(string_copy);
+    parson_free(string_copy);
+    return result;
+}
+
+JSON_Value *json_parse_string_in_situ(char *buffer, size_t string_len)
+{
+    const char *string = buffer;
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer[string_len] = '\0';
+    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
+        string = string + 3; /* Support for UTF-8 BOM */
+    }
+    return parse_value(&string, 0, 1);
 }
 
 JSON_Value *json_parse_string_with_comments(const char *string)
@@ -1236,11 +1541,295 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
+    result = parse_value((const char **)&string_mutable_copy_ptr, 0, 0);
     parson_free(string_mutable_copy);
     return result;
 }
 
+/* Validator
+   Checks the grammar of RFC 8259 without building values, so it never allocates. Nesting is
+   tracked in a bit per level rather than by recursion. */
+
+#define VALIDATOR_IS_WHITESPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+#define VALIDATOR_SKIP_WHITESPACES(str, end)                  \
+    while ((str) < (end) && VALIDATOR_IS_WHITESPACE(*(str))) { \
+        (str)++;                                              \
+    }
+
+static int validate_string(const char **string, const char *end)
+{
+    const char *run = NULL, *p = *string + 1;
+    if (*string == end || **string != '\"') {
+        return 0;
+    }
+    for (;;) {
+        run = p;
+        p += span_plain(p, (size_t)(end - p), 0);
+        if (!is_valid_utf8(run, (size_t)(p - run)) || p == end) {
+            return 0;
+        }
+        if (*p == '\"') {
+            *string = p + 1;
+            return 1;
+        }
+        if (*p != '\\' || ++p == end) {
+            return 0; /* control character or escape at the end */
+        }
+        if (*p == 'u') {
+            if (end - p < 5 || hex_char_to_int(p[1]) < 0 || hex_char_to_int(p[2]) < 0 ||
+                hex_char_to_int(p[3]) < 0 || hex_char_to_int(p[4]) < 0) {
+                return 0;
+            }
+            p += 5;
+        } else if (*p != '\0' && strchr("\"\\/bfnrt", *p) != NULL) {
+            p++;
+        } else {
+            return 0;
+        }
+    }
+}
+
+static int validate_member_name(const char **string, const char *end)
+{
+    VALIDATOR_SKIP_WHITESPACES(*string, end);
+    if (!validate_string(string, end)) {
+        return 0;
+    }
+    VALIDATOR_SKIP_WHITESPACES(*string, end);
+    if (*string == end || **string != ':') {
+        return 0;
+    }
+    (*string)++;
+    return 1;
+}
+
+static int validate_number(const char **string, const char *end)
+{
+    const char *p = *string, *digits = NULL;
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p < end && *p == '0') {
+        p++;
+    } else {
+        for (digits = p; p < end && isdigit((unsigned char)*p); p++)
+            ;
+        if (p == digits) {
+            return 0;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (digits = ++p; p < end && isdigit((unsigned char)*p); p++)
+            ;
+        if (p == digits) {
+            return 0;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        for (digits = p; p < end && isdigit((unsigned char)*p); p++)
+            ;
+        if (p == digits) {
+            return 0;
+        }
+    }
+    *string = p;
+    return 1;
+}
+
+static int validate_literal(const char **string, const char *end, const char *literal,
+                            size_t literal_len)
+{
+    if ((size_t)(end - *string) < literal_len || strncmp(*string, literal, literal_len) != 0) {
+        return 0;
+    }
+    *string += literal_len;
+    return 1;
+}
+
+int json_is_well_formed(const char *string, size_t string_len)
+{
+    unsigned char is_object[MAX_NESTING / 8]; /* one bit per open container */
+    const char *p = string, *end = string + string_len;
+    size_t depth = 0;
+    int in_object = 0;
+    if (string == NULL) {
+        return 0;
+    }
+    for (;;) {
+        /* a value is expected */
+        VALIDATOR_SKIP_WHITESPACES(p, end);
+        if (p == end) {
+            return 0;
+        }
+        if (*p == '{' || *p == '[') {
+            if (depth == MAX_NESTING) {
+                return 0;
+            }
+            in_object = *p == '{';
+            if (in_object) {
+                is_object[depth / 8] |= (unsigned char)(1u << (depth % 8));
+            } else {
+                is_object[depth / 8] &= (unsigned char)~(1u << (depth % 8));
+            }
+            depth++;
+            p++;
+            VALIDATOR_SKIP_WHITESPACES(p, end);
+            if (p < end && *p == (in_object ? '}' : ']')) {
+                p++;
+                depth--;
+            } else {
+                if (in_object && !validate_member_name(&p, end)) {
+                    return 0;
+                }
+                continue;
+            }
+        } else if (*p == '\"') {
+            if (!validate_string(&p, end)) {
+                return 0;
+            }
+        } else if (*p == 't') {
+            if (!validate_literal(&p, end, "true", 4)) {
+                return 0;
+            }
+        } else if (*p == 'f') {
+            if (!validate_literal(&p, end, "false", 5)) {
+                return 0;
+            }
+        } else if (*p == 'n') {
+            if (!validate_literal(&p, end, "null", 4)) {
+                return 0;
+            }
+        } else if (!validate_number(&p, end)) {
+            return 0;
+        }
+        /* a value is complete, close containers until the next element or the end */
+        for (;;) {
+            VALIDATOR_SKIP_WHITESPACES(p, end);
+            if (depth == 0) {
+                return p == end;
+            }
+            if (p == end) {
+                return 0;
+            }
+            in_object = (is_object[(depth - 1) / 8] >> ((depth - 1) % 8)) & 1;
+            if (*p == ',') {
+                p++;
+                if (in_object && !validate_member_name(&p, end)) {
+                    return 0;
+                }
+                break;
+            }
+            if (*p != (in_object ? '}' : ']')) {
+                return 0;
+            }
+            p++;
+            depth--;
+        }
+    }
+}
+
+/* Steps over one value, only matching up brackets and strings inside containers */
+static int skip_value(const char **string, const char *end)
+{
+    const char *p = *string, *token = NULL;
+    size_t depth = 0;
+    do {
+        VALIDATOR_SKIP_WHITESPACES(p, end);
+        if (p == end) {
+            return 0;
+        }
+        switch (*p) {
+        case '\"':
+            if (!validate_string(&p, end)) {
+                return 0;
+            }
+            break;
+        case '{':
+        case '[':
+            depth++;
+            p++;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return 0;
+            }
+            depth--;
+            p++;
+            break;
+        case ',':
+        case ':':
+            if (depth == 0) {
+                return 0;
+            }
+            p++;
+            break;
+        default: /* number or literal */
+            for (token = p; p < end && !VALIDATOR_IS_WHITESPACE(*p) && *p != ',' && *p != ':' && *p != '{' &&
+                            *p != '}' && *p != '[' && *p != ']' && *p != '\"';
+                 p++)
+                ;
+            if (p == token) {
+                return 0;
+            }
+            break;
+        }
+    } while (depth > 0);
+    *string = p;
+    return 1;
+}
+
+int json_find_member(const char *string, size_t string_len, const char *name, const char **value,
+                     size_t *value_len)
+{
+    const char *p = string, *end = string + string_len, *member = NULL, *start = NULL;
+    size_t name_len = 0;
+    if (string == NULL || name == NULL || value == NULL || value_len == NULL) {
+        return 0;
+    }
+    name_len = strlen(name);
+    VALIDATOR_SKIP_WHITESPACES(p, end);
+    if (p == end || *p != '{') {
+        return 0;
+    }
+    p++;
+    VALIDATOR_SKIP_WHITESPACES(p, end);
+    if (p < end && *p == '}') {
+        return 0;
+    }
+    for (;;) {
+        VALIDATOR_SKIP_WHITESPACES(p, end);
+        member = p + 1;
+        if (!validate_member_name(&p, end)) {
+            return 0;
+        }
+        VALIDATOR_SKIP_WHITESPACES(p, end);
+        start = p;
+        if (!skip_value(&p, end)) {
+            return 0;
+        }
+        /* member runs up to the closing quote, which validate_member_name stepped over */
+        if ((size_t)(start - member) > name_len && memcmp(member, name, name_len) == 0 &&
+            member[name_len] == '\"') {
+            *value = start;
+            *value_len = (size_t)(p - start);
+            return 1;
+        }
+        VALIDATOR_SKIP_WHITESPACES(p, end);
+        if (p == end || *p != ',') {
+            return 0;
+        }
+        p++;
+    }
+}
+
+#undef VALIDATOR_IS_WHITESPACE
+#undef VALIDATOR_SKIP_WHITESPACES
+
 /* JSON Object API */
 
 JSON_Value *json_object_get_value(const JSON_Object *object, const char *name)
@@ -1312,6 +1901,173 @@ int json_object_dotget_boolean(const JSON_Object *object, const char *name)
     return json_value_get_boolean(json_object_dotget_value(object, name));
 }
 
+/* JSON Path API */
+
+/* Compiled paths are usually held for the life of the app, so they use malloc and free directly
+   rather than the allocation functions, which may hand out memory that is released in bulk. */
+
+JSON_Path *json_path_compile(const char *path)
+{
+    return json_path_compile_set(&path, 1);
+}
+
+JSON_Path *json_path_compile_set(const char *const *paths, size_t count)
+{
+    JSON_Path *compiled = NULL;
+    JSON_Path_Node *node = NULL;
+    size_t i, j, names_len = 0, max_nodes = 0, parent = 0;
+    const char *segment = NULL;
+    char *names_cursor = NULL, *dot_position = NULL;
+    if (paths == NULL || count == 0) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if (paths[i] == NULL) {
+            return NULL;
+        }
+        for (segment = paths[i]; *segment; segment++) {
+            max_nodes += *segment == '.';
+        }
+        max_nodes++;
+        names_len += (size_t)(segment - paths[i]) + 1;
+    }
+    compiled = (JSON_Path *)malloc(sizeof(JSON_Path));
+    if (compiled == NULL) {
+        return NULL;
+    }
+    compiled->node_count = 0;
+    compiled->path_count = count;
+    compiled->nodes = (JSON_Path_Node *)malloc(max_nodes * sizeof(JSON_Path_Node));
+    compiled->leaves = (size_t *)malloc(count * sizeof(size_t));
+    compiled->resolved = (JSON_Value **)malloc(max_nodes * sizeof(JSON_Value *));
+    compiled->names = (char *)malloc(names_len);
+    if (compiled->nodes == NULL || compiled->leaves == NULL || compiled->resolved == NULL ||
+        compiled->names == NULL) {
+        json_path_free(compiled);
+        return NULL;
+    }
+    names_cursor = compiled->names;
+    for (i = 0; i < count; i++) {
+        parent = PATH_NODE_ROOT;
+        segment = names_cursor;
+        names_cursor = strcpy(names_cursor, paths[i]) + strlen(paths[i]) + 1;
+        for (;;) {
+            dot_position = strchr(segment, '.');
+            if (dot_position != NULL) {
+                *dot_position = '\0';
+            }
+            /* share the node if an earlier path already reached this prefix */
+            for (j = parent == PATH_NODE_ROOT ? 0 : parent + 1; j < compiled->node_count; j++) {
+                node = &compiled->nodes[j];
+                if (node->parent == parent && strcmp(node->name, segment) == 0) {
+                    break;
+                }
+            }
+            if (j == compiled->node_count) {
+                node = &compiled->nodes[compiled->node_count++];
+                node->name = segment;
+                node->name_len = strlen(segment);
+                node->hash = hash_string(segment, node->name_len);
+                node->parent = parent;
+            }
+            parent = j;
+            if (dot_position == NULL) {
+                break;
+            }
+            segment = dot_position + 1;
+        }
+        compiled->leaves[i] = parent;
+    }
+    return compiled;
+}
+
+void json_path_free(JSON_Path *path)
+{
+    if (path == NULL) {
+        return;
+    }
+    free(path->nodes);
+    free(path->leaves);
+    free(path->resolved);
+    free(path->names);
+    free(path);
+}
+
+size_t json_path_get_count(const JSON_Path *path)
+{
+    return path ? path->path_count : 0;
+}
+
+JSON_Value *json_path_get_value(const JSON_Object *object, const JSON_Path *path)
+{
+    const JSON_Path_Node *node = NULL;
+    JSON_Value *value = NULL;
+    size_t i, index;
+    if (object == NULL || path == NULL) {
+        return NULL;
+    }
+    for (i = 0; i <= path->leaves[0]; i++) {
+        node = &path->nodes[i];
+        index = json_object_find_index_hashed(object, node->name, node->name_len, &node->hash);
+        if (index == OBJECT_INDEX_NOT_FOUND) {
+            return NULL;
+        }
+        value = object->values[index];
+        object = json_value_get_object(value);
+    }
+    return value;
+}
+
+const char *json_path_get_string(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_string(json_path_get_value(object, path));
+}
+
+double json_path_get_number(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_number(json_path_get_value(object, path));
+}
+
+JSON_Object *json_path_get_object(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_object(json_path_get_value(object, path));
+}
+
+JSON_Array *json_path_get_array(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_array(json_path_get_value(object, path));
+}
+
+int json_path_get_boolean(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_boolean(json_path_get_value(object, path));
+}
+
+size_t json_path_get_values(const JSON_Object *object, const JSON_Path *path, JSON_Value **values)
+{
+    const JSON_Path_Node *node = NULL;
+    const JSON_Object *parent_object = NULL;
+    size_t i, index, found = 0;
+    if (path == NULL || values == NULL) {
+        return 0;
+    }
+    /* parents precede their children, so one pass resolves every node */
+    for (i = 0; i < path->node_count; i++) {
+        node = &path->nodes[i];
+        parent_object = node->parent == PATH_NODE_ROOT
+                            ? object
+                            : json_value_get_object(path->resolved[node->parent]);
+        index = json_object_find_index_hashed(parent_object, node->name, node->name_len,
+                                              &node->hash);
+        path->resolved[i] = index == OBJECT_INDEX_NOT_FOUND ? NULL : parent_object->values[index];
+    }
+    for (i = 0; i < path->path_count; i++) {
+        values[i] = path->resolved[path->leaves[i]];
+        found += values[i] != NULL;
+    }
+    return found;
+}
+
 size_t json_object_get_count(const JSON_Object *object)
 {
     return object ? object->count : 0;
@@ -1448,7 +2204,9 @@ void json_value_free(JSON_Value *value)
         json_object_free(value->value.object);
         break;
     case JSONString:
-        parson_free(value->value.string);
+        if (!(value->flags & VALUE_FLAG_BORROWED_STRING)) {
+            parson_free(value->value.string);
+        }
         break;
     case JSONArray:
         json_array_free(value->value.array);
@@ -1467,6 +2225,7 @@ JSON_Value *json_value_init_object(void)
     }
     new_value->parent = NULL;
     new_value->type = JSONObject;
+    new_value->flags = 0;
     new_value->value.object = json_object_init(new_value);
     if (!new_value->value.object) {
         parson_free(new_value);
@@ -1483,6 +2242,7 @@ JSON_Value *json_value_init_array(void)
     }
     new_value->parent = NULL;
     new_value->type = JSONArray;
+    new_value->flags = 0;
     new_value->value.array = json_array_init(new_value);
     if (!new_value->value.array) {
         parson_free(new_value);
@@ -1526,6 +2286,7 @@ JSON_Value *json_value_init_number(double number)
     }
     new_value->parent = NULL;
     new_value->type = JSONNumber;
+    new_value->flags = 0;
     new_value->value.number = number;
     return new_value;
 }
@@ -1538,6 +2299,7 @@ JSON_Value *json_value_init_boolean(int boolean)
     }
     new_value->parent = NULL;
     new_value->type = JSONBoolean;
+    new_value->flags = 0;
     new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
 }
@@ -1550,6 +2312,7 @@ JSON_Value *json_value_init_null(void)
     }
     new_value->parent = NULL;
     new_value->type = JSONNull;
+    new_value->flags = 0;
     return new_value;
 }
 
@@ -1635,87 +2398,80 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
 
 size_t json_serialization_size(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Output out = {NULL, 0, 0, 0, 0};
+    if (json_serialize_to_output(value, &out, 0) == JSONFailure) {
+        return 0;
+    }
+    return out.size + 1;
 }
 
-JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
+/* Growing doubles the buffer, so trim the result when that left more than a starting buffer's
+   worth unused. Returns the string, or NULL if it was freed for lack of memory. */
+static char *output_trim(JSON_Output *out)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
+    char *trimmed = NULL;
+    if (out->capacity - (out->size + 1) <= STARTING_OUTPUT_CAPACITY) {
+        return out->buf;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0) {
-        return JSONFailure;
+    trimmed = (char *)parson_malloc(out->size + 1);
+    if (trimmed == NULL) {
+        return out->buf; /* the larger buffer is still a valid result */
     }
-    return JSONSuccess;
+    memcpy(trimmed, out->buf, out->size + 1);
+    parson_free(out->buf);
+    return trimmed;
 }
 
-char *json_serialize_to_string(const JSON_Value *value)
+JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
+    JSON_Output out = {NULL, 0, 0, 0, 0};
     if (buf == NULL) {
-        return NULL;
+        return JSONFailure;
     }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
+    out.buf = buf;
+    out.capacity = buf_size_in_bytes;
+    return json_serialize_to_output(value, &out, 0);
+}
+
+char *json_serialize_to_string(const JSON_Value *value)
+{
+    JSON_Output out = {NULL, 0, 0, 1, 0};
+    if (json_serialize_to_output(value, &out, 0) == JSONFailure) {
+        parson_free(out.buf);
         return NULL;
     }
-    return buf;
+    return output_trim(&out);
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Output out = {NULL, 0, 0, 0, 0};
+    if (json_serialize_to_output(value, &out, 1) == JSONFailure) {
+        return 0;
+    }
+    return out.size + 1;
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0) {
+    JSON_Output out = {NULL, 0, 0, 0, 0};
+    if (buf == NULL) {
         return JSONFailure;
     }
-    return JSONSuccess;
+    out.buf = buf;
+    out.capacity = buf_size_in_bytes;
+    return json_serialize_to_output(value, &out, 1);
 }
 
 char *json_serialize_to_string_pretty(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
+    JSON_Output out = {NULL, 0, 0, 1, 0};
+    if (json_serialize_to_output(value, &out, 1) == JSONFailure) {
+        parson_free(out.buf);
         return NULL;
     }
-    return buf;
+    return output_trim(&out);
 }
 
 void json_free_serialized_string(char *string)
@@ -1880,16 +2636,14 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
     if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_find_index(object, name, strlen(name));
+    if (i != OBJECT_INDEX_NOT_FOUND) { /* free and overwrite old value */
+        old_value = object->values[i];
+        value->flags |= old_value->flags & VALUE_FLAG_BORROWED_NAME; /* name stays, so does its owner */
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -2028,9 +2782,10 @@ JSON_Status json_object_clear(JSON_Object *object)
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        json_object_free_name(object, i);
         json_value_free(object->values[i]);
     }
+    json_object_index_free(object);
     object->count = 0;
     return JSONSuccess;
 }
@@ -0,0 +1,199 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+/* Fragmentation soak for dx_json_pool. Keeps a changing set of documents of mixed shapes and
+   lifetimes alive for a million operations, checking every document survives a serialize round
+   trip, that no size class runs out however the frees interleave, so only requests larger than
+   the largest class reach malloc, and that every block comes back. Runs on the host:
+
+     gcc -O2 -I include tests/dx_json_pool_soak_test.c src/dx_json_pool.c src/parson.c -lm -lpthread -o soak && ./soak
+
+   Exits with 0 when every check passes. */
+
+#include "dx_json_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SOAK_OPERATIONS 1000000
+#define SOAK_LIVE_DOCUMENTS 6
+#define SOAK_REPORT_EVERY (SOAK_OPERATIONS / 10)
+
+typedef struct SOAK_DOCUMENT {
+    JSON_Value *value;
+    char text[512];
+} SOAK_DOCUMENT;
+
+static SOAK_DOCUMENT documents[SOAK_LIVE_DOCUMENTS];
+static unsigned int seed = 1;
+static unsigned long failures;
+
+static unsigned int Random(unsigned int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % range;
+}
+
+static void Check(bool condition, const char *what)
+{
+    if (!condition) {
+        if (failures++ < 10) {
+            printf("FAILED: %s\n", what);
+        }
+    }
+}
+
+static size_t AppendString(char *text, size_t length, size_t maxLength)
+{
+    text[length++] = '"';
+    for (size_t i = 0; i < maxLength; i++) {
+        text[length++] = (char)('a' + Random(26));
+    }
+    text[length++] = '"';
+    return length;
+}
+
+/// <summary>
+/// Compact JSON in the form parson serializes it, so a round trip must give the same text. Mixes
+/// short and long strings, numbers, nested objects and arrays to exercise every size class.
+/// </summary>
+static void GenerateDocument(char *text)
+{
+    size_t length = 0;
+    unsigned int members = 1 + Random(12);
+
+    text[length++] = '{';
+    for (unsigned int i = 0; i < members; i++) {
+        if (i > 0) {
+            text[length++] = ',';
+        }
+        length += (size_t)sprintf(text + length, "\"m%u\":", i);
+
+        switch (Random(4)) {
+        case 0:
+            length += (size_t)sprintf(text + length, "%u", Random(100000));
+            break;
+        case 1:
+            length = AppendString(text, length, 1 + Random(i % 3 == 0 ? 40 : 8));
+            break;
+        case 2:
+            length += (size_t)sprintf(text + length, "{\"x\":%u,\"y\":true}", Random(1000));
+            break;
+        default:
+            text[length++] = '[';
+            for (unsigned int item = 0, items = Random(4); item < items; item++) {
+                length += (size_t)sprintf(text + length, item > 0 ? ",%u" : "%u", Random(10));
+            }
+            text[length++] = ']';
+            break;
+        }
+    }
+    text[length++] = '}';
+    text[length] = '\0';
+}
+
+static size_t BlocksInUse(void)
+{
+    DX_JSON_POOL_STATS stats;
+    size_t inUse;
+
+    dx_jsonPoolGetStats(&stats);
+    inUse = stats.fallbackInUse;
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        inUse += stats.sizeClass[i].inUse;
+    }
+    return inUse;
+}
+
+static void PrintStats(const char *label)
+{
+    DX_JSON_POOL_STATS stats;
+
+    dx_jsonPoolGetStats(&stats);
+    printf("%-10s", label);
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        printf(" %zu:%zu/%zu", stats.sizeClass[i].blockSize, stats.sizeClass[i].highWater, stats.sizeClass[i].blockCount);
+    }
+    printf("  malloc %zu, most live %zu\n", stats.fallbackTotal, stats.fallbackHighWater);
+}
+
+static void SoakChurn(void)
+{
+    DX_JSON_POOL_STATS stats;
+    char *serialized;
+
+    for (unsigned long operation = 1; operation <= SOAK_OPERATIONS; operation++) {
+        SOAK_DOCUMENT *document = &documents[Random(SOAK_LIVE_DOCUMENTS)];
+
+        if (document->value != NULL && Random(3) != 0) {
+            // Serialize a live document, allocating a string while others stay live
+            serialized = json_serialize_to_string(document->value);
+            Check(serialized != NULL && strcmp(serialized, document->text) == 0, "round trip");
+            json_free_serialized_string(serialized);
+        } else {
+            // Replace the document, so lifetimes overlap in a different order every time
+            json_value_free(document->value);
+            GenerateDocument(document->text);
+            document->value = json_parse_string(document->text);
+            Check(document->value != NULL, "parse");
+        }
+
+        if (operation % SOAK_REPORT_EVERY == 0) {
+            char label[16];
+            snprintf(label, sizeof(label), "%luk", operation / 1000);
+            PrintStats(label);
+        }
+    }
+
+    // A class that ran out would show a high water mark at its block count. Oversized requests,
+    // such as growing serialize buffers, are at most one per document plus the string.
+    dx_jsonPoolGetStats(&stats);
+    for (size_t i = 0; i < DX_JSON_POOL_CLASS_COUNT; i++) {
+        Check(stats.sizeClass[i].highWater < stats.sizeClass[i].blockCount, "no size class ran out");
+    }
+    Check(stats.fallbackHighWater <= SOAK_LIVE_DOCUMENTS + 1, "malloc only for oversized requests");
+    Check(!dx_jsonPoolReset(), "reset refused while documents are live");
+    Check(BlocksInUse() > 0, "refused reset left the blocks alone");
+
+    for (size_t i = 0; i < SOAK_LIVE_DOCUMENTS; i++) {
+        json_value_free(documents[i].value);
+        documents[i].value = NULL;
+    }
+    Check(BlocksInUse() == 0, "every block returned");
+    Check(dx_jsonPoolReset(), "reset once nothing is live");
+}
+
+static void SpillToMalloc(void)
+{
+    DX_JSON_POOL_STATS stats;
+    JSON_Value *array = json_value_init_array();
+
+    // Far more values than the 16 and 32 byte classes hold, so the pool spills upwards and then
+    // into malloc
+    for (int i = 0; i < DX_JSON_POOL_BLOCKS_16 + DX_JSON_POOL_BLOCKS_32 + DX_JSON_POOL_BLOCKS_64 + 64; i++) {
+        json_array_append_number(json_array(array), i);
+    }
+
+    dx_jsonPoolGetStats(&stats);
+    Check(stats.fallbackInUse > 0, "exhausted slabs fall back to malloc");
+    Check(json_array_get_count(json_array(array)) == DX_JSON_POOL_BLOCKS_16 + DX_JSON_POOL_BLOCKS_32 +
+                                                         DX_JSON_POOL_BLOCKS_64 + 64,
+          "spilled values intact");
+    PrintStats("spill");
+
+    json_value_free(array);
+    dx_jsonPoolGetStats(&stats);
+    Check(stats.fallbackInUse == 0 && BlocksInUse() == 0, "fallback blocks freed");
+    Check(dx_jsonPoolReset(), "reset after spill");
+}
+
+int main(void)
+{
+    dx_jsonPoolInit();
+
+    SoakChurn();
+    SpillToMalloc();
+
+    printf("%lu failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
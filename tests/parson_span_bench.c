@@ -0,0 +1,108 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+/* Throughput of the parson string paths the span kernels speed up: parsing and serializing a
+   document of long, mostly plain strings, and validating a string with json_value_init_string.
+   Build it once per kernel set, and against an older src/parson.c to compare:
+
+     gcc -O2 -I include tests/parson_span_bench.c src/parson.c -lm -o bench && ./bench                         SSE2 on x86
+     gcc -O2 -DPARSON_SIMD_DISABLED -I include tests/parson_span_bench.c src/parson.c -lm -o bench && ./bench  SWAR and scalar
+
+   Prints the best of several rounds, so the numbers are only comparable on the same machine. */
+
+#include "parson.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PROPERTIES 32
+#define BENCH_STRING_LENGTH 240
+#define BENCH_ROUNDS 7
+#define BENCH_DOCUMENT_ITERATIONS 3000
+#define BENCH_STRING_ITERATIONS 200000
+
+static char document[BENCH_PROPERTIES * (BENCH_STRING_LENGTH + 16) + 2];
+static char serialized[sizeof(document)];
+
+static double NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/// <summary>
+/// Twin-like document: every property is a long run of plain characters with an escape now and
+/// then, which is the case the kernels are for.
+/// </summary>
+static size_t GenerateDocument(void)
+{
+    size_t length = 0;
+
+    document[length++] = '{';
+    for (int property = 0; property < BENCH_PROPERTIES; property++) {
+        length += (size_t)sprintf(document + length, "%s\"line_%d\":\"", property > 0 ? "," : "", property);
+        for (int i = 0; i < BENCH_STRING_LENGTH; i++) {
+            if (i % 97 == 95) {
+                document[length++] = '\\';
+                document[length++] = 'n';
+                i++;
+            } else {
+                document[length++] = (char)('a' + (i * 7 + property) % 26);
+            }
+        }
+        document[length++] = '"';
+    }
+    document[length++] = '}';
+    document[length] = '\0';
+    return length;
+}
+
+int main(void)
+{
+    static char text[BENCH_STRING_LENGTH + 1];
+    double bestParse = 1e18, bestSerialize = 1e18, bestValidate = 1e18, start, elapsed;
+    size_t documentLength = GenerateDocument();
+    JSON_Value *value = json_parse_string(document);
+
+    if (value == NULL || json_serialize_to_buffer(value, serialized, sizeof(serialized)) != JSONSuccess) {
+        printf("benchmark document does not round trip\n");
+        return 1;
+    }
+
+    // Mostly ASCII with one two byte sequence, so validation takes both paths
+    memset(text, 'x', BENCH_STRING_LENGTH);
+    memcpy(text + 100, "\xc3\xa9", 2);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        start = NowNs();
+        for (int i = 0; i < BENCH_DOCUMENT_ITERATIONS; i++) {
+            json_value_free(json_parse_string(document));
+        }
+        elapsed = (NowNs() - start) / BENCH_DOCUMENT_ITERATIONS;
+        bestParse = elapsed < bestParse ? elapsed : bestParse;
+
+        start = NowNs();
+        for (int i = 0; i < BENCH_DOCUMENT_ITERATIONS; i++) {
+            json_serialize_to_buffer(value, serialized, sizeof(serialized));
+        }
+        elapsed = (NowNs() - start) / BENCH_DOCUMENT_ITERATIONS;
+        bestSerialize = elapsed < bestSerialize ? elapsed : bestSerialize;
+
+        start = NowNs();
+        for (int i = 0; i < BENCH_STRING_ITERATIONS; i++) {
+            json_value_free(json_value_init_string(text));
+        }
+        elapsed = (NowNs() - start) / BENCH_STRING_ITERATIONS;
+        bestValidate = elapsed < bestValidate ? elapsed : bestValidate;
+    }
+
+    printf("parse        %6zu B  %8.0f ns  %6.0f MB/s\n", documentLength, bestParse, documentLength / bestParse * 1e3);
+    printf("serialize    %6zu B  %8.0f ns  %6.0f MB/s\n", strlen(serialized), bestSerialize,
+           strlen(serialized) / bestSerialize * 1e3);
+    printf("init_string  %6d B  %8.0f ns\n", BENCH_STRING_LENGTH, bestValidate);
+
+    json_value_free(value);
+    return 0;
+}
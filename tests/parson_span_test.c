@@ -0,0 +1,114 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+/* Checks the span kernels in parson.c against byte at a time reference loops. The kernels are
+   static, so this includes parson.c. Run it for every kernel set that can be built:
+
+     gcc -O2 -I include tests/parson_span_test.c -lm -o span && ./span                         SSE2 on x86
+     gcc -O2 -DPARSON_SIMD_DISABLED -I include tests/parson_span_test.c -lm -o span && ./span  SWAR and scalar
+
+   Exits with 0 when every kernel result matches the reference. */
+
+#include "../src/parson.c"
+
+#include <stdio.h>
+
+#if defined(PARSON_SIMD_SSE2)
+#define KERNELS "SSE2"
+#else
+#define KERNELS "SWAR and scalar"
+#endif
+
+static const char plain_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 !#$%&'()*+,-.:;<=>?@[]^_`{|}~"
+                                  "\xc3\xa9";
+
+static unsigned long checks, mismatches;
+
+static size_t reference_ascii(const char *string, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (unsigned char)string[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+static size_t reference_plain(const char *string, size_t n, int stop_at_slash)
+{
+    size_t i;
+    unsigned char c;
+    for (i = 0; i < n; i++) {
+        c = (unsigned char)string[i];
+        if (c < 0x20 || c == '\"' || c == '\\' || (stop_at_slash && c == '/')) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void check(const char *string, size_t n)
+{
+    if (span_ascii(string, n) != reference_ascii(string, n)) {
+        mismatches++;
+    }
+    if (span_plain(string, n, 0) != reference_plain(string, n, 0)) {
+        mismatches++;
+    }
+    if (span_plain(string, n, 1) != reference_plain(string, n, 1)) {
+        mismatches++;
+    }
+    checks += 3;
+}
+
+static char plain_at(size_t i)
+{
+    return plain_chars[i % (sizeof(plain_chars) - 1)];
+}
+
+int main(void)
+{
+    static char buffer[128];
+    unsigned int seed = 1;
+    size_t offset, n, pos, i;
+    int c;
+    char *string;
+
+    /* Every byte value at every position, for every alignment and for lengths spanning the
+       vector, SWAR and scalar tails. A second special byte later on catches kernels that report
+       the wrong one of several. */
+    for (offset = 0; offset < 16; offset++) {
+        string = buffer + offset;
+        for (n = 0; n <= 64; n++) {
+            for (i = 0; i < n; i++) {
+                string[i] = plain_at(i);
+            }
+            check(string, n);
+            for (c = 0; c < 256; c++) {
+                for (pos = 0; pos < n; pos++) {
+                    string[pos] = (char)c;
+                    check(string, n);
+                    if (pos + 3 < n) {
+                        string[pos + 3] = '\x01';
+                        check(string, n);
+                        string[pos + 3] = plain_at(pos + 3);
+                    }
+                    string[pos] = plain_at(pos);
+                }
+            }
+        }
+    }
+
+    /* Random strings, mostly plain with a special byte now and then */
+    for (i = 0; i < 1000000; i++) {
+        seed = seed * 1103515245 + 12345;
+        n = (seed >> 16) % 96;
+        for (pos = 0; pos < n; pos++) {
+            seed = seed * 1103515245 + 12345;
+            buffer[pos] = (seed >> 16) & 7 ? plain_at(seed >> 19) : (char)(seed >> 24);
+        }
+        check(buffer, n);
+    }
+
+    printf("%s kernels: %lu checks, %lu mismatches\n", KERNELS, checks, mismatches);
+    return mismatches == 0 ? 0 : 1;
+}